@@ -25,6 +25,18 @@
  #define WIRE Wire1
 #endif
 
+// The size of the Wire transmit buffer. Transmissions longer than this are
+// truncated
+#ifdef BUFFER_LENGTH
+ #define WIRE_BUFFER_LENGTH BUFFER_LENGTH
+#else
+ #define WIRE_BUFFER_LENGTH 32
+#endif
+
+// The number of channels that can be written in a single transmission (one
+// byte of the buffer is used by the register address, each channel takes 4)
+#define CHANNELS_PER_TRANSMISSION ((WIRE_BUFFER_LENGTH - 1) / 4)
+
 // Set to true to print some debug messages, or false to disable them.
 #define ENABLE_DEBUG_OUTPUT false
 
@@ -81,6 +93,31 @@ void Adafruit_PWMServoDriver::setPWM(uint8_t num, uint16_t on, uint16_t off) {
   WIRE.endTransmission();
 }
 
+// Sets the OFF value of num consecutive channels starting from first, with the
+// ON value at 0. The MODE1 register is set to auto-increment in setPWMFreq(),
+// so the registers of consecutive channels are written in a single
+// transmission, with as many channels as the Wire buffer allows. off must
+// contain num values.
+void Adafruit_PWMServoDriver::setPWMRange(uint8_t first, uint8_t num, const uint16_t *off) {
+  while (num > 0) {
+    const uint8_t n = min(num, CHANNELS_PER_TRANSMISSION);
+
+    WIRE.beginTransmission(_i2caddr);
+    WIRE.write(LED0_ON_L+4*first);
+    for (uint8_t i = 0; i < n; i++) {
+      WIRE.write(0);
+      WIRE.write(0);
+      WIRE.write(off[i]);
+      WIRE.write(off[i]>>8);
+    }
+    WIRE.endTransmission();
+
+    first += n;
+    off += n;
+    num -= n;
+  }
+}
+
 // Sets pin without having to deal with on/off tick placement and properly handles
 // a zero value as completely off.  Optional invert parameter supports inverting
 // the pulse for sinking to ground.  Val should be a value from 0 to 4095 inclusive.
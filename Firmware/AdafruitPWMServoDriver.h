@@ -50,6 +50,7 @@ class Adafruit_PWMServoDriver {
   void reset(void);
   void setPWMFreq(float freq);
   void setPWM(uint8_t num, uint16_t on, uint16_t off);
+  void setPWMRange(uint8_t first, uint8_t num, const uint16_t *off);
   void setPin(uint8_t num, uint16_t val, bool invert=false);
 
  private:
@@ -25,11 +25,20 @@
 #include "serialcommunication.h"
 #include "sequenceplayer.h"
 #include <stdlib.h>
+#include <string.h>
 // import backpack library to use LED backpacks
 #include "AdafruitLEDBackpack.h"
 // import GFX library to draw bitmaps on LED backpacks
 #include "AdafruitGFX.h"
 
+#ifndef CONTROL_RATE
+	// The rate of the control tick (i.e. how many times per second servos are
+	// updated) in Hz. This should not be higher than the PWM frequency set in
+	// SequencePlayer::begin() (200 Hz), typical values are 50, 100 or 200.
+	// Define this when compiling to change it
+	#define CONTROL_RATE 200
+#endif
+
 // The possible states
 enum States {IdleState, StreamMode, StreamModeStopping, ImmediateMode};
 
@@ -40,20 +49,70 @@ const unsigned int servoMid[SequencePoint::dim] = {1500, 1840, 1000, 1150, 1300,
 
 // The current status
 States status = IdleState;
-// The baud rate to use for communication with computer
+// The baud rate the communication with the computer starts at. The computer
+// can then ask for a higher rate (see SerialCommunication::maxLinkSpeed)
 const long baudRate = 115200;
+// How many milliseconds we wait for the link confirm packet after changing the
+// baud rate before going back to baudRate
+const unsigned long linkConfirmTimeout = 1000;
+// True if we changed the baud rate and are waiting for the link confirm packet.
+// The PC only sends it after receiving our echo of the link test packet, so
+// other packets do not tell us that the PC can hear us at the new rate
+bool linkUnconfirmed = false;
+// The milliseconds at which we changed the baud rate
+unsigned long linkChangeTime = 0;
 // The object that handles communication
 SerialCommunication serialCommunication;
-// The microseconds of the last loop
-unsigned long lastTime = 0;
+// The rate of the control tick in Hz, see CONTROL_RATE
+const unsigned long controlRate = CONTROL_RATE;
+// The period of the control tick in microseconds
+const unsigned long controlPeriod = 1000000 / controlRate;
+// The microseconds at which the next control tick is due
+unsigned long nextTickTime = 0;
+// The number of control ticks that ended after the next one was due. Reset
+// when a stream starts
+unsigned long tickOverruns = 0;
+// The number of times the sequence buffer ran empty while streaming, i.e. a
+// point ended before the next one arrived. Reset when a stream starts
+unsigned long streamUnderruns = 0;
+// True once a point of the current stream has been played. Before that an
+// empty buffer is not an underrun
+bool streamPlaying = false;
+// True while the buffer is empty because of an underrun
+bool inUnderrun = false;
+// The milliseconds at which the current underrun started
+unsigned long underrunStartTime = 0;
 // The object controlling the servos
 SequencePlayer sequencePlayer(servoMin, servoMax);
 // Each how many milliseconds we should send the battery charge
 const unsigned long batteryInterval = 500;
 // The milliseconds we last sent the battery charge
 unsigned long lastBatteryTime = 0;
-// This is true if the sequence buffer was full
+// The maximum number of telemetry packets per second. Each packet takes about
+// 50 bytes, so this leaves most of the bandwidth of the slowest link speed to
+// sequence points
+const unsigned char maxTelemetryRate = 50;
+// Each how many milliseconds we should send telemetry, 0 if the PC did not ask
+// for it
+unsigned long telemetryInterval = 0;
+// The milliseconds we last sent telemetry
+unsigned long lastTelemetryTime = 0;
+// The maximum duration of a control tick in microseconds since telemetry was
+// last sent
+unsigned long maxTickDuration = 0;
+// True if the PC of the current stream speaks SerialCommunication::protocolVersion
+// and so uses credits for flow control. Other PCs get a "sequence buffer full"
+// or "not full" packet after each point instead
+bool creditFlowControl = false;
+// Only used without credits: true if the sequence buffer was full
 bool sequenceBufferWasFull = false;
+// The number of sequence points the PC is allowed to send and that we have not
+// received yet. Credits are granted when slots in the sequence buffer become
+// free, so this is never greater than the number of free slots
+int grantedCredits = 0;
+// The number of sequence points lost in corrupted frames already taken into
+// account in stream mode
+unsigned long handledLostPoints = 0;
 // Battery pin
 const int batteryPin = 3;
 
@@ -101,6 +160,90 @@ void smile()
 	face.writeDisplay();
 }
 
+/**
+ * \brief Sends a debug packet with statistics of the last stream
+ *
+ * The packet contains the number of servo channel writes issued and skipped
+ * because the value did not change, the number of control tick overruns, the
+ * maximum and average lateness of point starts in microseconds, the number
+ * of corrupted frames received since the board started and the number of
+ * underruns
+ */
+void sendStreamStatistics()
+{
+	// Enough for the text and seven 32 bits numbers
+	char msg[184];
+	strcpy(msg, "PWM writes issued ");
+	ultoa(sequencePlayer.issuedWrites(), msg + strlen(msg), 10);
+	strcat(msg, " skipped ");
+	ultoa(sequencePlayer.skippedWrites(), msg + strlen(msg), 10);
+	strcat(msg, ", tick overruns ");
+	ultoa(tickOverruns, msg + strlen(msg), 10);
+	strcat(msg, ", lateness max ");
+	ultoa(sequencePlayer.maxLateness(), msg + strlen(msg), 10);
+	strcat(msg, "us avg ");
+	const unsigned long points = sequencePlayer.scheduledPoints();
+	ultoa((points == 0) ? 0 : (sequencePlayer.totalLateness() / points), msg + strlen(msg), 10);
+	strcat(msg, "us, corrupted frames ");
+	ultoa(serialCommunication.corruptedFrames(), msg + strlen(msg), 10);
+	strcat(msg, ", underruns ");
+	ultoa(streamUnderruns, msg + strlen(msg), 10);
+
+	serialCommunication.sendDebugPacket(msg);
+}
+
+/**
+ * \brief Sends a telemetry packet
+ *
+ * The packet contains the number of the current point of the stream, its
+ * phase, the time since it started, timing statistics and the PWM of servos.
+ * The maximum duration of control ticks is reset
+ */
+void sendTelemetry()
+{
+	serialCommunication.sendTelemetry(sequencePlayer.startedPoints(), sequencePlayer.phase(), sequencePlayer.pointElapsedTime() / 1000, tickOverruns, sequencePlayer.maxLateness(), maxTickDuration, sequencePlayer.commandedPwm());
+
+	maxTickDuration = 0;
+}
+
+/**
+ * \brief Performs a control tick, moving servos
+ *
+ * This is called every controlPeriod microseconds
+ */
+void controlTick()
+{
+	// Moving servos. We do this even when idle because in that case we are sure the buffer is empty
+	const bool emptyBuffer = !sequencePlayer.step();
+
+	// Keeping track of underruns. The PC is told how long each one lasted
+	// when the next point arrives
+	if (status == StreamMode) {
+		if (!emptyBuffer) {
+			if (inUnderrun) {
+				// PCs speaking older protocols do not know underrun packets
+				if (creditFlowControl) {
+					serialCommunication.sendUnderrun(millis() - underrunStartTime);
+				}
+				inUnderrun = false;
+			}
+			streamPlaying = true;
+		} else if (streamPlaying && !inUnderrun) {
+			inUnderrun = true;
+			underrunStartTime = millis();
+			++streamUnderruns;
+		}
+	}
+
+	if ((status == StreamModeStopping) && emptyBuffer) {
+		// We have finally stopped, clearing the sequence player buffer and returning idle
+		sequencePlayer.clearBuffer();
+		status = IdleState;
+		sendStreamStatistics();
+		serialCommunication.sendSequenceFinished();
+	}
+}
+
 void setup()
 {
 	// initialize Adafruit's LED backpack
@@ -126,19 +269,56 @@ void setup()
 	// Setting the point to fill. The buffer cannot be full at this stage!
 	serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
 
+	// The first control tick is performed immediately
+	nextTickTime = micros();
+
 }
 
 void loop()
 {
-	// Moving servos.We do this even when idle because in that case we are sure the buffer is empty
-	const bool emptyBuffer = !sequencePlayer.step();
+	// Performing the control tick if it is due. Serial communication and the
+	// battery check below fill the time between ticks. The difference is
+	// converted to long so that the check also works when micros() wraps
+	if (long(micros() - nextTickTime) >= 0) {
+		const unsigned long tickStartTime = micros();
+		controlTick();
 
-	if ((status == StreamModeStopping) && emptyBuffer) {
-		// We have finally stopped, clearing the sequence player buffer and returning idle
-		sequencePlayer.clearBuffer();
-		status = IdleState;
-		serialCommunication.sendSequenceFinished();
-	} else if ((status == StreamMode) && sequenceBufferWasFull && (!sequencePlayer.bufferFull())) {
+		// If the next tick is already due we cannot keep up with the control
+		// rate: counting the overrun and starting again from now instead of
+		// performing all missed ticks in a burst
+		nextTickTime += controlPeriod;
+		const unsigned long curTime = micros();
+		maxTickDuration = max(maxTickDuration, curTime - tickStartTime);
+		if (long(curTime - nextTickTime) >= 0) {
+			++tickOverruns;
+			nextTickTime = curTime + controlPeriod;
+		}
+	}
+
+	// Sequence points lost in discarded frames used a credit of the PC but
+	// will never fill a slot: granting their credits again, otherwise the
+	// window of the PC would shrink forever. Other discarded frames (pings,
+	// telemetry requests) did not use credits, so they are not counted
+	const unsigned long lostPoints = serialCommunication.lostPoints();
+	if ((status == StreamMode) && creditFlowControl) {
+		grantedCredits = max(0, grantedCredits - int(lostPoints - handledLostPoints));
+	}
+	handledLostPoints = lostPoints;
+
+	if ((status == StreamMode) && creditFlowControl) {
+		// If there are free slots that we have not granted yet, sending credits for them
+		const int newCredits = sequencePlayer.freeSlots() - grantedCredits;
+		if (newCredits > 0) {
+			// If the buffer was full, we also have to set the point to fill. The PC
+			// cannot be sending a point here because it had no credits
+			if (serialCommunication.nextSequencePointToFill() == NULL) {
+				serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+			}
+			serialCommunication.sendCredits(newCredits);
+
+			grantedCredits += newCredits;
+		}
+	} else if ((status == StreamMode) && sequenceBufferWasFull && !sequencePlayer.bufferFull()) {
 		// If the buffer was full and it is no longer full, sending a buffer not full package
 		serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
 		serialCommunication.sendBufferNotFull();
@@ -148,87 +328,151 @@ void loop()
 
 	// Checking if there are new commands
 	if (serialCommunication.commandReceived()) {
-		switch (status) {
-			case IdleState:
-				if (serialCommunication.isStartStream()) {
-					// Checking that we got the correct point dimension
-					if (serialCommunication.pointDimension() != SequencePoint::dim) {
-						serialCommunication.sendDebugPacket("Invalid point dimension");
+		// Pings and telemetry requests are handled in any state, so that
+		// latency and timing can also be measured while streaming
+		if (serialCommunication.isPing()) {
+			serialCommunication.sendPingEcho();
+		} else if (serialCommunication.isTelemetryRate()) {
+			const unsigned char rate = min(serialCommunication.requestedTelemetryRate(), maxTelemetryRate);
+			telemetryInterval = (rate == 0) ? 0 : (1000 / rate);
+			lastTelemetryTime = millis();
+		} else {
+			switch (status) {
+				case IdleState:
+					if (serialCommunication.isStartStream()) {
+						// Checking that we got the correct point dimension
+						if (serialCommunication.pointDimension() != SequencePoint::dim) {
+							serialCommunication.sendDebugPacket("Invalid point dimension");
+						} else {
+							status = StreamMode;
+							sequencePlayer.resetStatistics();
+							tickOverruns = 0;
+							streamUnderruns = 0;
+							streamPlaying = false;
+							inUnderrun = false;
+							serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+
+							creditFlowControl = (serialCommunication.pcProtocolVersion() >= SerialCommunication::protocolVersion);
+							sequenceBufferWasFull = false;
+							if (creditFlowControl) {
+								// Telling the PC how many points we can buffer, so that it
+								// can size its window
+								serialCommunication.sendStreamAccepted(SequencePlayer::bufferDepth);
+
+								// The PC sends the first point without waiting for credits, the
+								// remaining free slots are granted in the next loop
+								grantedCredits = 1;
+							}
+						}
+					} else if (serialCommunication.isProtocolVersion()) {
+						// Nothing to answer, the PC learns our version from the "stream
+						// accepted" packet
+					} else if (serialCommunication.isLinkSpeed()) {
+						// Agreeing on the highest speed we both support. The answer is sent at
+						// the current rate, then we switch. If the PC cannot talk to us at the
+						// new rate it won't send the link confirm packet and we go back to the
+						// starting rate (see below)
+						const unsigned char speed = min(serialCommunication.requestedLinkSpeed(), SerialCommunication::maxLinkSpeed);
+						serialCommunication.sendLinkSpeed(speed);
+						serialCommunication.changeBaudRate(SerialCommunication::baudRateForLinkSpeed(speed));
+						linkUnconfirmed = true;
+						linkChangeTime = millis();
+					} else if (serialCommunication.isLinkTest()) {
+						serialCommunication.sendLinkTestEcho();
+					} else if (serialCommunication.isLinkConfirm()) {
+						// The PC received our echo, keeping the new rate. The PC sends the
+						// packet again if our answer is lost, so we answer every time
+						linkUnconfirmed = false;
+						serialCommunication.sendLinkConfirmed();
+					} else if (serialCommunication.isStartImmediate()) {
+						// Checking that we got the correct point dimension
+						if (serialCommunication.pointDimension() != SequencePoint::dim) {
+							serialCommunication.sendDebugPacket("Invalid point dimension");
+						} else {
+							status = ImmediateMode;
+							serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+						}
 					} else {
-						status = StreamMode;
-						sequenceBufferWasFull = false;
-						serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+						serialCommunication.sendDebugPacket("Unexpected command");
 					}
-				} else if (serialCommunication.isStartImmediate()) {
-					// Checking that we got the correct point dimension
-					if (serialCommunication.pointDimension() != SequencePoint::dim) {
-						serialCommunication.sendDebugPacket("Invalid point dimension");
+					break;
+				case StreamMode:
+					if (serialCommunication.isSequencePoint()) {
+						// If the queue was full, sending a debug packet
+						if (serialCommunication.nextSequencePointToFill() == NULL) {
+							serialCommunication.sendDebugPacket("Sequence point received but buffer full");
+						} else {
+							// Marking the point as complete and setting the next object to fill
+							// (this is NULL if the buffer is full)
+							sequencePlayer.pointFilled();
+							serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+
+							if (creditFlowControl) {
+								// Using one credit. New credits are sent when slots become free
+								--grantedCredits;
+							} else {
+								// Telling the PC whether it can send the next point
+								sequenceBufferWasFull = sequencePlayer.bufferFull();
+								if (sequenceBufferWasFull) {
+									serialCommunication.sendBufferFull();
+								} else {
+									serialCommunication.sendBufferNotFull();
+								}
+							}
+						}
+					} else if (serialCommunication.isCreditResync()) {
+						// The PC had no credits for a while, maybe a credit packet was lost.
+						// It has no points in flight, so all free slots are its credits
+						grantedCredits = sequencePlayer.freeSlots();
+						if ((grantedCredits > 0) && (serialCommunication.nextSequencePointToFill() == NULL)) {
+							serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+						}
+						serialCommunication.sendCreditResync(grantedCredits);
+					} else if (serialCommunication.isStop()) {
+						// Setting status to stopping. We still have to play all remaining sequence points
+						status = StreamModeStopping;
 					} else {
-						status = ImmediateMode;
-						sequenceBufferWasFull = false;
-						serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+						serialCommunication.sendDebugPacket("Unexpected command");
 					}
-				} else {
-					serialCommunication.sendDebugPacket("Unexpected command");
-				}
-				break;
-			case StreamMode:
-				if (serialCommunication.isSequencePoint()) {
-					// If the queue was full, sending a debug packet
-					if (serialCommunication.nextSequencePointToFill() == NULL) {
-						serialCommunication.sendDebugPacket("Sequence point received but buffer full");
-					} else {
-						// Marking the point as complete
-						sequencePlayer.pointFilled();
-
-						// Checking what to send in response and setting the next object
-						// to fill
-						sequenceBufferWasFull = sequencePlayer.bufferFull();
-						if (sequenceBufferWasFull) {
-							serialCommunication.setNextSequencePointToFill(NULL);
-							serialCommunication.sendBufferFull();
+					break;
+				case StreamModeStopping:
+					// We do not expect any packet here
+					serialCommunication.sendDebugPacket("Unexpected command (sequence stopping)");
+					break;
+				case ImmediateMode:
+					if (serialCommunication.isSequencePoint()) {
+						// If the queue was full, sending a debug packet
+						if (serialCommunication.nextSequencePointToFill() == NULL) {
+							serialCommunication.sendDebugPacket("Sequence point received but buffer full");
 						} else {
+							// Setting both sequence point duration and timeToTarget to 0, so that the new
+							// position is immediately reached
+							serialCommunication.nextSequencePointToFill()->duration = 0;
+							serialCommunication.nextSequencePointToFill()->timeToTarget = 0;
+
+							// Marking the point as complete
+							sequencePlayer.pointFilled();
 							serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
-							serialCommunication.sendBufferNotFull();
 						}
-					}
-				} else if (serialCommunication.isStop()) {
-					// Setting status to stopping. We still have to play all remaining sequence points
-					status = StreamModeStopping;
-				} else {
-					serialCommunication.sendDebugPacket("Unexpected command");
-				}
-				break;
-			case StreamModeStopping:
-				// We do not expect any packet here
-				serialCommunication.sendDebugPacket("Unexpected command (sequence stopping)");
-				break;
-			case ImmediateMode:
-				if (serialCommunication.isSequencePoint()) {
-					// If the queue was full, sending a debug packet
-					if (serialCommunication.nextSequencePointToFill() == NULL) {
-						serialCommunication.sendDebugPacket("Sequence point received but buffer full");
+					} else if (serialCommunication.isStop()) {
+						// Clearing the sequence player buffer and returning idle
+						sequencePlayer.clearBuffer();
+						status = IdleState;
 					} else {
-						// Setting both sequence point duration and timeToTarget to 0, so that the new
-						// position is immediately reached
-						serialCommunication.nextSequencePointToFill()->duration = 0;
-						serialCommunication.nextSequencePointToFill()->timeToTarget = 0;
-
-						// Marking the point as complete
-						sequencePlayer.pointFilled();
-						serialCommunication.setNextSequencePointToFill(sequencePlayer.pointToFill());
+						serialCommunication.sendDebugPacket("Unexpected command");
 					}
-				} else if (serialCommunication.isStop()) {
-					// Clearing the sequence player buffer and returning idle
-					sequencePlayer.clearBuffer();
-					status = IdleState;
-				} else {
-					serialCommunication.sendDebugPacket("Unexpected command");
-				}
-				break;
+					break;
+			}
 		}
 	}
 
+	// Going back to the starting baud rate if the PC did not confirm that the
+	// link works after changing it
+	if (linkUnconfirmed && ((millis() - linkChangeTime) > linkConfirmTimeout)) {
+		serialCommunication.changeBaudRate(baudRate);
+		linkUnconfirmed = false;
+	}
+
 	// Checking if we have to send the battery level
 	const unsigned long curBatteryTime = millis();
 	if ((curBatteryTime - lastBatteryTime) > batteryInterval) {
@@ -243,4 +487,14 @@ void loop()
 
 		lastBatteryTime = curBatteryTime;
 	}
+
+	// Checking if we have to send telemetry
+	if (telemetryInterval != 0) {
+		const unsigned long curTelemetryTime = millis();
+		if ((curTelemetryTime - lastTelemetryTime) >= telemetryInterval) {
+			sendTelemetry();
+
+			lastTelemetryTime = curTelemetryTime;
+		}
+	}
 }
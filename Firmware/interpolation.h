@@ -0,0 +1,127 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef INTERPOLATION_H
+#define INTERPOLATION_H
+
+#include <stdint.h>
+
+/**
+ * \file interpolation.h
+ *
+ * The fixed-point kernel used by SequencePlayer to interpolate servo
+ * positions. Divisions are only performed when a sequence point becomes
+ * current (to compute the PWM of the start and target positions and the slope
+ * of the segment): while moving, the PWM of a servo is computed with a
+ * multiplication, a shift and an addition. Slopes are in Q16 format (PWM units
+ * per time unit, multiplied by 65536); the time unit is a power of two
+ * microseconds, chosen so that the time to target fits in 16 bits. Explicitly
+ * sized types are used so that results are the same on the Arduino and on the
+ * host (see the simulator).
+ */
+
+namespace Interpolation
+{
+	/**
+	 * \brief Computes the Q16 scale mapping positions to PWM values
+	 *
+	 * The scale is rounded up, so that positionToPwm() gives exactly
+	 * (pos * range) / 255 for all positions and ranges below 4096
+	 * \param range the PWM range of the servo
+	 * \return the Q16 scale
+	 */
+	inline uint32_t pwmScale(uint16_t range)
+	{
+		return ((uint32_t(range) << 16) + 254) / 255;
+	}
+
+	/**
+	 * \brief Maps a position to the PWM value
+	 *
+	 * \param pos the position (between 0 and 255)
+	 * \param pwmMin the minimum PWM of the servo
+	 * \param scale the scale of the servo computed by pwmScale()
+	 * \return the PWM value
+	 */
+	inline uint16_t positionToPwm(uint8_t pos, uint16_t pwmMin, uint32_t scale)
+	{
+		return pwmMin + uint16_t((pos * scale) >> 16);
+	}
+
+	/**
+	 * \brief Returns the shift converting microseconds to the time unit of a
+	 *        segment
+	 *
+	 * \param timeToTarget the time to target of the segment in microseconds
+	 * \return the shift such that (timeToTarget >> shift) fits in 16 bits
+	 */
+	inline uint8_t timeShift(uint32_t timeToTarget)
+	{
+		uint8_t shift = 0;
+		while ((timeToTarget >> shift) > 0xFFFFu) {
+			++shift;
+		}
+
+		return shift;
+	}
+
+	/**
+	 * \brief Computes the Q16 slope of a segment
+	 *
+	 * \param startPwm the PWM at the start of the segment
+	 * \param targetPwm the PWM at the end of the segment
+	 * \param timeToTarget the time to target of the segment in microseconds
+	 * \param shift the shift computed by timeShift()
+	 * \return the slope in PWM units per time unit, in Q16 format
+	 */
+	inline int32_t pwmSlope(uint16_t startPwm, uint16_t targetPwm, uint32_t timeToTarget, uint8_t shift)
+	{
+		const int32_t t = int32_t(timeToTarget >> shift);
+		if (t == 0) {
+			return 0;
+		}
+
+		// The difference is at most 4095 in absolute value, so this fits
+		return ((int32_t(targetPwm) - int32_t(startPwm)) * 65536) / t;
+	}
+
+	/**
+	 * \brief Computes the PWM of a servo during a segment
+	 *
+	 * The product of the slope and the time is at most 2^28 in absolute value
+	 * when stepTime is not greater than the time to target. This relies on
+	 * the right shift of negative numbers being arithmetic, which is the case
+	 * with GCC
+	 * \param startPwm the PWM at the start of the segment
+	 * \param slope the slope computed by pwmSlope()
+	 * \param stepTime the time since the start of the segment in
+	 *                 microseconds. This must not be greater than the time to
+	 *                 target
+	 * \param shift the shift computed by timeShift()
+	 * \return the PWM value
+	 */
+	inline uint16_t interpolatePwm(uint16_t startPwm, int32_t slope, uint32_t stepTime, uint8_t shift)
+	{
+		return uint16_t(int32_t(startPwm) + ((slope * int32_t(stepTime >> shift)) >> 16));
+	}
+}
+
+#endif
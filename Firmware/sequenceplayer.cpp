@@ -35,11 +35,26 @@ SequencePlayer::SequencePlayer(const unsigned int servoMin[SequencePoint::dim],
 	, m_pointToFill(1)
 	, m_stepStartTime(0)
 	, m_startingNewPoint(true)
+	, m_carryStartTime(false)
+	, m_targetReached(false)
+	, m_movingServos(0)
+	, m_startPwm()
+	, m_pwmSlope()
+	, m_timeShift(0)
+	, m_pwmValues()
+	, m_sentPwmValues()
+	, m_issuedWrites(0)
+	, m_skippedWrites(0)
+	, m_scheduledPoints(0)
+	, m_startedPoints(0)
+	, m_totalLateness(0)
+	, m_maxLateness(0)
 {
-	// Copying the minimum PWM for servos and computing the range
+	// Copying the minimum PWM for servos and computing the scale from
+	// positions to PWM
 	memcpy(m_servoMin, servoMin, sizeof(m_servoMin));
 	for (int i = 0; i < SequencePoint::dim; ++i) {
-		m_servoRange[i] = servoMax[i] - servoMin[i];
+		m_servoScale[i] = Interpolation::pwmScale(servoMax[i] - servoMin[i]);
 	}
 }
 
@@ -51,10 +66,12 @@ void SequencePlayer::begin(const SequencePoint& curPos)
 	m_pwm.begin();
 	m_pwm.setPWMFreq(200);
 
-	// Moving all servos to their position
+	// Moving all servos to their position. All channels are written because
+	// we don't know their value
 	for (int i = 0; i < SequencePoint::dim; ++i) {
 		moveServo(i, curPos.point[i]);
 	}
+	updateServos(true);
 }
 
 SequencePoint* SequencePlayer::pointToFill()
@@ -73,41 +90,82 @@ void SequencePlayer::pointFilled()
 
 void SequencePlayer::forceNextPoint()
 {
-	m_startingNewPoint = true;
-	m_curPoint = (m_curPoint + 1) % bufferDimension;
-	m_prevPoint = (m_prevPoint + 1) % bufferDimension;
+	nextPoint();
+
+	// The next point starts when step() is called
+	m_carryStartTime = false;
 }
 
 bool SequencePlayer::step()
 {
 	if (bufferEmpty()) {
+		// The next point will start when it is received
+		m_carryStartTime = false;
+
 		return false;
 	}
 
+	const unsigned long curTime = micros();
+
 	if (m_startingNewPoint) {
-		// Storing the start time
-		m_stepStartTime = millis();
+		// Storing the start time, unless the point starts when the previous one
+		// ended
+		if (!m_carryStartTime) {
+			m_stepStartTime = curTime;
+		}
+		m_targetReached = false;
+		++m_startedPoints;
 	}
 
-	// Now checking how much has passed since we being move
-	const unsigned long stepTime = millis() - m_stepStartTime;
+	// Now checking how much has passed since we being move. The subtraction is
+	// correct even if micros() wrapped around
+	const unsigned long stepTime = curTime - m_stepStartTime;
+	const unsigned long timeToTarget = m_buffer[m_curPoint].timeToTarget * 1000ul;
+	const unsigned long pointTime = (static_cast<unsigned long>(m_buffer[m_curPoint].timeToTarget) + m_buffer[m_curPoint].duration) * 1000ul;
 
 	// Checking what to do. Notice that if both timeToTarget and duration are 0, we move
 	// to the target position directly. If the first check, the !m_startingNewPoint condition
-	// is checked to avoid skipping a point that has both timeToTarget and duration to 0 when
-	// millis() changes between the two calls above
-	if ((!m_startingNewPoint) && (stepTime > (m_buffer[m_curPoint].timeToTarget + m_buffer[m_curPoint].duration))) {
-		// The current step has finished, moving to the next one and recursively calling self
-		forceNextPoint();
+	// is checked to avoid skipping a point that has both timeToTarget and duration to 0.
+	// A point that just started is only skipped if it has already ended and the next one
+	// is buffered: it was shorter than the control period, servos could not show it anyway
+	// and the next segment starts from its target
+	const bool nextPointBuffered = (((m_curPoint + 1) % bufferDimension) != m_pointToFill);
+	if ((!m_startingNewPoint || nextPointBuffered) && (stepTime > pointTime)) {
+		// The current step has finished, the next one starts exactly when this
+		// one ended. Moving to the next one and recursively calling self
+		m_stepStartTime += pointTime;
+		nextPoint();
+
+		// Keeping track of how late we noticed the start of the new point
+		const unsigned long lateness = stepTime - pointTime;
+		++m_scheduledPoints;
+		m_totalLateness += lateness;
+		if (lateness > m_maxLateness) {
+			m_maxLateness = lateness;
+		}
 
 		return step();
 	} else {
-		// Checking if we have to move (if not we simply wait)
-		if ((m_startingNewPoint) || (stepTime <= m_buffer[m_curPoint].timeToTarget)) {
-			// We have not reached the point yet, moving servos
+		// Checking if we have to move (if not we simply wait). We move until the
+		// target position has been written once, even if timeToTarget elapsed
+		// between two steps
+		if (m_startingNewPoint) {
+			startSegment();
+		}
+		if ((m_startingNewPoint) || (!m_targetReached)) {
+			// Servos that do not move in this point only need to be set when the
+			// point starts
+			m_targetReached = (stepTime >= timeToTarget);
 			for (int i = 0; i < SequencePoint::dim; ++i) {
-				moveServo(i, currentServoPos(i, stepTime));
+				if (m_startingNewPoint || ((m_movingServos & (1ul << i)) != 0)) {
+					if (m_targetReached) {
+						moveServo(i, m_buffer[m_curPoint].point[i]);
+					} else {
+						m_pwmValues[i] = Interpolation::interpolatePwm(m_startPwm[i], m_pwmSlope[i], stepTime, m_timeShift);
+					}
+				}
 			}
+			updateServos();
 		}
 	}
 
@@ -120,6 +178,35 @@ bool SequencePlayer::step()
 	return true;
 }
 
+void SequencePlayer::resetStatistics()
+{
+	m_issuedWrites = 0;
+	m_skippedWrites = 0;
+	m_scheduledPoints = 0;
+	m_startedPoints = 0;
+	m_totalLateness = 0;
+	m_maxLateness = 0;
+}
+
+SequencePlayer::Phase SequencePlayer::phase() const
+{
+	if (bufferEmpty()) {
+		return NoPoint;
+	}
+
+	// A point that step() has not started yet is about to move
+	return (m_startingNewPoint || !m_targetReached) ? Moving : Holding;
+}
+
+unsigned long SequencePlayer::pointElapsedTime() const
+{
+	if (bufferEmpty() || m_startingNewPoint) {
+		return 0;
+	}
+
+	return micros() - m_stepStartTime;
+}
+
 void SequencePlayer::clearBuffer()
 {
 	// Changing m_pointToFill so that we do not have to also change m_prevPoint
@@ -128,30 +215,75 @@ void SequencePlayer::clearBuffer()
 	// We also set the flag for the starting of a new point to true to store the start time
 	// the first time step() is called with a point
 	m_startingNewPoint = true;
+	m_carryStartTime = false;
 }
 
-unsigned char SequencePlayer::currentServoPos(int servo, unsigned long curTime)
+void SequencePlayer::nextPoint()
 {
-	// Computing the new position. This is still a value between 0 and 255.
-	// If timeToTarget is 0, the new position will be the one in curPoint
-	unsigned char newPos;
+	m_startingNewPoint = true;
+	m_carryStartTime = true;
+	m_curPoint = (m_curPoint + 1) % bufferDimension;
+	m_prevPoint = (m_prevPoint + 1) % bufferDimension;
+}
 
-	if (m_buffer[m_curPoint].timeToTarget == 0) {
-		newPos = m_buffer[m_curPoint].point[servo];
-	} else {
-		const long d = long(m_buffer[m_curPoint].point[servo]) - long(m_buffer[m_prevPoint].point[servo]);
-		const long newP = long(m_buffer[m_prevPoint].point[servo]) + ((d * long(curTime)) / long(m_buffer[m_curPoint].timeToTarget));
-		newPos = (unsigned char) newP;
-	}
+void SequencePlayer::startSegment()
+{
+	const SequencePoint& prev = m_buffer[m_prevPoint];
+	const SequencePoint& cur = m_buffer[m_curPoint];
+	const uint32_t timeToTarget = cur.timeToTarget * 1000ul;
+
+	m_timeShift = Interpolation::timeShift(timeToTarget);
+	m_movingServos = 0;
+	for (int i = 0; i < SequencePoint::dim; ++i) {
+		// Servos that do not move have a slope of 0
+		if (cur.point[i] != prev.point[i]) {
+			m_movingServos |= 1ul << i;
+		}
 
-	return newPos;
+		m_startPwm[i] = Interpolation::positionToPwm(prev.point[i], m_servoMin[i], m_servoScale[i]);
+		const uint16_t targetPwm = Interpolation::positionToPwm(cur.point[i], m_servoMin[i], m_servoScale[i]);
+		m_pwmSlope[i] = Interpolation::pwmSlope(m_startPwm[i], targetPwm, timeToTarget, m_timeShift);
+	}
 }
 
 void SequencePlayer::moveServo(int servo, unsigned char pos)
 {
-	// Here we map the position in the PWM range. pos is always a value between 0 and 255
-	const long mappedPos = ((long(pos) * m_servoRange[servo]) / 255) + m_servoMin[servo];
+	// Here we map the position in the PWM range (without divisions) and store
+	// the value, servos are moved by updateServos()
+	m_pwmValues[servo] = Interpolation::positionToPwm(pos, m_servoMin[servo], m_servoScale[servo]);
+}
+
+void SequencePlayer::updateServos(bool force)
+{
+	// Each transmission has a fixed cost (start, address, register, stop and
+	// the overhead of the Wire library) comparable to writing a couple of
+	// channels, so runs of changed channels separated by at most this number
+	// of unchanged channels are written together, rewriting the unchanged ones
+	const int maxMergedGap = 2;
+
+	int i = 0;
+	while (i < SequencePoint::dim) {
+		// Skipping unchanged channels
+		if (!force && (m_pwmValues[i] == m_sentPwmValues[i])) {
+			++m_skippedWrites;
+			++i;
+			continue;
+		}
 
-	// Moving servo
-	m_pwm.setPWM(servo, 0, mappedPos);
+		// Looking for the last changed channel that is not too far from the
+		// previous one and writing all channels up to it together
+		const int first = i;
+		int last = i;
+		for (int j = i + 1; (j < SequencePoint::dim) && ((j - last) <= (maxMergedGap + 1)); ++j) {
+			if (force || (m_pwmValues[j] != m_sentPwmValues[j])) {
+				last = j;
+			}
+		}
+		for (i = first; i <= last; ++i) {
+			m_sentPwmValues[i] = m_pwmValues[i];
+		}
+
+		m_pwm.setPWMRange(first, last - first + 1, &m_pwmValues[first]);
+		m_issuedWrites += last - first + 1;
+	}
 }
@@ -24,15 +24,24 @@
 
 #include "sequencepoint.h"
 #include "AdafruitPWMServoDriver.h"
+#include "interpolation.h"
+
+#ifndef SEQUENCE_BUFFER_DIMENSION
+	// The number of slots in the buffer of sequence points. Define this when
+	// compiling to change it, the RAM budget is checked after SequencePlayer
+	#define SEQUENCE_BUFFER_DIMENSION 16
+#endif
 
 /**
  * \brief The class controlling the servos
  *
- * This class stores sequence points and moves servos. Sequence points are in
- * a ring buffer. To add a sequence point use the pointer returned by the
- * function pointToFill(), then call pointFilled() when the sequence point is
- * valid. To play the sequence call step(). This class internally uses millis()
- * to compute the position of servos. Never move servos controlled by this class
+ * This class stores sequence points and moves servos. Sequence points are in a
+ * ring buffer. To add a sequence point use the pointer returned by the function
+ * pointToFill(), then call pointFilled() when the sequence point is valid. To
+ * play the sequence call step(). This class internally uses micros() to compute
+ * the position of servos. When a point ends, the next one starts exactly at the
+ * end time of the previous one (not when step() notices the end), so no drift
+ * accumulates over long sequences. Never move servos controlled by this class
  * externally: here we need to keep the current position to compute the velocity
  * at which servos must move to a new postition. The current position of servos
  * is stored in the buffer but it never cleared. After instantiating this class,
@@ -42,10 +51,40 @@
 class SequencePlayer
 {
 public:
+	/**
+	 * \brief The number of slots in the buffer of sequence points
+	 *
+	 * One slot always keeps the previous point, see bufferDepth
+	 */
+	static const int bufferDimension = SEQUENCE_BUFFER_DIMENSION;
+
 	/**
 	 * \brief How many sequence points we can buffer
+	 *
+	 * This is the number of points the PC can send before the first one is
+	 * played, it is sent to the PC when a stream starts
 	 */
-	static const int bufferDimension = 4;
+	static const int bufferDepth = bufferDimension - 1;
+
+	/**
+	 * \brief The maximum number of bytes of RAM an instance may use
+	 *
+	 * This covers the buffer of points and the per-servo interpolation
+	 * state (about 16 bytes per servo). The ATmega328 only has 2048 bytes
+	 * of RAM, shared with serial and I2C buffers, global objects and the
+	 * stack
+	 */
+	static const unsigned int ramBudget = 768;
+
+	/**
+	 * \brief The phases of the current point
+	 *
+	 * NoPoint means that the buffer is empty. In the Moving phase servos
+	 * move towards the position of the current point, in the Holding phase
+	 * they have reached it and wait for the end of the point. The values
+	 * are sent to the PC in telemetry packets
+	 */
+	enum Phase {NoPoint = 0, Moving = 1, Holding = 2};
 
 public:
 	/**
@@ -91,7 +130,8 @@ public:
 	 *
 	 * The call to the step() function following a call to this function
 	 * will move to the next point in the sequence regardless of whether the
-	 * previous one has been reached or not
+	 * previous one has been reached or not. The next point starts when step()
+	 * is called
 	 */
 	void forceNextPoint();
 
@@ -99,8 +139,11 @@ public:
 	 * \brief Performs a step
 	 *
 	 * This function can either move servos, wait or move to the next
-	 * sequence point. It only returns false if it cannot do anything
-	 * because the buffer is empty
+	 * sequence point. All buffered points that ended before the call are
+	 * skipped, so points shorter than the interval between calls do not
+	 * make the sequence fall behind. A point that has not been played yet
+	 * is only skipped if the next one is already buffered. It only returns
+	 * false if it cannot do anything because the buffer is empty
 	 * \return false if the buffer is empty, true otherwise
 	 */
 	bool step();
@@ -132,26 +175,158 @@ public:
 		return (m_prevPoint == m_pointToFill);
 	}
 
+	/**
+	 * \brief Returns the number of points that can still be added to the
+	 *        buffer
+	 *
+	 * \return the number of points that can still be added to the buffer
+	 */
+	int freeSlots() const
+	{
+		return (m_prevPoint - m_pointToFill + bufferDimension) % bufferDimension;
+	}
+
+	/**
+	 * \brief Returns the number of servo channel writes sent to the PWM
+	 *        driver
+	 *
+	 * \return the number of servo channel writes sent to the PWM driver
+	 */
+	unsigned long issuedWrites() const
+	{
+		return m_issuedWrites;
+	}
+
+	/**
+	 * \brief Returns the number of servo channel writes skipped because the
+	 *        value did not change
+	 *
+	 * \return the number of skipped servo channel writes
+	 */
+	unsigned long skippedWrites() const
+	{
+		return m_skippedWrites;
+	}
+
+	/**
+	 * \brief Returns the number of points that started when the previous
+	 *        one ended
+	 *
+	 * \return the number of points that started when the previous one ended
+	 */
+	unsigned long scheduledPoints() const
+	{
+		return m_scheduledPoints;
+	}
+
+	/**
+	 * \brief Returns the total lateness of point starts in microseconds
+	 *
+	 * Points start when the previous one ends, but step() only notices the
+	 * end when it is called. The lateness of a point is the time between its
+	 * start and the step() call noticing it. The lateness does not delay the
+	 * following points, because the start time of points is not changed
+	 * \return the sum of the lateness of all points in microseconds
+	 */
+	unsigned long totalLateness() const
+	{
+		return m_totalLateness;
+	}
+
+	/**
+	 * \brief Returns the maximum lateness of point starts in microseconds
+	 *
+	 * See totalLateness() for the definition of lateness
+	 * \return the maximum lateness of a point in microseconds
+	 */
+	unsigned long maxLateness() const
+	{
+		return m_maxLateness;
+	}
+
+	/**
+	 * \brief Returns the number of points that have been started
+	 *
+	 * The first point started after resetStatistics() is the point number
+	 * 0, so while a point is played this is its number plus one. The counter
+	 * wraps around at the maximum value of unsigned int
+	 * \return the number of points that have been started
+	 */
+	unsigned int startedPoints() const
+	{
+		return m_startedPoints;
+	}
+
+	/**
+	 * \brief Returns the phase of the current point
+	 *
+	 * \return the phase of the current point
+	 */
+	Phase phase() const;
+
+	/**
+	 * \brief Returns the time since the current point started
+	 *
+	 * \return the time since the current point started in microseconds, 0
+	 *         if no point has started
+	 */
+	unsigned long pointElapsedTime() const;
+
+	/**
+	 * \brief Returns the PWM values last sent to the driver
+	 *
+	 * \return the array of SequencePoint::dim PWM values last sent to the
+	 *         driver
+	 */
+	const uint16_t* commandedPwm() const
+	{
+		return m_sentPwmValues;
+	}
+
+	/**
+	 * \brief Resets the counters of issued and skipped writes, of started
+	 *        points and the lateness statistics
+	 */
+	void resetStatistics();
+
 private:
 	/**
-	 * \brief Computes the position the servo it should have at the given
-	 *        time
+	 * \brief Moves to the next point, which starts when the current one ends
+	 */
+	void nextPoint();
+
+	/**
+	 * \brief Prepares the interpolation of the current point
 	 *
-	 * \param servo the index of the servo to move
-	 * \param curTime the current step time. This MUST be lower than the
-	 *                timeToTarget of the current step
-	 * \return the position the servo should have
+	 * This computes the PWM at the start of the point, the slope and the
+	 * mask of moving servos. It is called when a point becomes current, so
+	 * that moving servos only needs a multiplication, a shift and an addition
+	 * per servo (see interpolation.h)
 	 */
-	unsigned char currentServoPos(int servo, unsigned long curTime);
+	void startSegment();
 
 	/**
-	 * \brief Moves one servo to specified position
+	 * \brief Sets the position of one servo
 	 *
+	 * The position is mapped to the PWM range of the servo. The servo is only
+	 * moved by the next call to updateServos()
 	 * \param servo the index of the servo to move
 	 * \param pos the position to which the servo should be moved
 	 */
 	void moveServo(int servo, unsigned char pos);
 
+	/**
+	 * \brief Sends the positions set with moveServo() to the PWM driver
+	 *
+	 * Only servos whose PWM value changed since the last update are written.
+	 * Consecutive changed channels are written together with as few I2C
+	 * transmissions as possible, gaps of one or two unchanged channels are
+	 * rewritten to merge the runs around them
+	 * \param force if true all servos are written, even if they did not
+	 *              change
+	 */
+	void updateServos(bool force = false);
+
 	/**
 	 * \brief The driver of motors
 	 */
@@ -178,9 +353,11 @@ private:
 	int m_pointToFill;
 
 	/**
-	 * \brief The time the sequence point started in milliseconds
+	 * \brief The time the sequence point started in microseconds
 	 *
-	 * This is set using millis()
+	 * This is set using micros() when a point starts after the buffer was
+	 * empty or after forceNextPoint(). Otherwise it is the time the previous
+	 * point ended, so the sub-millisecond phase is carried across points
 	 */
 	unsigned long m_stepStartTime;
 
@@ -191,18 +368,104 @@ private:
 	 */
 	bool m_startingNewPoint;
 
+	/**
+	 * \brief If true the new point starts when the previous one ended
+	 *
+	 * When false, the new point starts at the time step() is called
+	 */
+	bool m_carryStartTime;
+
+	/**
+	 * \brief Set to true when servos have been moved to the target position
+	 *        of the current point
+	 *
+	 * After this, servos are not moved until the point ends
+	 */
+	bool m_targetReached;
+
+	/**
+	 * \brief The mask of servos moving in the current sequence point
+	 *
+	 * Bit i is set if the position of servo i in the current point is
+	 * different from the one in the previous point. Servos that do not move
+	 * are only set when the point starts. SequencePoint::dim must not be
+	 * greater than 32
+	 */
+	unsigned long m_movingServos;
+
 	/**
 	 * \brief The minimum value for servos PWM
 	 */
 	unsigned int m_servoMin[SequencePoint::dim];
 
 	/**
-	 * \brief The range of servos PWM
+	 * \brief The Q16 scale mapping positions to the PWM range of servos
 	 *
-	 * Valid values for PWM will be from m_servoMin to (m_servoMin +
-	 * m_servoRange)
+	 * Valid values for PWM will be from m_servoMin to the maximum PWM, see
+	 * Interpolation::pwmScale()
+	 */
+	uint32_t m_servoScale[SequencePoint::dim];
+
+	/**
+	 * \brief The PWM of servos at the start of the current point
 	 */
-	unsigned int m_servoRange[SequencePoint::dim];
+	uint16_t m_startPwm[SequencePoint::dim];
+
+	/**
+	 * \brief The Q16 slope of servos in the current point
+	 *
+	 * See Interpolation::pwmSlope()
+	 */
+	int32_t m_pwmSlope[SequencePoint::dim];
+
+	/**
+	 * \brief The shift converting microseconds to the time unit of the
+	 *        current point
+	 *
+	 * See Interpolation::timeShift()
+	 */
+	uint8_t m_timeShift;
+
+	/**
+	 * \brief The PWM values set with moveServo()
+	 */
+	uint16_t m_pwmValues[SequencePoint::dim];
+
+	/**
+	 * \brief The PWM values last sent to the driver
+	 */
+	uint16_t m_sentPwmValues[SequencePoint::dim];
+
+	/**
+	 * \brief The number of servo channel writes sent to the PWM driver
+	 */
+	unsigned long m_issuedWrites;
+
+	/**
+	 * \brief The number of servo channel writes skipped because the value
+	 *        did not change
+	 */
+	unsigned long m_skippedWrites;
+
+	/**
+	 * \brief The number of points that started when the previous one ended
+	 */
+	unsigned long m_scheduledPoints;
+
+	/**
+	 * \brief The number of points that have been started
+	 */
+	unsigned int m_startedPoints;
+
+	/**
+	 * \brief The sum of the lateness of point starts in microseconds
+	 */
+	unsigned long m_totalLateness;
+
+	/**
+	 * \brief The maximum lateness of a point start in microseconds
+	 */
+	unsigned long m_maxLateness;
 
 	/**
 	 * \brief Copy constructor is disabled
@@ -215,4 +478,12 @@ private:
 	SequencePlayer& operator=(const SequencePlayer&);
 };
 
+static_assert(SequencePlayer::bufferDepth >= 1, "The buffer of sequence points must have at least two slots");
+static_assert(SequencePlayer::bufferDepth <= 255, "The depth of the buffer of sequence points is sent to the PC in one byte");
+#ifdef __AVR__
+	// Types are wider on other targets (e.g. the simulator), so the size is
+	// only meaningful on the board
+	static_assert(sizeof(SequencePlayer) <= SequencePlayer::ramBudget, "The sequence player exceeds its RAM budget, reduce SEQUENCE_BUFFER_DIMENSION");
+#endif
+
 #endif
@@ -24,81 +24,117 @@
 #include <math.h>
 #include <Arduino.h>
 
+static_assert(SequencePoint::dim <= 16, "Delta packets have a 16 bits mask of changed servos");
+
+/**
+ * \brief Updates a CRC-8 (polynomial 0x07, initial value 0) with one byte
+ *
+ * \param crc the current value of the CRC
+ * \param v the byte to add
+ * \return the new value of the CRC
+ */
+static unsigned char crc8Update(unsigned char crc, unsigned char v)
+{
+	crc ^= v;
+	for (int i = 0; i < 8; ++i) {
+		crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+	}
+
+	return crc;
+}
+
+/**
+ * \brief Computes the CRC-8 of a buffer
+ *
+ * \param data the buffer
+ * \param length the number of bytes in the buffer
+ * \return the CRC of the buffer
+ */
+static unsigned char crc8(const unsigned char* data, unsigned char length)
+{
+	unsigned char crc = 0;
+	for (unsigned char i = 0; i < length; ++i) {
+		crc = crc8Update(crc, data[i]);
+	}
+
+	return crc;
+}
+
 SerialCommunication::SerialCommunication()
 	: m_pointToFill(NULL)
 	, m_receivedCommand(0)
 	, m_receivedPacketBytes(0)
 	, m_receivedPointDim(0)
+	, m_requestedLinkSpeed(0)
+	, m_requestedTelemetryRate(0)
+	, m_pcProtocolVersion(0)
+	, m_linkTestData()
+	, m_pingData()
+	, m_lastPoint()
+	, m_changedServos(0)
+	, m_deltaPositions(0)
+	, m_deltaBaseValid(false)
+	, m_framed(false)
+	, m_frameStarted(false)
+	, m_frameSynced(false)
+	, m_frameDiscarding(false)
+	, m_frameEscape(false)
+	, m_frameBuffer()
+	, m_frameBytes(0)
+	, m_sendCrc(0)
+	, m_corruptedFrames(0)
+	, m_lostPoints(0)
 {
 }
 
+long SerialCommunication::baudRateForLinkSpeed(unsigned char speed)
+{
+	switch (speed) {
+		case 0:
+			return 115200;
+		case 1:
+			return 250000;
+		case 2:
+			return 500000;
+		default:
+			return 1000000;
+	}
+}
+
 void SerialCommunication::begin(long baudRate)
 {
 	Serial.begin(baudRate);
 }
 
+void SerialCommunication::changeBaudRate(long baudRate)
+{
+	// Calling begin() again is enough to change the baud rate
+	Serial.flush();
+	Serial.begin(baudRate);
+}
+
 bool SerialCommunication::commandReceived()
 {
-	bool retVal = false;
 	while (Serial.available() > 0) {
 		// Reading one byte
-		const int v = Serial.read();
-
-		// Checking what to do
-		if (previousCommandComplete()) {
-			// New package. First of all resetting the number of bytes for the package
-			m_receivedPacketBytes = 0;
-
-			// Setting the received command to the byte we just read and checking if the
-			// command if finished here (the only command that ends in one byte is 'H')
-			m_receivedCommand = (char) v;
-			if (m_receivedCommand == 'H') {
-				retVal = true;
-				break;
-			}
-		} else if ((m_receivedCommand == 'S') || (m_receivedCommand == 'I')) {
-			++m_receivedPacketBytes;
+		const unsigned char v = (unsigned char) Serial.read();
 
-			// The byte we received is the point dimension, storing and returning true
-			m_receivedPointDim = (unsigned char) v;
-			retVal = true;
-			break;
-		} else if (m_receivedCommand == 'P') {
-			++m_receivedPacketBytes;
-
-			if (m_pointToFill != NULL) {
-				switch (m_receivedPacketBytes) {
-					case 1:
-						m_pointToFill->duration = ((unsigned char) v) << 8;
-						break;
-					case 2:
-						m_pointToFill->duration += (unsigned char) v;
-						break;
-					case 3:
-						m_pointToFill->timeToTarget = ((unsigned char) v) << 8;
-						break;
-					case 4:
-						m_pointToFill->timeToTarget += (unsigned char) v;
-						break;
-					default:
-						m_pointToFill->point[m_receivedPacketBytes - 5] = (unsigned char) v;
-						break;
-				}
-			}
+		// Switching to framed mode when the PC starts a frame between
+		// packets. A sync byte is never a valid packet type
+		if (!m_framed && (v == frameSync) && (previousCommandComplete() || !knownCommand())) {
+			m_framed = true;
+		}
 
-			if (m_receivedPacketBytes == (SequencePoint::dim + 4)) {
-				retVal = true;
-				break;
+		if (m_framed) {
+			if (frameByteReceived(v)) {
+				return true;
 			}
-		} else {
-			// If we get here the previous packet was unknown. Here we set m_receivedCommand
-			// to what we received and do another cycle
-			m_receivedCommand = (char) v;
-			m_receivedPacketBytes = 0;
+		} else if (decodeByte(v)) {
+			return true;
 		}
 	}
 
-	return retVal;
+	return false;
 }
 
 void SerialCommunication::setNextSequencePointToFill(SequencePoint* p)
@@ -108,40 +144,436 @@ void SerialCommunication::setNextSequencePointToFill(SequencePoint* p)
 
 void SerialCommunication::sendBufferNotFull()
 {
-	Serial.write('N');
+	beginPacket(1);
+	writePacketByte('N');
+	endPacket();
 }
 
 void SerialCommunication::sendBufferFull()
 {
-	Serial.write('F');
+	beginPacket(1);
+	writePacketByte('F');
+	endPacket();
+}
+
+void SerialCommunication::sendStreamAccepted(unsigned char bufferDepth)
+{
+	beginPacket(2);
+	writePacketByte('A');
+	writePacketByte(bufferDepth);
+	endPacket();
+}
+
+void SerialCommunication::sendCredits(unsigned char n)
+{
+	beginPacket(2);
+	writePacketByte('C');
+	writePacketByte(n);
+	endPacket();
+}
+
+void SerialCommunication::sendCreditResync(unsigned char n)
+{
+	beginPacket(2);
+	writePacketByte('G');
+	writePacketByte(n);
+	endPacket();
+}
+
+void SerialCommunication::sendLinkSpeed(unsigned char speed)
+{
+	beginPacket(2);
+	writePacketByte('L');
+	writePacketByte(speed);
+	endPacket();
+}
+
+void SerialCommunication::sendLinkTestEcho()
+{
+	beginPacket(linkTestLength + 1);
+	writePacketByte('T');
+	for (unsigned char i = 0; i < linkTestLength; ++i) {
+		writePacketByte(m_linkTestData[i]);
+	}
+	endPacket();
+}
+
+void SerialCommunication::sendLinkConfirmed()
+{
+	beginPacket(1);
+	writePacketByte('V');
+	endPacket();
+}
+
+void SerialCommunication::sendPingEcho()
+{
+	const unsigned long curTime = micros();
+
+	beginPacket(pingLength + 5);
+	writePacketByte('Y');
+	for (unsigned char i = 0; i < pingLength; ++i) {
+		writePacketByte(m_pingData[i]);
+	}
+	writePacketByte((curTime >> 24) & 0xFF);
+	writePacketByte((curTime >> 16) & 0xFF);
+	writePacketByte((curTime >> 8) & 0xFF);
+	writePacketByte(curTime & 0xFF);
+	endPacket();
+}
+
+void SerialCommunication::sendUnderrun(unsigned long duration)
+{
+	const unsigned int d = min(duration, 65535ul);
+
+	beginPacket(3);
+	writePacketByte('W');
+	writePacketByte((d >> 8) & 0xFF);
+	writePacketByte(d & 0xFF);
+	endPacket();
+}
+
+void SerialCommunication::sendTelemetry(unsigned int startedPoints, unsigned char phase, unsigned long pointTime, unsigned long tickOverruns, unsigned long maxLateness, unsigned long maxTickDuration, const uint16_t* pwm)
+{
+	// Packet type, point counter, phase, four 16 bits values, the number of
+	// channels and the PWM of each channel
+	beginPacket(13 + 2 * SequencePoint::dim);
+	writePacketByte('M');
+	writePacketByte((startedPoints >> 8) & 0xFF);
+	writePacketByte(startedPoints & 0xFF);
+	writePacketByte(phase);
+	writePacketWord(pointTime);
+	writePacketWord(tickOverruns);
+	writePacketWord(maxLateness);
+	writePacketWord(maxTickDuration);
+	writePacketByte(SequencePoint::dim);
+	for (int i = 0; i < SequencePoint::dim; ++i) {
+		writePacketWord(pwm[i]);
+	}
+	endPacket();
 }
 
 void SerialCommunication::sendSequenceFinished()
 {
-	Serial.write('E');
+	beginPacket(1);
+	writePacketByte('E');
+	endPacket();
 }
 
 void SerialCommunication::sendDebugPacket(const char* msg)
 {
-	const unsigned int msgLen = min(strlen(msg), 255);
+	// In framed mode the payload (with packet type and length) must fit
+	// in 255 bytes
+	const unsigned int msgLen = min(strlen(msg), m_framed ? 253 : 255);
 
-	Serial.write('D');
-	Serial.write(msgLen);
+	beginPacket(msgLen + 2);
+	writePacketByte('D');
+	writePacketByte(msgLen);
 	for (unsigned int i = 0; i < msgLen; ++i) {
-		Serial.write(msg[i]);
+		writePacketByte(msg[i]);
 	}
+	endPacket();
 }
 
 void SerialCommunication::sendBatteryCharge(unsigned char v)
 {
-	Serial.write('B');
-	Serial.write(v);
+	beginPacket(2);
+	writePacketByte('B');
+	writePacketByte(v);
+	endPacket();
+}
+
+bool SerialCommunication::decodeByte(unsigned char v)
+{
+	// Checking what to do
+	if (previousCommandComplete()) {
+		// New package. First of all resetting the number of bytes for the package
+		m_receivedPacketBytes = 0;
+
+		// Setting the received command to the byte we just read and checking if the
+		// command if finished here (the only commands that end in one byte are 'H',
+		// 'V' and 'R')
+		m_receivedCommand = (char) v;
+		if ((m_receivedCommand == 'H') || (m_receivedCommand == 'V') || (m_receivedCommand == 'R')) {
+			return true;
+		}
+	} else if ((m_receivedCommand == 'S') || (m_receivedCommand == 'I')) {
+		++m_receivedPacketBytes;
+
+		// The byte we received is the point dimension, storing and returning true
+		m_receivedPointDim = (unsigned char) v;
+		return true;
+	} else if (m_receivedCommand == 'L') {
+		++m_receivedPacketBytes;
+
+		m_requestedLinkSpeed = (unsigned char) v;
+		return true;
+	} else if (m_receivedCommand == 'M') {
+		++m_receivedPacketBytes;
+
+		m_requestedTelemetryRate = (unsigned char) v;
+		return true;
+	} else if (m_receivedCommand == 'Q') {
+		++m_receivedPacketBytes;
+
+		m_pcProtocolVersion = (unsigned char) v;
+		return true;
+	} else if (m_receivedCommand == 'T') {
+		m_linkTestData[m_receivedPacketBytes++] = (unsigned char) v;
+
+		if (m_receivedPacketBytes == linkTestLength) {
+			return true;
+		}
+	} else if (m_receivedCommand == 'Y') {
+		m_pingData[m_receivedPacketBytes++] = (unsigned char) v;
+
+		if (m_receivedPacketBytes == pingLength) {
+			return true;
+		}
+	} else if ((m_receivedCommand == 'P') || (m_receivedCommand == 'U')) {
+		++m_receivedPacketBytes;
+
+		// Timings are the same for both packet types
+		if ((m_pointToFill != NULL) && (m_receivedPacketBytes <= 4)) {
+			switch (m_receivedPacketBytes) {
+				case 1:
+					m_pointToFill->duration = ((unsigned char) v) << 8;
+					break;
+				case 2:
+					m_pointToFill->duration += (unsigned char) v;
+					break;
+				case 3:
+					m_pointToFill->timeToTarget = ((unsigned char) v) << 8;
+					break;
+				case 4:
+					m_pointToFill->timeToTarget += (unsigned char) v;
+					break;
+			}
+		}
+
+		if (m_receivedCommand == 'P') {
+			if (m_receivedPacketBytes > 4) {
+				m_lastPoint[m_receivedPacketBytes - 5] = (unsigned char) v;
+			}
+
+			if (m_receivedPacketBytes == (SequencePoint::dim + 4)) {
+				completePoint();
+				m_deltaBaseValid = true;
+				return true;
+			}
+		} else {
+			if (m_receivedPacketBytes == 5) {
+				m_changedServos = ((unsigned char) v) << 8;
+			} else if (m_receivedPacketBytes == 6) {
+				m_changedServos += (unsigned char) v;
+
+				// Counting the positions that will follow
+				m_deltaPositions = 0;
+				for (int i = 0; i < SequencePoint::dim; ++i) {
+					if (m_changedServos & (1u << i)) {
+						++m_deltaPositions;
+					}
+				}
+			} else if (m_receivedPacketBytes > 6) {
+				// Storing the position of the first servo whose bit is set
+				// and clearing the bit
+				for (int i = 0; i < SequencePoint::dim; ++i) {
+					if (m_changedServos & (1u << i)) {
+						m_lastPoint[i] = (unsigned char) v;
+						m_changedServos &= ~(1u << i);
+						break;
+					}
+				}
+			}
+
+			if ((m_receivedPacketBytes >= 6) && (m_receivedPacketBytes == (m_deltaPositions + 6))) {
+				if (m_framed && !m_deltaBaseValid) {
+					return false;
+				}
+
+				completePoint();
+				return true;
+			}
+		}
+	} else {
+		// If we get here the previous packet was unknown. Here we set m_receivedCommand
+		// to what we received and wait for the next byte
+		m_receivedCommand = (char) v;
+		m_receivedPacketBytes = 0;
+	}
+
+	return false;
+}
+
+bool SerialCommunication::frameByteReceived(unsigned char v)
+{
+	// A sync byte always starts a new frame. If we were in the middle of a
+	// frame, some bytes were lost
+	if (v == frameSync) {
+		if (m_frameStarted && (m_frameBytes != 0)) {
+			frameCorrupted();
+		}
+		m_frameStarted = true;
+		m_frameSynced = true;
+		m_frameDiscarding = false;
+		m_frameEscape = false;
+		m_frameBytes = 0;
+
+		return false;
+	}
+
+	// A byte outside of a frame means that the sync byte of the frame was
+	// lost. The frame is read anyway to know the packet type (see
+	// frameCorrupted()), unless we are skipping the rest of a frame with an
+	// invalid length
+	if (!m_frameStarted) {
+		if (m_frameDiscarding) {
+			return false;
+		}
+
+		m_frameStarted = true;
+		m_frameSynced = false;
+		m_frameEscape = false;
+		m_frameBytes = 0;
+	}
+
+	if (v == frameEscape) {
+		m_frameEscape = true;
+
+		return false;
+	} else if (m_frameEscape) {
+		v ^= frameEscapeXor;
+		m_frameEscape = false;
+	}
+
+	m_frameBuffer[m_frameBytes++] = v;
+
+	// The first byte is the length of the payload
+	const unsigned char payloadLength = m_frameBuffer[0];
+	if ((payloadLength == 0) || (payloadLength > maxFramePayload)) {
+		frameCorrupted();
+		m_frameStarted = false;
+		m_frameDiscarding = true;
+
+		return false;
+	}
+
+	// Waiting for the payload and the CRC
+	if (m_frameBytes < (payloadLength + 2)) {
+		return false;
+	}
+	m_frameStarted = false;
+
+	if (!m_frameSynced || (crc8(m_frameBuffer, payloadLength + 1) != m_frameBuffer[payloadLength + 1])) {
+		frameCorrupted();
+
+		return false;
+	}
+
+	// Decoding the packet in the payload. A frame contains exactly one
+	// packet, so we start from a clean decoder and the packet must end with
+	// the payload. Delta packets are also discarded if a frame was lost after
+	// the last full sequence packet, because we don't have the positions they
+	// are relative to
+	m_receivedCommand = 0;
+	for (unsigned char i = 1; i <= payloadLength; ++i) {
+		if (decodeByte(m_frameBuffer[i])) {
+			if (i == payloadLength) {
+				return true;
+			}
+
+			break;
+		}
+	}
+
+	frameCorrupted();
+	m_receivedCommand = 0;
+
+	return false;
+}
+
+void SerialCommunication::frameCorrupted()
+{
+	++m_corruptedFrames;
+	m_deltaBaseValid = false;
+
+	// The second byte of the frame is the packet type, if we got that far
+	if ((m_frameBytes >= 2) && ((m_frameBuffer[1] == 'P') || (m_frameBuffer[1] == 'U'))) {
+		++m_lostPoints;
+	}
+
+	// Telling the PC, so that it sends the next point as a full sequence
+	// packet
+	beginPacket(1);
+	writePacketByte('K');
+	endPacket();
+}
+
+bool SerialCommunication::knownCommand() const
+{
+	return (m_receivedCommand == 'P') || (m_receivedCommand == 'U') || (m_receivedCommand == 'S') || (m_receivedCommand == 'I') || (m_receivedCommand == 'H') || (m_receivedCommand == 'L') || (m_receivedCommand == 'T') || (m_receivedCommand == 'Y') || (m_receivedCommand == 'M') || (m_receivedCommand == 'Q') || (m_receivedCommand == 'V') || (m_receivedCommand == 'R');
+}
+
+void SerialCommunication::beginPacket(unsigned char length)
+{
+	if (m_framed) {
+		Serial.write(frameSync);
+		m_sendCrc = 0;
+		writePacketByte(length);
+	}
+}
+
+void SerialCommunication::writePacketByte(unsigned char v)
+{
+	if (m_framed) {
+		m_sendCrc = crc8Update(m_sendCrc, v);
+		writeEscaped(v);
+	} else {
+		Serial.write(v);
+	}
+}
+
+void SerialCommunication::writePacketWord(unsigned long v)
+{
+	const unsigned int w = min(v, 65535ul);
+
+	writePacketByte((w >> 8) & 0xFF);
+	writePacketByte(w & 0xFF);
+}
+
+void SerialCommunication::endPacket()
+{
+	if (m_framed) {
+		writeEscaped(m_sendCrc);
+	}
+}
+
+void SerialCommunication::writeEscaped(unsigned char v)
+{
+	// Escaping bytes that would be taken as the start of a frame
+	if ((v == frameSync) || (v == frameEscape)) {
+		Serial.write(frameEscape);
+		Serial.write(v ^ frameEscapeXor);
+	} else {
+		Serial.write(v);
+	}
 }
 
 bool SerialCommunication::previousCommandComplete() const
 {
 	return (m_receivedCommand == 0) ||
 	       (m_receivedCommand == 'H') ||
-	       ((m_receivedPacketBytes == 1) && ((m_receivedCommand == 'S') || (m_receivedCommand == 'I'))) ||
-	       ((m_receivedPacketBytes == (SequencePoint::dim + 4)) && (m_receivedCommand == 'P'));
+	       (m_receivedCommand == 'V') ||
+	       (m_receivedCommand == 'R') ||
+	       ((m_receivedPacketBytes == 1) && ((m_receivedCommand == 'S') || (m_receivedCommand == 'I') || (m_receivedCommand == 'L') || (m_receivedCommand == 'M') || (m_receivedCommand == 'Q'))) ||
+	       ((m_receivedPacketBytes == linkTestLength) && (m_receivedCommand == 'T')) ||
+	       ((m_receivedPacketBytes == pingLength) && (m_receivedCommand == 'Y')) ||
+	       ((m_receivedPacketBytes == (SequencePoint::dim + 4)) && (m_receivedCommand == 'P')) ||
+	       ((m_receivedPacketBytes >= 6) && (m_receivedPacketBytes == (m_deltaPositions + 6)) && (m_receivedCommand == 'U'));
+}
+
+void SerialCommunication::completePoint()
+{
+	if (m_pointToFill != NULL) {
+		memcpy(m_pointToFill->point, m_lastPoint, sizeof(m_lastPoint));
+	}
 }
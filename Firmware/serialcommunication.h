@@ -22,6 +22,7 @@
 #ifndef SERIALCOMMUNICATION_H
 #define SERIALCOMMUNICATION_H
 
+#include <stdint.h>
 #include "sequencepoint.h"
 
 /**
@@ -33,7 +34,24 @@
  * has arrived using the is*() functions(); if it returns false, you must call
  * it again until it returns true to be able to rely on the value of the is*()
  * functions. Sequence points are written directly inside a SequencePoint object
- * that is provided using the setNextSequencePointToFill() function.
+ * that is provided using the setNextSequencePointToFill() function. Sequence
+ * points can also arrive as delta packets, carrying only the positions that
+ * changed since the previous point: the other positions are taken from the
+ * last point received.
+ *
+ * Packets can either be sent as they are or inside frames. A frame is the sync
+ * byte (0x7E), the length of the payload (1 byte), the payload (a packet) and
+ * the CRC-8 (polynomial 0x07) of length and payload. Inside frames, the sync
+ * and escape (0x7D) bytes are replaced by the escape byte followed by the
+ * original byte xor 0x20, so the sync byte always marks the start of a frame
+ * and we resynchronize at the next frame after bytes are lost or corrupted.
+ * Frames that are truncated or have a wrong length or CRC are discarded and
+ * counted (see corruptedFrames()), and a "frame discarded" packet is sent to
+ * the PC. After that, delta packets are discarded until a full sequence packet
+ * arrives, because the point they are relative to could have been lost. We
+ * switch to framed mode when the PC sends
+ * the first frame and then only accept frames and send packets inside frames
+ * until the board is reset.
  *
  * NOTE: we read the point dimension from start packages, but we always expect
  *       points to have a dimension equal to SequencePoint::dim. Check
@@ -41,6 +59,68 @@
  */
 class SerialCommunication
 {
+public:
+	/**
+	 * \brief The byte starting a frame
+	 */
+	static const unsigned char frameSync = 0x7E;
+
+	/**
+	 * \brief The byte escaping sync and escape bytes inside frames
+	 */
+	static const unsigned char frameEscape = 0x7D;
+
+	/**
+	 * \brief The value escaped bytes are xored with
+	 */
+	static const unsigned char frameEscapeXor = 0x20;
+
+	/**
+	 * \brief The maximum length of the payload of frames we receive
+	 *
+	 * This is the length of a full sequence packet, the longest packet the
+	 * PC sends
+	 */
+	static const unsigned char maxFramePayload = SequencePoint::dim + 5;
+
+	/**
+	 * \brief The highest link speed we support
+	 *
+	 * See baudRateForLinkSpeed()
+	 */
+	static const unsigned char maxLinkSpeed = 3;
+
+	/**
+	 * \brief The version of the stream protocol we speak
+	 *
+	 * Version 1 adds windowed flow control, delta sequence packets and
+	 * underrun packets. PCs speaking it send a protocol version packet
+	 * before starting a stream, to the others we only send "sequence
+	 * buffer (not) full" packets
+	 */
+	static const unsigned char protocolVersion = 1;
+
+	/**
+	 * \brief The number of bytes of link test packets
+	 */
+	static const unsigned char linkTestLength = 8;
+
+	/**
+	 * \brief The number of bytes of the timestamp of ping packets
+	 */
+	static const unsigned char pingLength = 4;
+
+	/**
+	 * \brief Returns the baud rate of a link speed
+	 *
+	 * Link speeds are 0 (115200, the rate the link starts at), 1 (250000),
+	 * 2 (500000) and 3 (1000000). The last three have no error with a 16
+	 * MHz clock. Invalid link speeds are taken as maxLinkSpeed
+	 * \param speed the link speed
+	 * \return the baud rate
+	 */
+	static long baudRateForLinkSpeed(unsigned char speed);
+
 public:
 	/**
 	 * \brief Constructor
@@ -57,6 +137,14 @@ public:
 	 */
 	void begin(long baudRate);
 
+	/**
+	 * \brief Changes the baud rate
+	 *
+	 * This waits until all data has been sent at the previous rate
+	 * \param baudRate the new baud rate
+	 */
+	void changeBaudRate(long baudRate);
+
 	/**
 	 * \brief Returns true if a command has been received
 	 *
@@ -72,11 +160,12 @@ public:
 	/**
 	 * \brief Returns true if we received a sequence point
 	 *
+	 * This is true both for full sequence points and for delta packets
 	 * \return true if we received a sequence point
 	 */
 	bool isSequencePoint() const
 	{
-		return (m_receivedCommand == 'P');
+		return (m_receivedCommand == 'P') || (m_receivedCommand == 'U');
 	}
 
 	/**
@@ -109,6 +198,76 @@ public:
 		return (m_receivedCommand == 'H');
 	}
 
+	/**
+	 * \brief Returns true if we received a link speed request
+	 *
+	 * \return true if we received a link speed request
+	 */
+	bool isLinkSpeed() const
+	{
+		return (m_receivedCommand == 'L');
+	}
+
+	/**
+	 * \brief Returns true if we received a link test packet
+	 *
+	 * \return true if we received a link test packet
+	 */
+	bool isLinkTest() const
+	{
+		return (m_receivedCommand == 'T');
+	}
+
+	/**
+	 * \brief Returns true if we received a link confirm packet
+	 *
+	 * \return true if we received a link confirm packet
+	 */
+	bool isLinkConfirm() const
+	{
+		return (m_receivedCommand == 'V');
+	}
+
+	/**
+	 * \brief Returns true if we received a credit resync request
+	 *
+	 * \return true if we received a credit resync request
+	 */
+	bool isCreditResync() const
+	{
+		return (m_receivedCommand == 'R');
+	}
+
+	/**
+	 * \brief Returns true if we received a protocol version packet
+	 *
+	 * \return true if we received a protocol version packet
+	 */
+	bool isProtocolVersion() const
+	{
+		return (m_receivedCommand == 'Q');
+	}
+
+	/**
+	 * \brief Returns true if we received a ping packet
+	 *
+	 * \return true if we received a ping packet
+	 */
+	bool isPing() const
+	{
+		return (m_receivedCommand == 'Y');
+	}
+
+	/**
+	 * \brief Returns true if we received a telemetry rate packet
+	 *
+	 * \return true if we received a telemetry rate packet
+	 */
+	bool isTelemetryRate() const
+	{
+		return (m_receivedCommand == 'M');
+	}
+
 	/**
 	 * \brief Returns the received command
 	 *
@@ -119,6 +278,43 @@ public:
 		return m_receivedCommand;
 	}
 
+	/**
+	 * \brief Returns true if we are in framed mode
+	 *
+	 * \return true if we are in framed mode
+	 */
+	bool framed() const
+	{
+		return m_framed;
+	}
+
+	/**
+	 * \brief Returns the number of corrupted frames received
+	 *
+	 * These are frames that were truncated or had a wrong length or CRC
+	 * \return the number of corrupted frames received since the board
+	 *         started
+	 */
+	unsigned long corruptedFrames() const
+	{
+		return m_corruptedFrames;
+	}
+
+	/**
+	 * \brief Returns the number of corrupted frames that carried a sequence
+	 *        point
+	 *
+	 * These are the corrupted frames whose packet type was received and is
+	 * the one of a full or delta sequence packet. Frames that lost their
+	 * packet type are not counted
+	 * \return the number of sequence points lost in corrupted frames since
+	 *         the board started
+	 */
+	unsigned long lostPoints() const
+	{
+		return m_lostPoints;
+	}
+
 	/**
 	 * \brief Sets the object to fill with the next sequence packet
 	 *
@@ -163,16 +359,130 @@ public:
 		return m_receivedPointDim;
 	}
 
+	/**
+	 * \brief Returns the link speed requested by the PC
+	 *
+	 * This is only valid after we received a link speed request
+	 * \return the requested link speed
+	 */
+	unsigned char requestedLinkSpeed() const
+	{
+		return m_requestedLinkSpeed;
+	}
+
+	/**
+	 * \brief Returns the telemetry rate requested by the PC
+	 *
+	 * This is only valid after we received a telemetry rate packet
+	 * \return the number of telemetry packets per second requested, 0 if
+	 *         telemetry packets should not be sent
+	 */
+	unsigned char requestedTelemetryRate() const
+	{
+		return m_requestedTelemetryRate;
+	}
+
+	/**
+	 * \brief Returns the protocol version of the PC
+	 *
+	 * This is only valid after we received a protocol version packet
+	 * \return the protocol version of the PC
+	 */
+	unsigned char pcProtocolVersion() const
+	{
+		return m_pcProtocolVersion;
+	}
+
 	/**
 	 * \brief Sends a buffer not full package
+	 *
+	 * This is only used with PCs not speaking protocolVersion
 	 */
 	void sendBufferNotFull();
 
 	/**
 	 * \brief Sends a buffer full package
+	 *
+	 * This is only used with PCs not speaking protocolVersion
 	 */
 	void sendBufferFull();
 
+	/**
+	 * \brief Sends a stream accepted package
+	 *
+	 * \param bufferDepth the number of sequence points the buffer can hold
+	 */
+	void sendStreamAccepted(unsigned char bufferDepth);
+
+	/**
+	 * \brief Sends a credits package
+	 *
+	 * \param n the number of additional sequence points the PC can send
+	 */
+	void sendCredits(unsigned char n);
+
+	/**
+	 * \brief Sends the answer to a credit resync request
+	 *
+	 * \param n the absolute number of sequence points the PC can send
+	 */
+	void sendCreditResync(unsigned char n);
+
+	/**
+	 * \brief Sends a link speed package
+	 *
+	 * \param speed the link speed that will be used
+	 */
+	void sendLinkSpeed(unsigned char speed);
+
+	/**
+	 * \brief Sends back the link test package we received
+	 *
+	 * Call this only after a link test package has been received
+	 */
+	void sendLinkTestEcho();
+
+	/**
+	 * \brief Sends a link confirmed package
+	 */
+	void sendLinkConfirmed();
+
+	/**
+	 * \brief Sends back the timestamp of the ping package we received,
+	 *        together with the current time
+	 *
+	 * Call this only after a ping package has been received
+	 */
+	void sendPingEcho();
+
+	/**
+	 * \brief Sends an underrun package
+	 *
+	 * \param duration how long the buffer remained empty in milliseconds.
+	 *                 Values above 65535 are sent as 65535
+	 */
+	void sendUnderrun(unsigned long duration);
+
+	/**
+	 * \brief Sends a telemetry package
+	 *
+	 * Times and counters that do not fit in 16 bits are sent as 65535
+	 * \param startedPoints the number of points started since the stream
+	 *                      started (only the lower 16 bits are sent)
+	 * \param phase the phase of the current point (see
+	 *              SequencePlayer::Phase)
+	 * \param pointTime the time since the current point started in
+	 *                  milliseconds
+	 * \param tickOverruns the number of control tick overruns since the
+	 *                     stream started
+	 * \param maxLateness the maximum lateness of point starts since the
+	 *                    stream started in microseconds
+	 * \param maxTickDuration the maximum duration of a control tick since
+	 *                        the previous telemetry package in microseconds
+	 * \param pwm the SequencePoint::dim PWM values last sent to servos
+	 */
+	void sendTelemetry(unsigned int startedPoints, unsigned char phase, unsigned long pointTime, unsigned long tickOverruns, unsigned long maxLateness, unsigned long maxTickDuration, const uint16_t* pwm);
+
 	/**
 	 * \brief Sends a sequence finished package
 	 */
@@ -182,6 +492,7 @@ public:
 	 * \brief Sends a debug packet
 	 *
 	 * \param msg the message to send. This cannot be longer than 255 bytes
+	 *            (253 bytes in framed mode), longer messages are truncated
 	 */
 	void sendDebugPacket(const char* msg);
 
@@ -201,6 +512,82 @@ private:
 	 */
 	bool previousCommandComplete() const;
 
+	/**
+	 * \brief Decodes one byte of a packet
+	 *
+	 * \param v the byte to decode
+	 * \return true if the byte completes a packet
+	 */
+	bool decodeByte(unsigned char v);
+
+	/**
+	 * \brief Processes one byte received in framed mode
+	 *
+	 * When a valid frame is complete, its payload is decoded. Bytes received
+	 * between frames mean that the sync byte of a frame was lost: they are
+	 * read as a frame to know the packet type and then reported as corrupted
+	 * \param v the byte received
+	 * \return true if the byte completes a valid frame with a packet
+	 */
+	bool frameByteReceived(unsigned char v);
+
+	/**
+	 * \brief Returns true if m_receivedCommand is a packet type we know
+	 *
+	 * \return true if m_receivedCommand is a packet type we know
+	 */
+	bool knownCommand() const;
+
+	/**
+	 * \brief Counts a corrupted frame and tells the PC
+	 */
+	void frameCorrupted();
+
+	/**
+	 * \brief Starts sending a packet
+	 *
+	 * In framed mode this sends the sync byte and the length. Send the
+	 * packet with writePacketByte() and then call endPacket()
+	 * \param length the length of the packet in bytes
+	 */
+	void beginPacket(unsigned char length);
+
+	/**
+	 * \brief Sends one byte of a packet
+	 *
+	 * \param v the byte to send
+	 */
+	void writePacketByte(unsigned char v);
+
+	/**
+	 * \brief Sends a 16 bits value of a packet, most significant byte first
+	 *
+	 * \param v the value to send. Values above 65535 are sent as 65535
+	 */
+	void writePacketWord(unsigned long v);
+
+	/**
+	 * \brief Finishes sending a packet
+	 *
+	 * In framed mode this sends the CRC
+	 */
+	void endPacket();
+
+	/**
+	 * \brief Sends a byte of a frame, escaping it if needed
+	 *
+	 * \param v the byte to send
+	 */
+	void writeEscaped(unsigned char v);
+
+	/**
+	 * \brief Copies the positions of the last point received into the
+	 *        object to fill
+	 *
+	 * This is called when a sequence point is complete
+	 */
+	void completePoint();
+
 	/**
 	 * \brief The pointer to the next SequencePoint object to fill
 	 */
@@ -228,6 +615,122 @@ private:
 	 */
 	unsigned char m_receivedPointDim;
 
+	/**
+	 * \brief The link speed requested by the PC
+	 */
+	unsigned char m_requestedLinkSpeed;
+
+	/**
+	 * \brief The telemetry rate requested by the PC
+	 */
+	unsigned char m_requestedTelemetryRate;
+
+	/**
+	 * \brief The protocol version of the PC
+	 */
+	unsigned char m_pcProtocolVersion;
+
+	/**
+	 * \brief The data of the last link test package
+	 */
+	unsigned char m_linkTestData[linkTestLength];
+
+	/**
+	 * \brief The timestamp of the last ping package
+	 */
+	unsigned char m_pingData[pingLength];
+
+	/**
+	 * \brief The positions of the last sequence point received
+	 *
+	 * Delta packets only carry the positions that changed, the others are
+	 * taken from here. Positions are stored here while they are received
+	 * (even if there is no object to fill) and copied to the object to fill
+	 * when the point is complete
+	 */
+	unsigned char m_lastPoint[SequencePoint::dim];
+
+	/**
+	 * \brief The mask of servos that changed in the delta packet being
+	 *        received
+	 *
+	 * Bit i is set if the position of servo i is in the packet. The bits of
+	 * positions already received are cleared
+	 */
+	unsigned int m_changedServos;
+
+	/**
+	 * \brief The number of positions in the delta packet being received
+	 */
+	unsigned char m_deltaPositions;
+
+	/**
+	 * \brief True if m_lastPoint has the positions of the last point the PC
+	 *        sent
+	 *
+	 * This is false until the first full sequence packet is received and
+	 * after a frame is lost. Delta packets received in framed mode while
+	 * this is false are discarded
+	 */
+	bool m_deltaBaseValid;
+
+	/**
+	 * \brief True if we are in framed mode
+	 */
+	bool m_framed;
+
+	/**
+	 * \brief True if we received the sync byte of a frame and are
+	 *        receiving it
+	 */
+	bool m_frameStarted;
+
+	/**
+	 * \brief True if the frame being received started with the sync byte
+	 *
+	 * This is false for frames whose sync byte was lost, which are always
+	 * reported as corrupted
+	 */
+	bool m_frameSynced;
+
+	/**
+	 * \brief True if bytes are discarded until the next sync byte
+	 *
+	 * This happens after a frame with an invalid length, the remaining bytes
+	 * belong to a frame that has already been reported as corrupted
+	 */
+	bool m_frameDiscarding;
+
+	/**
+	 * \brief True if the previous byte of the frame was the escape byte
+	 */
+	bool m_frameEscape;
+
+	/**
+	 * \brief The frame being received, without the sync byte and unescaped
+	 */
+	unsigned char m_frameBuffer[maxFramePayload + 2];
+
+	/**
+	 * \brief The number of bytes in m_frameBuffer
+	 */
+	unsigned char m_frameBytes;
+
+	/**
+	 * \brief The CRC of the packet being sent
+	 */
+	unsigned char m_sendCrc;
+
+	/**
+	 * \brief The number of corrupted frames received
+	 */
+	unsigned long m_corruptedFrames;
+
+	/**
+	 * \brief The number of corrupted frames that carried a sequence point
+	 */
+	unsigned long m_lostPoints;
+
 	/**
 	 * \brief Copy constructor is disabled
 	 */
@@ -0,0 +1,116 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <time.h>
+#include <errno.h>
+#include "Arduino.h"
+
+namespace {
+	/**
+	 * \brief Returns the microseconds elapsed since the first call
+	 *
+	 * \return the microseconds since the first call
+	 */
+	unsigned long long elapsedMicros()
+	{
+		static struct timespec start = {0, 0};
+		if ((start.tv_sec == 0) && (start.tv_nsec == 0)) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		return (unsigned long long)(now.tv_sec - start.tv_sec) * 1000000ull + (now.tv_nsec - start.tv_nsec) / 1000;
+	}
+
+	/**
+	 * \brief Sleeps for the given number of microseconds
+	 *
+	 * \param us the number of microseconds to sleep
+	 */
+	void sleepMicros(unsigned long long us)
+	{
+		struct timespec t;
+		t.tv_sec = us / 1000000ull;
+		t.tv_nsec = (us % 1000000ull) * 1000;
+		while ((nanosleep(&t, &t) == -1) && (errno == EINTR)) {
+		}
+	}
+
+	/**
+	 * \brief The values returned by analogRead()
+	 */
+	int analogValues[256] = {0};
+}
+
+// millis() and micros() wrap around at 32 bits like on the Arduino, so that
+// the firmware is tested with the same overflow behaviour
+char* ultoa(unsigned long val, char* s, int radix)
+{
+	// Writing digits in reverse order and then reversing them
+	int n = 0;
+	do {
+		const unsigned long digit = val % radix;
+		val /= radix;
+
+		s[n++] = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+	} while (val != 0);
+	s[n] = '\0';
+
+	for (int i = 0; i < (n / 2); ++i) {
+		const char c = s[i];
+		s[i] = s[n - 1 - i];
+		s[n - 1 - i] = c;
+	}
+
+	return s;
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(uint32_t)(elapsedMicros() / 1000ull);
+}
+
+unsigned long micros()
+{
+	return (unsigned long)(uint32_t)elapsedMicros();
+}
+
+void delay(unsigned long ms)
+{
+	sleepMicros((unsigned long long)ms * 1000ull);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	sleepMicros(us);
+}
+
+int analogRead(uint8_t pin)
+{
+	return analogValues[pin];
+}
+
+void setAnalogValue(uint8_t pin, int value)
+{
+	analogValues[pin] = value;
+}
@@ -0,0 +1,110 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// A minimal replacement of the Arduino core to build the firmware on the host.
+// Only the functions used by the firmware and by the Adafruit libraries are
+// provided. All C headers are included here, before defining the min() and
+// max() macros like the Arduino core does
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "binary.h"
+#include "Print.h"
+#include "HardwareSerial.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define pgm_read_word(addr) (*(const unsigned short *)(addr))
+
+#ifndef min
+	#define min(a,b) ((a)<(b)?(a):(b))
+#endif
+#ifndef max
+	#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+
+/**
+ * \brief Converts an unsigned long to a string
+ *
+ * This is provided by the avr-libc stdlib.h
+ * \param val the value to convert
+ * \param s the buffer where the string is written. It must be big enough
+ * \param radix the base to use
+ * \return s
+ */
+char* ultoa(unsigned long val, char* s, int radix);
+
+/**
+ * \brief Returns the milliseconds since the simulator started
+ *
+ * \return the milliseconds since the simulator started
+ */
+unsigned long millis();
+
+/**
+ * \brief Returns the microseconds since the simulator started
+ *
+ * \return the microseconds since the simulator started
+ */
+unsigned long micros();
+
+/**
+ * \brief Sleeps for the given number of milliseconds
+ *
+ * \param ms the number of milliseconds to sleep
+ */
+void delay(unsigned long ms);
+
+/**
+ * \brief Sleeps for the given number of microseconds
+ *
+ * \param us the number of microseconds to sleep
+ */
+void delayMicroseconds(unsigned int us);
+
+/**
+ * \brief Reads an analog pin
+ *
+ * The value is the one set with setAnalogValue() (0 by default)
+ * \param pin the pin to read
+ * \return the value of the pin
+ */
+int analogRead(uint8_t pin);
+
+/**
+ * \brief Sets the value returned by analogRead() for a pin
+ *
+ * This is not part of the Arduino API, it is used by the simulator to
+ * configure the simulated hardware
+ * \param pin the pin
+ * \param value the value analogRead() will return for the pin
+ */
+void setAnalogValue(uint8_t pin, int value);
+
+#endif
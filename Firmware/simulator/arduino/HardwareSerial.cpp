@@ -0,0 +1,206 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "HardwareSerial.h"
+
+HardwareSerial Serial;
+
+HardwareSerial::HardwareSerial()
+	: m_master(-1)
+	, m_slave(-1)
+	, m_portName()
+	, m_linkPath()
+	, m_buffer()
+	, m_bufferStart(0)
+	, m_bufferSize(0)
+	, m_bytesReceived(0)
+	, m_bytesSent(0)
+	, m_baudRate(0)
+{
+}
+
+HardwareSerial::~HardwareSerial()
+{
+	end();
+}
+
+void HardwareSerial::begin(long baudRate)
+{
+	m_baudRate = baudRate;
+
+	if (m_master != -1) {
+		return;
+	}
+
+	// Creating the pseudo terminal
+	m_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((m_master == -1) || (grantpt(m_master) == -1) || (unlockpt(m_master) == -1)) {
+		fprintf(stderr, "Cannot create the pseudo terminal: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	strncpy(m_portName, ptsname(m_master), sizeof(m_portName) - 1);
+
+	// Opening the slave in raw mode. Programs opening the port will set
+	// their own parameters
+	m_slave = open(m_portName, O_RDWR | O_NOCTTY);
+	if (m_slave == -1) {
+		fprintf(stderr, "Cannot open the pseudo terminal %s: %s\n", m_portName, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct termios attributes;
+	tcgetattr(m_slave, &attributes);
+	cfmakeraw(&attributes);
+	tcsetattr(m_slave, TCSANOW, &attributes);
+
+	// Reads from the master must not block
+	fcntl(m_master, F_SETFL, fcntl(m_master, F_GETFL) | O_NONBLOCK);
+
+	if (m_linkPath[0] != '\0') {
+		unlink(m_linkPath);
+		if (symlink(m_portName, m_linkPath) == -1) {
+			fprintf(stderr, "Cannot create the link %s: %s\n", m_linkPath, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fprintf(stderr, "Serial port: %s\n", (m_linkPath[0] != '\0') ? m_linkPath : m_portName);
+}
+
+void HardwareSerial::end()
+{
+	if (m_master == -1) {
+		return;
+	}
+
+	if (m_linkPath[0] != '\0') {
+		unlink(m_linkPath);
+	}
+
+	close(m_slave);
+	close(m_master);
+	m_slave = -1;
+	m_master = -1;
+	m_portName[0] = '\0';
+	m_bufferStart = 0;
+	m_bufferSize = 0;
+}
+
+int HardwareSerial::available()
+{
+	fillBuffer();
+
+	return m_bufferSize;
+}
+
+int HardwareSerial::peek()
+{
+	fillBuffer();
+
+	if (m_bufferSize == 0) {
+		return -1;
+	}
+
+	return m_buffer[m_bufferStart];
+}
+
+int HardwareSerial::read()
+{
+	fillBuffer();
+
+	if (m_bufferSize == 0) {
+		return -1;
+	}
+
+	const int c = m_buffer[m_bufferStart];
+	m_bufferStart = (m_bufferStart + 1) % bufferDimension;
+	--m_bufferSize;
+
+	return c;
+}
+
+void HardwareSerial::flush()
+{
+	if (m_master != -1) {
+		tcdrain(m_master);
+	}
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	if (m_master == -1) {
+		return 0;
+	}
+
+	// The master is non-blocking, waiting until we can write like the
+	// Arduino does when the transmit buffer is full
+	while (::write(m_master, &c, 1) != 1) {
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+			return 0;
+		}
+
+		struct pollfd p;
+		p.fd = m_master;
+		p.events = POLLOUT;
+		poll(&p, 1, -1);
+	}
+
+	++m_bytesSent;
+
+	return 1;
+}
+
+void HardwareSerial::setLinkPath(const char* path)
+{
+	m_linkPath[0] = '\0';
+	if (path != nullptr) {
+		strncpy(m_linkPath, path, sizeof(m_linkPath) - 1);
+	}
+}
+
+const char* HardwareSerial::portName() const
+{
+	return m_portName;
+}
+
+void HardwareSerial::fillBuffer()
+{
+	if ((m_master == -1) || (m_bufferSize == bufferDimension)) {
+		return;
+	}
+
+	// Reading at most up to the end of the circular buffer, the remaining
+	// part is read the next time
+	const int end = (m_bufferStart + m_bufferSize) % bufferDimension;
+	const int maxBytes = (end >= m_bufferStart) ? (bufferDimension - end) : (m_bufferStart - end);
+	const ssize_t n = ::read(m_master, &m_buffer[end], maxBytes);
+	if (n > 0) {
+		m_bufferSize += n;
+		m_bytesReceived += n;
+	}
+}
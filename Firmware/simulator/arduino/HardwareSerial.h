@@ -0,0 +1,224 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef HARDWARESERIAL_H
+#define HARDWARESERIAL_H
+
+#include "Print.h"
+
+/**
+ * \brief The serial port of the simulated Arduino
+ *
+ * The serial line is a pseudo terminal: begin() creates it and prints the
+ * name of the slave side, which can be opened by the GUI or by seqplayer as if
+ * it were the serial port of a real Arduino. Optionally a symbolic link to the
+ * slave side is created, so that the port has a fixed name. The baud rate is
+ * only recorded, data is transferred as fast as possible
+ */
+class HardwareSerial : public Print
+{
+public:
+	/**
+	 * \brief Constructor
+	 */
+	HardwareSerial();
+
+	/**
+	 * \brief Destructor
+	 *
+	 * Closes the pseudo terminal and removes the link
+	 */
+	virtual ~HardwareSerial();
+
+	/**
+	 * \brief Creates the pseudo terminal
+	 *
+	 * The simulator terminates if the pseudo terminal cannot be created.
+	 * If the pseudo terminal already exists, only the baud rate is changed
+	 * \param baudRate the baud rate
+	 */
+	void begin(long baudRate);
+
+	/**
+	 * \brief Closes the pseudo terminal
+	 */
+	void end();
+
+	/**
+	 * \brief Returns the number of bytes that can be read
+	 *
+	 * \return the number of bytes that can be read without blocking
+	 */
+	int available();
+
+	/**
+	 * \brief Returns the next byte without removing it
+	 *
+	 * \return the next byte or -1 if no data is available
+	 */
+	int peek();
+
+	/**
+	 * \brief Reads a byte
+	 *
+	 * \return the byte read or -1 if no data is available
+	 */
+	int read();
+
+	/**
+	 * \brief Waits until all data has been written
+	 */
+	void flush();
+
+	/**
+	 * \brief Writes a byte
+	 *
+	 * \param c the byte to write
+	 * \return the number of bytes written
+	 */
+	virtual size_t write(uint8_t c) override;
+
+	using Print::write;
+
+	/**
+	 * \brief Sets the path of the symbolic link to create to the slave side
+	 *        of the pseudo terminal
+	 *
+	 * This is not part of the Arduino API. It must be called before begin()
+	 * \param path the path of the link or nullptr to not create any link
+	 */
+	void setLinkPath(const char* path);
+
+	/**
+	 * \brief Returns the name of the slave side of the pseudo terminal
+	 *
+	 * This is not part of the Arduino API
+	 * \return the name of the port, an empty string if begin() has not been
+	 *         called
+	 */
+	const char* portName() const;
+
+	/**
+	 * \brief Returns the number of bytes received
+	 *
+	 * This is not part of the Arduino API
+	 * \return the number of bytes received
+	 */
+	unsigned long bytesReceived() const
+	{
+		return m_bytesReceived;
+	}
+
+	/**
+	 * \brief Returns the number of bytes sent
+	 *
+	 * This is not part of the Arduino API
+	 * \return the number of bytes sent
+	 */
+	unsigned long bytesSent() const
+	{
+		return m_bytesSent;
+	}
+
+	/**
+	 * \brief Returns the baud rate set with the last call to begin()
+	 *
+	 * This is not part of the Arduino API
+	 * \return the baud rate
+	 */
+	long baudRate() const
+	{
+		return m_baudRate;
+	}
+
+private:
+	/**
+	 * \brief Moves data from the pseudo terminal to the receive buffer
+	 */
+	void fillBuffer();
+
+	/**
+	 * \brief The dimension of the receive buffer
+	 *
+	 * This is the same as the one of the Arduino core
+	 */
+	static const int bufferDimension = 64;
+
+	/**
+	 * \brief The file descriptor of the master side of the pseudo terminal
+	 */
+	int m_master;
+
+	/**
+	 * \brief The file descriptor of the slave side of the pseudo terminal
+	 *
+	 * We keep the slave open so that reading from the master does not fail
+	 * when no program has the port open
+	 */
+	int m_slave;
+
+	/**
+	 * \brief The name of the slave side of the pseudo terminal
+	 */
+	char m_portName[256];
+
+	/**
+	 * \brief The path of the link to create
+	 */
+	char m_linkPath[256];
+
+	/**
+	 * \brief The receive buffer
+	 */
+	uint8_t m_buffer[bufferDimension];
+
+	/**
+	 * \brief The position of the first byte in the receive buffer
+	 */
+	int m_bufferStart;
+
+	/**
+	 * \brief The number of bytes in the receive buffer
+	 */
+	int m_bufferSize;
+
+	/**
+	 * \brief The number of bytes received
+	 */
+	unsigned long m_bytesReceived;
+
+	/**
+	 * \brief The number of bytes sent
+	 */
+	unsigned long m_bytesSent;
+
+	/**
+	 * \brief The baud rate set with the last call to begin()
+	 */
+	long m_baudRate;
+};
+
+/**
+ * \brief The serial port
+ */
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,113 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "Print.h"
+
+Print::~Print()
+{
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < size; ++i) {
+		n += write(buffer[i]);
+	}
+
+	return n;
+}
+
+size_t Print::write(const char* str)
+{
+	if (str == nullptr) {
+		return 0;
+	}
+
+	return write((const uint8_t*) str, strlen(str));
+}
+
+size_t Print::print(const char str[])
+{
+	return write(str);
+}
+
+size_t Print::print(char c)
+{
+	return write((uint8_t) c);
+}
+
+size_t Print::print(long n, int base)
+{
+	if (base == DEC) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%ld", n);
+
+		return write(buf);
+	}
+
+	return print((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+	// Converting from the least significant digit
+	char buf[8 * sizeof(unsigned long) + 1];
+	char* str = &buf[sizeof(buf) - 1];
+	*str = '\0';
+
+	if (base < 2) {
+		base = DEC;
+	}
+
+	do {
+		const unsigned long digit = n % base;
+		n /= base;
+
+		*--str = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
+	} while (n != 0);
+
+	return write(str);
+}
+
+size_t Print::print(int n, int base)
+{
+	return print((long) n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+	return print((unsigned long) n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", digits, n);
+
+	return write(buf);
+}
+
+size_t Print::println()
+{
+	return write("\r\n");
+}
@@ -0,0 +1,169 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef PRINT_H
+#define PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+/**
+ * \brief The base class of objects that can print text
+ *
+ * This mimics the Print class of the Arduino core. Subclasses only need to
+ * implement write(uint8_t)
+ */
+class Print
+{
+public:
+	/**
+	 * \brief Destructor
+	 */
+	virtual ~Print();
+
+	/**
+	 * \brief Writes a byte
+	 *
+	 * \param c the byte to write
+	 * \return the number of bytes written
+	 */
+	virtual size_t write(uint8_t c) = 0;
+
+	/**
+	 * \brief Writes a buffer
+	 *
+	 * The default implementation calls write(uint8_t) for each byte
+	 * \param buffer the buffer to write
+	 * \param size the size of the buffer
+	 * \return the number of bytes written
+	 */
+	virtual size_t write(const uint8_t* buffer, size_t size);
+
+	/**
+	 * \brief Writes a null-terminated string
+	 *
+	 * \param str the string to write
+	 * \return the number of bytes written
+	 */
+	size_t write(const char* str);
+
+	/**
+	 * \brief Prints a string
+	 *
+	 * \param str the string to print
+	 * \return the number of bytes written
+	 */
+	size_t print(const char str[]);
+
+	/**
+	 * \brief Prints a character
+	 *
+	 * \param c the character to print
+	 * \return the number of bytes written
+	 */
+	size_t print(char c);
+
+	/**
+	 * \brief Prints an integer
+	 *
+	 * \param n the number to print
+	 * \param base the base to use
+	 * \return the number of bytes written
+	 */
+	size_t print(long n, int base = DEC);
+
+	/**
+	 * \brief Prints an unsigned integer
+	 *
+	 * \param n the number to print
+	 * \param base the base to use
+	 * \return the number of bytes written
+	 */
+	size_t print(unsigned long n, int base = DEC);
+
+	/**
+	 * \brief Prints an integer
+	 *
+	 * \param n the number to print
+	 * \param base the base to use
+	 * \return the number of bytes written
+	 */
+	size_t print(int n, int base = DEC);
+
+	/**
+	 * \brief Prints an unsigned integer
+	 *
+	 * \param n the number to print
+	 * \param base the base to use
+	 * \return the number of bytes written
+	 */
+	size_t print(unsigned int n, int base = DEC);
+
+	/**
+	 * \brief Prints a floating point number
+	 *
+	 * \param n the number to print
+	 * \param digits the number of decimal digits
+	 * \return the number of bytes written
+	 */
+	size_t print(double n, int digits = 2);
+
+	/**
+	 * \brief Prints a newline
+	 *
+	 * \return the number of bytes written
+	 */
+	size_t println();
+
+	/**
+	 * \brief Prints a value followed by a newline
+	 *
+	 * \param v the value to print
+	 * \return the number of bytes written
+	 */
+	template <class T>
+	size_t println(T v)
+	{
+		const size_t n = print(v);
+		return n + println();
+	}
+
+	/**
+	 * \brief Prints a value followed by a newline
+	 *
+	 * \param v the value to print
+	 * \param format the base or the number of decimal digits
+	 * \return the number of bytes written
+	 */
+	template <class T>
+	size_t println(T v, int format)
+	{
+		const size_t n = print(v, format);
+		return n + println();
+	}
+};
+
+#endif
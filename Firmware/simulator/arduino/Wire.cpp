@@ -0,0 +1,135 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include "Wire.h"
+
+TwoWire Wire;
+TwoWire& Wire1 = Wire;
+
+I2CDevice::~I2CDevice()
+{
+}
+
+TwoWire::TwoWire()
+	: m_devices()
+	, m_clock(100000)
+	, m_txAddress(0)
+	, m_txBuffer()
+	, m_txSize(0)
+	, m_rxBuffer()
+	, m_rxPos(0)
+	, m_rxSize(0)
+	, m_transmissions(0)
+	, m_bytesTransferred(0)
+{
+}
+
+void TwoWire::begin()
+{
+}
+
+void TwoWire::setClock(uint32_t clock)
+{
+	m_clock = clock;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	m_txAddress = address;
+	m_txSize = 0;
+}
+
+uint8_t TwoWire::endTransmission()
+{
+	// The address byte and the data
+	++m_transmissions;
+	m_bytesTransferred += 1 + m_txSize;
+
+	I2CDevice* const device = m_devices[m_txAddress & 0x7F];
+	if (device == nullptr) {
+		return 2;
+	}
+
+	device->receive(m_txBuffer, m_txSize);
+	m_txSize = 0;
+
+	return 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	if (m_txSize >= BUFFER_LENGTH) {
+		return 0;
+	}
+
+	m_txBuffer[m_txSize++] = data;
+
+	return 1;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+	if (quantity > BUFFER_LENGTH) {
+		quantity = BUFFER_LENGTH;
+	}
+
+	++m_transmissions;
+	m_bytesTransferred += 1 + quantity;
+
+	m_rxPos = 0;
+	m_rxSize = 0;
+
+	I2CDevice* const device = m_devices[address & 0x7F];
+	if (device == nullptr) {
+		return 0;
+	}
+
+	for (; m_rxSize < quantity; ++m_rxSize) {
+		m_rxBuffer[m_rxSize] = device->transmit();
+	}
+
+	return quantity;
+}
+
+int TwoWire::available()
+{
+	return m_rxSize - m_rxPos;
+}
+
+int TwoWire::read()
+{
+	if (m_rxPos >= m_rxSize) {
+		return -1;
+	}
+
+	return m_rxBuffer[m_rxPos++];
+}
+
+void TwoWire::attach(uint8_t address, I2CDevice* device)
+{
+	m_devices[address & 0x7F] = device;
+}
+
+unsigned long TwoWire::busTime() const
+{
+	// Each byte is 8 data bits plus the acknowledge bit
+	return (unsigned long)((unsigned long long) m_bytesTransferred * 9ull * 1000000ull / m_clock);
+}
@@ -0,0 +1,240 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "Arduino.h"
+
+// The size of the transmit and receive buffers, the same as the Arduino core
+#define BUFFER_LENGTH 32
+
+/**
+ * \brief The interface of simulated I2C devices
+ *
+ * Devices are attached to a TwoWire bus at a given address
+ */
+class I2CDevice
+{
+public:
+	/**
+	 * \brief Destructor
+	 */
+	virtual ~I2CDevice();
+
+	/**
+	 * \brief Called when a transmission to the device ends
+	 *
+	 * \param data the bytes written by the master
+	 * \param size the number of bytes
+	 */
+	virtual void receive(const uint8_t* data, int size) = 0;
+
+	/**
+	 * \brief Called when the master reads a byte from the device
+	 *
+	 * \return the byte read
+	 */
+	virtual uint8_t transmit() = 0;
+};
+
+/**
+ * \brief The simulated I2C bus
+ *
+ * This mimics the TwoWire class of the Arduino core: bytes written between
+ * beginTransmission() and endTransmission() are buffered (at most
+ * BUFFER_LENGTH bytes, further bytes are dropped) and delivered to the device
+ * with the given address when the transmission ends. The bus also counts
+ * transmissions and bytes and estimates the time they would take on the real
+ * bus
+ */
+class TwoWire
+{
+public:
+	/**
+	 * \brief Constructor
+	 */
+	TwoWire();
+
+	/**
+	 * \brief Initializes the bus
+	 */
+	void begin();
+
+	/**
+	 * \brief Sets the clock of the bus
+	 *
+	 * This is only used to estimate the time spent on the bus
+	 * \param clock the clock frequency in Hz
+	 */
+	void setClock(uint32_t clock);
+
+	/**
+	 * \brief Starts a transmission to a device
+	 *
+	 * \param address the address of the device
+	 */
+	void beginTransmission(uint8_t address);
+
+	/**
+	 * \brief Ends the transmission and delivers data to the device
+	 *
+	 * \return 0 on success, 2 if no device has the given address
+	 */
+	uint8_t endTransmission();
+
+	/**
+	 * \brief Writes a byte in the transmit buffer
+	 *
+	 * \param data the byte to write
+	 * \return 1 if the byte was written, 0 if the buffer is full
+	 */
+	size_t write(uint8_t data);
+
+	/**
+	 * \brief Reads bytes from a device
+	 *
+	 * \param address the address of the device
+	 * \param quantity the number of bytes to read
+	 * \return the number of bytes read
+	 */
+	uint8_t requestFrom(uint8_t address, uint8_t quantity);
+
+	/**
+	 * \brief Returns the number of bytes that can be read
+	 *
+	 * \return the number of bytes that can be read
+	 */
+	int available();
+
+	/**
+	 * \brief Reads a byte received with requestFrom()
+	 *
+	 * \return the byte or -1 if no data is available
+	 */
+	int read();
+
+	/**
+	 * \brief Attaches a device to the bus
+	 *
+	 * This is not part of the Arduino API. The device is not owned by the
+	 * bus
+	 * \param address the address of the device
+	 * \param device the device
+	 */
+	void attach(uint8_t address, I2CDevice* device);
+
+	/**
+	 * \brief Returns the number of transmissions
+	 *
+	 * This is not part of the Arduino API
+	 * \return the number of transmissions (including reads)
+	 */
+	unsigned long transmissions() const
+	{
+		return m_transmissions;
+	}
+
+	/**
+	 * \brief Returns the number of bytes transferred
+	 *
+	 * This is not part of the Arduino API. Addresses are included
+	 * \return the number of bytes transferred
+	 */
+	unsigned long bytesTransferred() const
+	{
+		return m_bytesTransferred;
+	}
+
+	/**
+	 * \brief Returns the estimated time spent on the bus
+	 *
+	 * This is not part of the Arduino API. Each byte takes 9 clock cycles
+	 * \return the estimated time spent on the bus in microseconds
+	 */
+	unsigned long busTime() const;
+
+private:
+	/**
+	 * \brief The attached devices, indexed by address
+	 */
+	I2CDevice* m_devices[128];
+
+	/**
+	 * \brief The clock of the bus in Hz
+	 */
+	uint32_t m_clock;
+
+	/**
+	 * \brief The address of the current transmission
+	 */
+	uint8_t m_txAddress;
+
+	/**
+	 * \brief The transmit buffer
+	 */
+	uint8_t m_txBuffer[BUFFER_LENGTH];
+
+	/**
+	 * \brief The number of bytes in the transmit buffer
+	 */
+	int m_txSize;
+
+	/**
+	 * \brief The receive buffer
+	 */
+	uint8_t m_rxBuffer[BUFFER_LENGTH];
+
+	/**
+	 * \brief The position of the next byte to read in the receive buffer
+	 */
+	int m_rxPos;
+
+	/**
+	 * \brief The number of bytes in the receive buffer
+	 */
+	int m_rxSize;
+
+	/**
+	 * \brief The number of transmissions
+	 */
+	unsigned long m_transmissions;
+
+	/**
+	 * \brief The number of bytes transferred
+	 */
+	unsigned long m_bytesTransferred;
+};
+
+/**
+ * \brief The I2C bus
+ */
+extern TwoWire Wire;
+
+/**
+ * \brief The second I2C bus
+ *
+ * The Adafruit libraries use this when not compiled for AVR. It is the same
+ * bus as Wire
+ */
+extern TwoWire& Wire1;
+
+#endif
@@ -0,0 +1,118 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include "fakepca9685.h"
+#include "AdafruitPWMServoDriver.h"
+
+namespace {
+	/**
+	 * \brief The auto-increment bit of the MODE1 register
+	 */
+	const uint8_t mode1AutoIncrement = 0x20;
+
+	/**
+	 * \brief The last register of channels, the register address rolls
+	 *        over to 0 after this when auto-incrementing
+	 */
+	const uint8_t lastChannelRegister = LED0_OFF_H + 4 * (FakePCA9685::numChannels - 1);
+}
+
+FakePCA9685::FakePCA9685()
+	: m_registers()
+	, m_curRegister(0)
+	, m_trace(nullptr)
+	, m_channelUpdates(0)
+	, m_redundantChannelUpdates(0)
+	, m_lastValues()
+{
+}
+
+void FakePCA9685::setTrace(FILE* trace)
+{
+	m_trace = trace;
+}
+
+void FakePCA9685::receive(const uint8_t* data, int size)
+{
+	if (size == 0) {
+		return;
+	}
+
+	// The first byte is the register address, the others are written
+	// starting from that register
+	m_curRegister = data[0];
+	for (int i = 1; i < size; ++i) {
+		writeRegister(m_curRegister, data[i]);
+		nextRegister();
+	}
+}
+
+uint8_t FakePCA9685::transmit()
+{
+	const uint8_t value = m_registers[m_curRegister];
+	nextRegister();
+
+	return value;
+}
+
+uint16_t FakePCA9685::channelOn(int channel) const
+{
+	const int base = LED0_ON_L + 4 * channel;
+
+	return m_registers[base] | (m_registers[base + 1] << 8);
+}
+
+uint16_t FakePCA9685::channelOff(int channel) const
+{
+	const int base = LED0_OFF_L + 4 * channel;
+
+	return m_registers[base] | (m_registers[base + 1] << 8);
+}
+
+void FakePCA9685::writeRegister(uint8_t reg, uint8_t value)
+{
+	m_registers[reg] = value;
+
+	// Writing the high byte of the OFF value completes a channel update
+	if ((reg >= LED0_OFF_H) && (reg <= lastChannelRegister) && (((reg - LED0_OFF_H) % 4) == 0)) {
+		const int channel = (reg - LED0_OFF_H) / 4;
+		const uint32_t channelValue = (uint32_t(channelOn(channel)) << 16) | channelOff(channel);
+
+		++m_channelUpdates;
+		if (channelValue == m_lastValues[channel]) {
+			++m_redundantChannelUpdates;
+		}
+		m_lastValues[channel] = channelValue;
+
+		if (m_trace != nullptr) {
+			fprintf(m_trace, "%lu,%d,%u,%u\n", micros(), channel, channelOn(channel), channelOff(channel));
+		}
+	}
+}
+
+void FakePCA9685::nextRegister()
+{
+	if ((m_registers[PCA9685_MODE1] & mode1AutoIncrement) == 0) {
+		return;
+	}
+
+	m_curRegister = (m_curRegister == lastChannelRegister) ? 0 : (m_curRegister + 1);
+}
@@ -0,0 +1,159 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef FAKEPCA9685_H
+#define FAKEPCA9685_H
+
+#include <stdio.h>
+#include "Wire.h"
+
+/**
+ * \brief A fake PCA9685 PWM controller
+ *
+ * This implements the register file of the PCA9685 (including register
+ * auto-increment) and records the PWM values of the 16 channels. Each time
+ * the OFF value of a channel is written, a channel update is counted and, if
+ * a trace file is set, a line with the time in microseconds, the channel, the
+ * ON and the OFF value is written to it (comma separated values)
+ */
+class FakePCA9685 : public I2CDevice
+{
+public:
+	/**
+	 * \brief The number of channels
+	 */
+	static const int numChannels = 16;
+
+public:
+	/**
+	 * \brief Constructor
+	 */
+	FakePCA9685();
+
+	/**
+	 * \brief Sets the file where channel updates are written
+	 *
+	 * \param trace the file or nullptr to disable tracing. The file is not
+	 *              closed by this object
+	 */
+	void setTrace(FILE* trace);
+
+	/**
+	 * \brief Called when a transmission to the device ends
+	 *
+	 * \param data the bytes written by the master
+	 * \param size the number of bytes
+	 */
+	virtual void receive(const uint8_t* data, int size) override;
+
+	/**
+	 * \brief Called when the master reads a byte from the device
+	 *
+	 * \return the register at the current address
+	 */
+	virtual uint8_t transmit() override;
+
+	/**
+	 * \brief Returns the ON value of a channel
+	 *
+	 * \param channel the channel
+	 * \return the ON value of the channel
+	 */
+	uint16_t channelOn(int channel) const;
+
+	/**
+	 * \brief Returns the OFF value of a channel
+	 *
+	 * \param channel the channel
+	 * \return the OFF value of the channel
+	 */
+	uint16_t channelOff(int channel) const;
+
+	/**
+	 * \brief Returns the number of channel updates
+	 *
+	 * \return the number of times the OFF value of a channel was written
+	 */
+	unsigned long channelUpdates() const
+	{
+		return m_channelUpdates;
+	}
+
+	/**
+	 * \brief Returns the number of channel updates that did not change the
+	 *        value of the channel
+	 *
+	 * \return the number of redundant channel updates
+	 */
+	unsigned long redundantChannelUpdates() const
+	{
+		return m_redundantChannelUpdates;
+	}
+
+private:
+	/**
+	 * \brief Writes a register
+	 *
+	 * \param reg the register
+	 * \param value the new value
+	 */
+	void writeRegister(uint8_t reg, uint8_t value);
+
+	/**
+	 * \brief Moves to the next register if auto-increment is enabled
+	 */
+	void nextRegister();
+
+	/**
+	 * \brief The registers
+	 */
+	uint8_t m_registers[256];
+
+	/**
+	 * \brief The current register
+	 */
+	uint8_t m_curRegister;
+
+	/**
+	 * \brief The file where channel updates are written
+	 */
+	FILE* m_trace;
+
+	/**
+	 * \brief The number of channel updates
+	 */
+	unsigned long m_channelUpdates;
+
+	/**
+	 * \brief The number of channel updates that did not change the value
+	 */
+	unsigned long m_redundantChannelUpdates;
+
+	/**
+	 * \brief The ON and OFF values of channels at their last update
+	 *
+	 * The ON value is in the high 16 bits. This is used to detect redundant
+	 * updates
+	 */
+	uint32_t m_lastValues[numChannels];
+};
+
+#endif
@@ -0,0 +1,232 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+	#include <x86intrin.h>
+#endif
+#include "interpolation.h"
+#include "sequencepoint.h"
+
+/**
+ * \file interpolationbench.cpp
+ *
+ * A benchmark comparing the fixed-point interpolation kernel of SequencePlayer
+ * (see interpolation.h) with the previous implementation, which computed
+ * positions with a 32 bits multiplication and division per servo and then
+ * mapped them to PWM with another division. Both kernels compute the PWM of
+ * all servos for many steps of random segments; the time (in CPU cycles on
+ * x86, in nanoseconds elsewhere) per step is printed along with the maximum
+ * difference between the PWM values they compute. Absolute numbers on the host
+ * say little about the Arduino, where divisions are far more expensive
+ * relative to multiplications, but the ratio shows the trend.
+ *
+ * The two kernels do not agree within one position quantum (range / 255 PWM
+ * units, up to 5.25 for the servos below). The previous kernel truncates
+ * twice: the position to an integer (less than one quantum) and then the PWM
+ * value (less than one unit). The fixed-point kernel is not exact either: the
+ * PWM of the endpoints, the slope and the product of slope and time are each
+ * truncated, with errors of less than one unit that partly cancel. The
+ * expected bound is one quantum plus two PWM units (the largest difference
+ * measured is about 1.8 units beyond a quantum): the benchmark checks it for
+ * each servo and exits with an error if it is exceeded.
+ */
+
+namespace {
+	/**
+	 * \brief The number of segments to simulate
+	 */
+	const int numSegments = 2000;
+
+	/**
+	 * \brief The number of steps per segment
+	 */
+	const int stepsPerSegment = 200;
+
+	/**
+	 * \brief Returns true if the difference between the kernels is within
+	 *        the expected bound
+	 *
+	 * The bound is one position quantum plus two PWM units, see the
+	 * description of this file
+	 * \param diff the absolute difference between the PWM values
+	 * \param range the PWM range of the servo
+	 * \return true if diff is less than range / 255 + 2
+	 */
+	bool withinBound(int diff, uint16_t range)
+	{
+		return (255 * diff) < (int(range) + 2 * 255);
+	}
+
+	/**
+	 * \brief A segment between two random points
+	 */
+	struct Segment
+	{
+		uint8_t start[SequencePoint::dim];
+		uint8_t target[SequencePoint::dim];
+		uint32_t timeToTarget;
+	};
+
+	/**
+	 * \brief Returns the current time in cycles (x86) or nanoseconds
+	 *
+	 * \return the current time
+	 */
+	uint64_t now()
+	{
+#if defined(__i386__) || defined(__x86_64__)
+		return __rdtsc();
+#else
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+
+		return uint64_t(t.tv_sec) * 1000000000ull + t.tv_nsec;
+#endif
+	}
+
+	/**
+	 * \brief The previous kernel: interpolates the position and maps it to
+	 *        PWM
+	 *
+	 * Types are those of the Arduino (long is 32 bits)
+	 */
+	uint16_t oldKernel(uint8_t start, uint8_t target, uint32_t timeToTarget, uint32_t curTime, uint16_t pwmMin, uint16_t range)
+	{
+		uint8_t pos;
+		if (curTime >= timeToTarget) {
+			pos = target;
+		} else {
+			while (timeToTarget >= (1ul << 23)) {
+				timeToTarget >>= 1;
+				curTime >>= 1;
+			}
+
+			const int32_t d = int32_t(target) - int32_t(start);
+			pos = uint8_t(int32_t(start) + ((d * int32_t(curTime)) / int32_t(timeToTarget)));
+		}
+
+		return uint16_t(((int32_t(pos) * range) / 255) + pwmMin);
+	}
+}
+
+int main()
+{
+	// The PWM limits are those of the first servos of the robot
+	const uint16_t pwmMin[SequencePoint::dim] = {1150,  500,  500,  800,  900,  550,  800,  550,  920,  500,  750, 1000,  500,  750,  650, 1450};
+	const uint16_t pwmMax[SequencePoint::dim] = {1770, 1840, 1800, 2200, 1700, 1750, 2050, 1670, 2000, 1700, 2020, 1800, 1800, 1650, 2000, 2200};
+	uint16_t range[SequencePoint::dim];
+	uint32_t scale[SequencePoint::dim];
+	for (int i = 0; i < SequencePoint::dim; ++i) {
+		range[i] = pwmMax[i] - pwmMin[i];
+		scale[i] = Interpolation::pwmScale(range[i]);
+	}
+
+	// Generating random segments, with times to target between 1 ms and 65 s
+	srand(1);
+	Segment* segments = new Segment[numSegments];
+	for (int s = 0; s < numSegments; ++s) {
+		for (int i = 0; i < SequencePoint::dim; ++i) {
+			segments[s].start[i] = rand() % 256;
+			segments[s].target[i] = rand() % 256;
+		}
+		segments[s].timeToTarget = ((s % 2) == 0) ? (1000 + rand() % 1000000) : (1000 + rand() % 65000000);
+	}
+
+	uint32_t checksum = 0;
+	int maxDifference = 0;
+	int outOfBound = 0;
+
+	// The previous kernel
+	uint64_t oldTime = 0;
+	for (int s = 0; s < numSegments; ++s) {
+		const Segment& seg = segments[s];
+
+		const uint64_t start = now();
+		for (int k = 0; k < stepsPerSegment; ++k) {
+			const uint32_t t = (uint64_t(seg.timeToTarget) * k) / stepsPerSegment;
+			for (int i = 0; i < SequencePoint::dim; ++i) {
+				checksum += oldKernel(seg.start[i], seg.target[i], seg.timeToTarget, t, pwmMin[i], range[i]);
+			}
+		}
+		oldTime += now() - start;
+	}
+
+	// The fixed-point kernel, including the computation of slopes when the
+	// segment starts
+	uint64_t newTime = 0;
+	for (int s = 0; s < numSegments; ++s) {
+		const Segment& seg = segments[s];
+		uint16_t startPwm[SequencePoint::dim];
+		int32_t slope[SequencePoint::dim];
+
+		const uint64_t start = now();
+		const uint8_t shift = Interpolation::timeShift(seg.timeToTarget);
+		for (int i = 0; i < SequencePoint::dim; ++i) {
+			startPwm[i] = Interpolation::positionToPwm(seg.start[i], pwmMin[i], scale[i]);
+			slope[i] = Interpolation::pwmSlope(startPwm[i], Interpolation::positionToPwm(seg.target[i], pwmMin[i], scale[i]), seg.timeToTarget, shift);
+		}
+		for (int k = 0; k < stepsPerSegment; ++k) {
+			const uint32_t t = (uint64_t(seg.timeToTarget) * k) / stepsPerSegment;
+			for (int i = 0; i < SequencePoint::dim; ++i) {
+				checksum += Interpolation::interpolatePwm(startPwm[i], slope[i], t, shift);
+			}
+		}
+		newTime += now() - start;
+
+		// Comparing with the previous kernel (outside of the timed part)
+		for (int k = 0; k < stepsPerSegment; ++k) {
+			const uint32_t t = (uint64_t(seg.timeToTarget) * k) / stepsPerSegment;
+			for (int i = 0; i < SequencePoint::dim; ++i) {
+				const int diff = abs(int(Interpolation::interpolatePwm(startPwm[i], slope[i], t, shift)) - int(oldKernel(seg.start[i], seg.target[i], seg.timeToTarget, t, pwmMin[i], range[i])));
+				if (diff > maxDifference) {
+					maxDifference = diff;
+				}
+				if (!withinBound(diff, range[i])) {
+					++outOfBound;
+				}
+			}
+		}
+	}
+
+	delete[] segments;
+
+	const double steps = double(numSegments) * stepsPerSegment;
+#if defined(__i386__) || defined(__x86_64__)
+	const char* unit = "cycles";
+#else
+	const char* unit = "ns";
+#endif
+	printf("Previous kernel: %.1f %s per step\n", oldTime / steps, unit);
+	printf("Fixed-point kernel: %.1f %s per step\n", newTime / steps, unit);
+	printf("Maximum PWM difference: %d (checksum %u)\n", maxDifference, checksum);
+
+	if (outOfBound != 0) {
+		printf("Error: %d PWM values differ by one position quantum plus two units or more\n", outOfBound);
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
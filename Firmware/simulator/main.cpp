@@ -0,0 +1,202 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "fakepca9685.h"
+#include "sequenceplayer.h"
+#include "serialcommunication.h"
+
+/**
+ * \file main.cpp
+ *
+ * The simulator of the robot firmware. This runs setup() and loop() of
+ * Firmware.ino on the host, with a pseudo terminal as the serial line and a
+ * fake PCA9685 on the I2C bus, so that the GUI and seqplayer can stream
+ * sequences to a simulated robot. When the simulator terminates (after the
+ * given duration or when interrupted) some statistics are printed on the
+ * standard error
+ */
+
+// The functions and objects of the sketch
+void setup();
+void loop();
+extern SequencePlayer sequencePlayer;
+extern unsigned long tickOverruns;
+extern unsigned long streamUnderruns;
+extern SerialCommunication serialCommunication;
+
+namespace {
+	/**
+	 * \brief The I2C address of the PWM controller
+	 */
+	const uint8_t pwmAddress = 0x40;
+
+	/**
+	 * \brief The I2C address of the LED backpack
+	 */
+	const uint8_t faceAddress = 0x71;
+
+	/**
+	 * \brief The analog pin used to read the battery charge
+	 */
+	const uint8_t batteryPin = 3;
+
+	/**
+	 * \brief A device ignoring everything it receives
+	 *
+	 * This is used for the LED backpack
+	 */
+	class NullI2CDevice : public I2CDevice
+	{
+	public:
+		virtual void receive(const uint8_t*, int) override
+		{
+		}
+
+		virtual uint8_t transmit() override
+		{
+			return 0;
+		}
+	};
+
+	/**
+	 * \brief Set to true when the simulator has to terminate
+	 */
+	volatile sig_atomic_t terminate = 0;
+
+	/**
+	 * \brief The handler of termination signals
+	 */
+	void terminationHandler(int)
+	{
+		terminate = 1;
+	}
+
+	/**
+	 * \brief Prints the usage message
+	 *
+	 * \param name the name of the program
+	 */
+	void usage(const char* name)
+	{
+		fprintf(stderr, "Usage: %s [options]\n", name);
+		fprintf(stderr, "Runs the robot firmware on a simulated Arduino\n\n");
+		fprintf(stderr, "  -l, --link PATH       creates a link to the serial port at PATH\n");
+		fprintf(stderr, "  -t, --trace FILE      writes PWM channel updates to FILE (CSV)\n");
+		fprintf(stderr, "  -d, --duration SECS   terminates after SECS seconds\n");
+		fprintf(stderr, "  -b, --battery VALUE   the analog reading of the battery (default 420)\n");
+		fprintf(stderr, "  -h, --help            shows this message\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const char* linkPath = nullptr;
+	const char* tracePath = nullptr;
+	unsigned long duration = 0;
+	int battery = 420;
+
+	const struct option options[] = {
+		{"link", required_argument, nullptr, 'l'},
+		{"trace", required_argument, nullptr, 't'},
+		{"duration", required_argument, nullptr, 'd'},
+		{"battery", required_argument, nullptr, 'b'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "l:t:d:b:h", options, nullptr)) != -1) {
+		switch (opt) {
+			case 'l':
+				linkPath = optarg;
+				break;
+			case 't':
+				tracePath = optarg;
+				break;
+			case 'd':
+				duration = strtoul(optarg, nullptr, 10);
+				break;
+			case 'b':
+				battery = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	// Setting up the simulated hardware
+	FakePCA9685 pwm;
+	NullI2CDevice face;
+	Wire.attach(pwmAddress, &pwm);
+	Wire.attach(faceAddress, &face);
+	setAnalogValue(batteryPin, battery);
+	Serial.setLinkPath(linkPath);
+
+	FILE* trace = nullptr;
+	if (tracePath != nullptr) {
+		trace = fopen(tracePath, "w");
+		if (trace == nullptr) {
+			fprintf(stderr, "Cannot open trace file %s\n", tracePath);
+			return EXIT_FAILURE;
+		}
+		fprintf(trace, "time,channel,on,off\n");
+		pwm.setTrace(trace);
+	}
+
+	signal(SIGINT, terminationHandler);
+	signal(SIGTERM, terminationHandler);
+
+	// Running the sketch
+	const unsigned long startTime = millis();
+	unsigned long loops = 0;
+	setup();
+	while (!terminate && ((duration == 0) || ((millis() - startTime) < (duration * 1000)))) {
+		loop();
+		++loops;
+	}
+	const unsigned long elapsed = millis() - startTime;
+
+	Serial.end();
+	if (trace != nullptr) {
+		fclose(trace);
+	}
+
+	// Printing statistics
+	fprintf(stderr, "Simulated time: %lu ms\n", elapsed);
+	fprintf(stderr, "Loop iterations: %lu (%.1f per second)\n", loops, (elapsed == 0) ? 0.0 : (loops * 1000.0 / elapsed));
+	fprintf(stderr, "Serial bytes received: %lu, sent: %lu, final baud rate: %ld\n", Serial.bytesReceived(), Serial.bytesSent(), Serial.baudRate());
+	fprintf(stderr, "I2C transmissions: %lu, bytes: %lu, estimated bus time: %lu us\n", Wire.transmissions(), Wire.bytesTransferred(), Wire.busTime());
+	fprintf(stderr, "PWM channel updates: %lu (%lu redundant)\n", pwm.channelUpdates(), pwm.redundantChannelUpdates());
+	fprintf(stderr, "Servo writes issued: %lu, skipped: %lu, control tick overruns: %lu (last stream)\n", sequencePlayer.issuedWrites(), sequencePlayer.skippedWrites(), tickOverruns);
+	fprintf(stderr, "Scheduled points: %lu, lateness total: %lu us, max: %lu us, underruns: %lu (last stream)\n", sequencePlayer.scheduledPoints(), sequencePlayer.totalLateness(), sequencePlayer.maxLateness(), streamUnderruns);
+	fprintf(stderr, "Serial protocol: %s, corrupted frames: %lu\n", serialCommunication.framed() ? "framed" : "unframed", serialCommunication.corruptedFrames());
+
+	return EXIT_SUCCESS;
+}
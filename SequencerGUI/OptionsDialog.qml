@@ -81,6 +81,103 @@ Window {
 
 				onTextChanged: serialCommunication.baudRate = parseFloat(text)
 			}
+
+			Text {
+				text: "Immediate rate:"
+			}
+
+			// This is the field to set the maximum number of points per
+			// second sent in immediate mode (0 means no limit)
+			TextField {
+				id: immediateRateField
+				Layout.fillWidth: true
+
+				validator: IntValidator {
+					bottom: 0
+					top: 1000
+				}
+
+				text: serialCommunication.immediateRate;
+
+				onTextChanged: serialCommunication.immediateRate = parseInt(text)
+			}
+
+			Text {
+				text: "Ping interval (ms):"
+			}
+
+			// This is the field to set how often the round trip time to the
+			// robot is measured (0 means never, older firmware doesn't
+			// support pings)
+			TextField {
+				id: pingIntervalField
+				Layout.fillWidth: true
+
+				validator: IntValidator {
+					bottom: 0
+					top: 60000
+				}
+
+				text: serialCommunication.pingInterval;
+
+				onTextChanged: serialCommunication.pingInterval = parseInt(text)
+			}
+
+			Text {
+				text: "Telemetry rate (Hz):"
+			}
+
+			// This is the field to set how many telemetry packets per second
+			// the robot sends (0 means none, older firmware doesn't support
+			// telemetry)
+			TextField {
+				id: telemetryRateField
+				Layout.fillWidth: true
+
+				validator: IntValidator {
+					bottom: 0
+					top: 255
+				}
+
+				text: serialCommunication.telemetryRate;
+
+				onTextChanged: serialCommunication.telemetryRate = parseInt(text)
+			}
+
+			Text {
+				text: "Framed protocol:"
+			}
+
+			// This is the checkbox to send packets inside frames, detecting
+			// corrupted data. Older firmware doesn't support frames. This can
+			// only be changed while the port is closed
+			CheckBox {
+				id: framedProtocolCheckBox
+				Layout.fillWidth: true
+				enabled: !serialCommunication.isConnected
+
+				text: "Send packets inside frames"
+				checked: serialCommunication.framedProtocol
+
+				onCheckedChanged: serialCommunication.framedProtocol = checked
+			}
+
+			Text {
+				text: "I/O thread:"
+			}
+
+			// This is the checkbox to move serial communication to a separate
+			// thread. This can only be changed while the port is closed
+			CheckBox {
+				id: ioThreadCheckBox
+				Layout.fillWidth: true
+				enabled: !serialCommunication.isConnected
+
+				text: "Serial I/O in a separate thread"
+				checked: serialCommunication.useIOThread
+
+				onCheckedChanged: serialCommunication.useIOThread = checked
+			}
 		}
 
 		Button {
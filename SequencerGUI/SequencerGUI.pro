@@ -5,12 +5,17 @@ QT += qml quick widgets serialport
 # CONFIG += c++14
 # QMAKE_CXXFLAGS += -std=c++14 -Wall -Wextra
 QMAKE_CXXFLAGS += -std=c++11 -Wall -Wextra
+# Uncomment to compile out the trace of serial packets (see PacketTrace)
+# DEFINES += SEQUENCERGUI_NO_PACKET_TRACE
 
 SOURCES += main.cpp \
     sequencer.cpp \
     sequence.cpp \
+    sequencemodel.cpp \
     sequencepoint.cpp \
-    serialcommunication.cpp
+    serialcommunication.cpp \
+    serialworker.cpp \
+    packettrace.cpp
 
 RESOURCES += qml.qrc
 
@@ -23,6 +28,12 @@ include(deployment.pri)
 HEADERS += \
     sequencer.h \
     sequence.h \
+    sequencemodel.h \
     sequencepoint.h \
     utils.h \
-    serialcommunication.h
+    ringbuffer.h \
+    packettrace.h \
+    latencyhistogram.h \
+    telemetrysample.h \
+    serialcommunication.h \
+    serialworker.h
@@ -80,6 +80,13 @@ Item {
 					sequence.setPointCoordinate(servoID, value)
 				}
 			}
+
+			// All changes made while dragging are a single undo step
+			onPressedChanged: {
+				if (!pressed) {
+					sequence.closeUndoStep()
+				}
+			}
 		}
 
 		TextField {
@@ -96,6 +103,8 @@ Item {
 					slider.value = parseFloat(text)
 				}
 			}
+
+			onEditingFinished: sequence.closeUndoStep()
 		}
 	}
 
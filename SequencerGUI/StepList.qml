@@ -0,0 +1,73 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+// Qt 5.4
+//import QtQuick 2.4
+//import QtQuick.Controls 1.3
+//import QtQuick.Layouts 1.1
+
+// Qt 5.2
+import QtQuick 2.0
+import QtQuick.Controls 1.1
+import QtQuick.Layouts 1.1
+
+// The list of all steps of the sequence. Only the delegates of visible steps
+// are created, so this stays responsive with long sequences. Clicking on a step
+// makes it the current one
+Item {
+	id: mainItem
+	implicitHeight: 150
+	implicitWidth: 200
+
+	ScrollView {
+		anchors.fill: parent
+		anchors.margins: 5
+
+		ListView {
+			id: stepList
+
+			model: sequenceModel
+			currentIndex: sequence.curPoint
+			clip: true
+
+			delegate: Rectangle {
+				width: stepList.width
+				height: stepText.implicitHeight + 4
+				color: model.isCurrent ? "lightsteelblue" : "transparent"
+
+				Text {
+					id: stepText
+					anchors.verticalCenter: parent.verticalCenter
+					anchors.left: parent.left
+					anchors.leftMargin: 2
+
+					text: "Step " + index + ": duration " + model.duration + " ms, time to target " + model.timeToTarget + " ms"
+				}
+
+				MouseArea {
+					anchors.fill: parent
+
+					onClicked: sequence.setCurPoint(index)
+				}
+			}
+		}
+	}
+}
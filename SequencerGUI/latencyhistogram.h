@@ -0,0 +1,221 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QMetaType>
+#include <QString>
+#include <QTextStream>
+#include <algorithm>
+
+/**
+ * \brief A histogram of durations in microseconds
+ *
+ * Buckets have exponentially growing widths: bucket 0 contains durations
+ * below 2 microseconds, bucket i (i > 0) durations from 2^i (included) to
+ * 2^(i + 1) (excluded) microseconds and the last bucket also all longer
+ * durations. This gives the same relative resolution to sub-millisecond round
+ * trips and to underruns lasting seconds, with a fixed, small size, so the
+ * histogram can be copied and passed in queued signals. The count, minimum,
+ * maximum and sum of all durations are also kept.
+ */
+class LatencyHistogram
+{
+public:
+	/**
+	 * \brief The number of buckets
+	 */
+	static const int numBuckets = 24;
+
+	/**
+	 * \brief Constructor
+	 *
+	 * Creates an empty histogram
+	 */
+	LatencyHistogram()
+		: m_buckets()
+		, m_count(0)
+		, m_min(0)
+		, m_max(0)
+		, m_sum(0)
+	{
+		clear();
+	}
+
+	/**
+	 * \brief Returns the smallest duration in a bucket
+	 *
+	 * \param i the index of the bucket
+	 * \return the smallest duration in the bucket in microseconds
+	 */
+	static quint32 bucketLowerBound(int i)
+	{
+		return (i == 0) ? 0 : (quint32(1) << i);
+	}
+
+	/**
+	 * \brief Returns the duration that ends a bucket
+	 *
+	 * \param i the index of the bucket
+	 * \return the first duration in microseconds after the bucket, 0 for
+	 *         the last bucket, which has no upper bound
+	 */
+	static quint32 bucketUpperBound(int i)
+	{
+		return (i == (numBuckets - 1)) ? 0 : (quint32(1) << (i + 1));
+	}
+
+	/**
+	 * \brief Adds a duration
+	 *
+	 * \param duration the duration in microseconds
+	 */
+	void add(quint32 duration)
+	{
+		int bucket = 0;
+		while ((bucket < (numBuckets - 1)) && (duration >= bucketUpperBound(bucket))) {
+			++bucket;
+		}
+		++m_buckets[bucket];
+
+		m_min = (m_count == 0) ? duration : std::min(m_min, duration);
+		m_max = std::max(m_max, duration);
+		m_sum += duration;
+		++m_count;
+	}
+
+	/**
+	 * \brief Removes all durations
+	 */
+	void clear()
+	{
+		std::fill(m_buckets, m_buckets + numBuckets, 0);
+		m_count = 0;
+		m_min = 0;
+		m_max = 0;
+		m_sum = 0;
+	}
+
+	/**
+	 * \brief Returns the number of durations in a bucket
+	 *
+	 * \param i the index of the bucket
+	 * \return the number of durations in the bucket
+	 */
+	int bucketCount(int i) const
+	{
+		return m_buckets[i];
+	}
+
+	/**
+	 * \brief Returns the number of durations
+	 *
+	 * \return the number of durations
+	 */
+	int count() const
+	{
+		return m_count;
+	}
+
+	/**
+	 * \brief Returns the shortest duration
+	 *
+	 * \return the shortest duration in microseconds, 0 if the histogram is
+	 *         empty
+	 */
+	quint32 min() const
+	{
+		return m_min;
+	}
+
+	/**
+	 * \brief Returns the longest duration
+	 *
+	 * \return the longest duration in microseconds, 0 if the histogram is
+	 *         empty
+	 */
+	quint32 max() const
+	{
+		return m_max;
+	}
+
+	/**
+	 * \brief Returns the mean duration
+	 *
+	 * \return the mean duration in microseconds, 0 if the histogram is
+	 *         empty
+	 */
+	double mean() const
+	{
+		return (m_count == 0) ? 0.0 : (double(m_sum) / double(m_count));
+	}
+
+	/**
+	 * \brief Writes the histogram as CSV rows
+	 *
+	 * One row is written for each bucket: the name, the bounds of the bucket
+	 * in microseconds (the upper bound is empty for the last bucket) and the
+	 * number of durations. The header is not written
+	 * \param stream the stream where rows are written
+	 * \param name the name of the histogram, used as the first column
+	 */
+	void writeCsv(QTextStream& stream, const QString& name) const
+	{
+		for (int i = 0; i < numBuckets; ++i) {
+			stream << name << "," << bucketLowerBound(i) << ",";
+			if (bucketUpperBound(i) != 0) {
+				stream << bucketUpperBound(i);
+			}
+			stream << "," << m_buckets[i] << "\n";
+		}
+	}
+
+private:
+	/**
+	 * \brief The number of durations in each bucket
+	 */
+	int m_buckets[numBuckets];
+
+	/**
+	 * \brief The number of durations
+	 */
+	int m_count;
+
+	/**
+	 * \brief The shortest duration
+	 */
+	quint32 m_min;
+
+	/**
+	 * \brief The longest duration
+	 */
+	quint32 m_max;
+
+	/**
+	 * \brief The sum of all durations
+	 */
+	quint64 m_sum;
+};
+
+Q_DECLARE_METATYPE(LatencyHistogram)
+
+#endif // LATENCYHISTOGRAM_H
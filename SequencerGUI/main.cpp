@@ -25,15 +25,17 @@
 #include <QtQml>
 #include "sequencer.h"
 #include "sequence.h"
+#include "sequencemodel.h"
 #include "serialcommunication.h"
 
 int main(int argc, char *argv[])
 {
 	QApplication app(argc, argv);
 
-	// Registering the Sequence and SerialCommunication types to QML. It is not possible to create
-	// these types directly from QML (but we don't need to)
+	// Registering the Sequence, SequenceModel and SerialCommunication types to QML. It is not
+	// possible to create these types directly from QML (but we don't need to)
 	qmlRegisterType<Sequence>();
+	qmlRegisterType<SequenceModel>();
 	qmlRegisterType<SerialCommunication>();
 
 	// Creating the main class of the application
@@ -110,6 +110,22 @@ ApplicationWindow {
 		}
 		Menu {
 			title: qsTr("&Edit")
+			MenuItem {
+				text: qsTr("&Undo")
+				shortcut: StandardKey.Undo
+				enabled: sequence.canUndo
+
+				onTriggered: sequence.undo();
+			}
+			MenuItem {
+				text: qsTr("&Redo")
+				shortcut: StandardKey.Redo
+				enabled: sequence.canRedo
+
+				onTriggered: sequence.redo();
+			}
+			MenuSeparator {
+			}
 			MenuItem {
 				text: qsTr("O&ptions")
 				onTriggered: optionsDialog.show(qsTr("Option action triggered"));
@@ -136,6 +152,13 @@ ApplicationWindow {
 				id: sequenceControl
 				Layout.minimumHeight: implicitHeight
 			}
+
+			StepList {
+				id: stepList
+				Layout.minimumHeight: implicitHeight
+
+				Layout.fillHeight: true
+			}
 		}
 
 		ServoControl {
@@ -182,7 +205,7 @@ ApplicationWindow {
 	FileDialog {
 		id: openSequenceDialog
 		title: "Open..."
-		nameFilters: ["Sequence files (*.seq)", "All files (*)"]
+		nameFilters: ["Sequence files (*.seq *.seqb)", "All files (*)"]
 		selectExisting: true
 
 		onAccepted: {
@@ -194,7 +217,7 @@ ApplicationWindow {
 	FileDialog {
 		id: saveSequenceDialog
 		title: "Save As..."
-		nameFilters: ["Sequence files (*.seq)"]
+		nameFilters: ["Sequence files (*.seq)", "Binary sequence files (*.seqb)"]
 		selectExisting: false
 
 		onAccepted: {
@@ -0,0 +1,94 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include "packettrace.h"
+#include <algorithm>
+#include <cstring>
+
+PacketTrace::PacketTrace()
+	: m_clock()
+	, m_enabled(0)
+	, m_writeIndex(0)
+	, m_readIndex(0)
+	, m_droppedRecords(0)
+{
+	m_clock.start();
+}
+
+void PacketTrace::setEnabled(bool enabled)
+{
+	m_enabled.fetchAndStoreOrdered(enabled ? 1 : 0);
+}
+
+int PacketTrace::dump(QTextStream& stream)
+{
+	const int writeIndex = m_writeIndex.loadAcquire();
+	int readIndex = m_readIndex.load();
+
+	int numRecords = 0;
+	while (readIndex != writeIndex) {
+		const Record& r = m_records[readIndex & positionMask];
+
+		stream << QString::number(double(r.time) / 1000000.0, 'f', 3) << ((r.direction == Direction::Sent) ? " >" : " <");
+		for (int i = 0; i < r.recordedBytes; ++i) {
+			stream << " " << QString::number(static_cast<unsigned char>(r.data[i]), 16).rightJustified(2, '0');
+		}
+		if (r.recordedBytes < r.length) {
+			stream << " ... (" << r.length << " bytes)";
+		}
+		stream << "\n";
+
+		readIndex = (readIndex + 1) & indexMask;
+		++numRecords;
+	}
+
+	// Releasing the records we read to the producer
+	m_readIndex.storeRelease(readIndex);
+
+	const int droppedRecords = m_droppedRecords.fetchAndStoreOrdered(0);
+	if (droppedRecords != 0) {
+		stream << "(" << droppedRecords << " records dropped, the trace was full)\n";
+	}
+
+	return numRecords;
+}
+
+void PacketTrace::append(Direction direction, const char* data, int length)
+{
+	const int writeIndex = m_writeIndex.load();
+	const int readIndex = m_readIndex.loadAcquire();
+
+	if (((writeIndex - readIndex) & indexMask) == capacity) {
+		m_droppedRecords.fetchAndAddOrdered(1);
+
+		return;
+	}
+
+	Record& r = m_records[writeIndex & positionMask];
+	r.time = m_clock.nsecsElapsed();
+	r.direction = direction;
+	r.recordedBytes = static_cast<quint8>(std::min(length, maxRecordedBytes));
+	r.length = static_cast<quint16>(std::min(length, 0xFFFF));
+	memcpy(r.data, data, r.recordedBytes);
+
+	// Publishing the record to the consumer
+	m_writeIndex.storeRelease((writeIndex + 1) & indexMask);
+}
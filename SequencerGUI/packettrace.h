@@ -0,0 +1,222 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef PACKETTRACE_H
+#define PACKETTRACE_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+/**
+ * \brief A trace of the packets exchanged with the hardware
+ *
+ * Packets are stored as binary records (a timestamp, the direction and the
+ * first bytes of the packet) in a fixed-size ring and are only formatted when
+ * the trace is dumped, so tracing costs a copy of a few bytes per packet. The
+ * ring is lock-free, with a single producer (the thread of the SerialWorker)
+ * and a single consumer (the thread calling dump()). When the ring is full new
+ * records are discarded and counted. Tracing is disabled by default: record()
+ * then only checks a flag. If SEQUENCERGUI_NO_PACKET_TRACE is defined at
+ * compile time, record() does nothing at all.
+ */
+class PacketTrace
+{
+public:
+	/**
+	 * \brief The direction of a traced packet
+	 */
+	enum class Direction : quint8 {
+		Sent,
+		Received
+	};
+
+	/**
+	 * \brief The maximum number of records in the trace
+	 */
+	static const int capacity = 1024;
+
+	/**
+	 * \brief The maximum number of bytes of a packet stored in a record
+	 */
+	static const int maxRecordedBytes = 28;
+
+	/**
+	 * \brief Constructor
+	 *
+	 * Creates an empty, disabled trace
+	 */
+	PacketTrace();
+
+	/**
+	 * \brief Copy constructor is deleted
+	 */
+	PacketTrace(const PacketTrace&) = delete;
+
+	/**
+	 * \brief Move constructor is deleted
+	 */
+	PacketTrace(PacketTrace&&) = delete;
+
+	/**
+	 * \brief Returns true if packets are being traced
+	 *
+	 * \return true if packets are being traced
+	 */
+	bool isEnabled() const
+	{
+		return m_enabled.load() != 0;
+	}
+
+	/**
+	 * \brief Enables or disables tracing
+	 *
+	 * This can be called from any thread. Records already in the trace are
+	 * kept
+	 * \param enabled if true packets are traced
+	 */
+	void setEnabled(bool enabled);
+
+	/**
+	 * \brief Records a packet
+	 *
+	 * Only call this from the producer thread
+	 * \param direction the direction of the packet
+	 * \param data the bytes of the packet
+	 * \param length the number of bytes of the packet
+	 */
+	void record(Direction direction, const char* data, int length)
+	{
+#ifndef SEQUENCERGUI_NO_PACKET_TRACE
+		if (isEnabled()) {
+			append(direction, data, length);
+		}
+#else
+		Q_UNUSED(direction);
+		Q_UNUSED(data);
+		Q_UNUSED(length);
+#endif
+	}
+
+	/**
+	 * \brief Writes all records to the stream and removes them
+	 *
+	 * Each record is written on one line: the time in milliseconds since
+	 * the trace was created, '>' for sent and '<' for received packets and
+	 * the bytes of the packet in hexadecimal. Only call this from the
+	 * consumer thread
+	 * \param stream the stream where records are written
+	 * \return the number of records written
+	 */
+	int dump(QTextStream& stream);
+
+private:
+	/**
+	 * \brief A record of the trace
+	 */
+	struct Record
+	{
+		/**
+		 * \brief The time of the record in nanoseconds
+		 */
+		qint64 time;
+
+		/**
+		 * \brief The direction of the packet
+		 */
+		Direction direction;
+
+		/**
+		 * \brief The number of bytes stored in data
+		 */
+		quint8 recordedBytes;
+
+		/**
+		 * \brief The length of the packet
+		 */
+		quint16 length;
+
+		/**
+		 * \brief The first bytes of the packet
+		 */
+		char data[maxRecordedBytes];
+	};
+
+	/**
+	 * \brief Adds a record to the ring
+	 *
+	 * \param direction the direction of the packet
+	 * \param data the bytes of the packet
+	 * \param length the number of bytes of the packet
+	 */
+	void append(Direction direction, const char* data, int length);
+
+	/**
+	 * \brief The mask to convert indices into positions in m_records
+	 */
+	static const int positionMask = capacity - 1;
+
+	/**
+	 * \brief The mask to keep indices in range
+	 *
+	 * Indices count up to twice the capacity, so that a full ring can be
+	 * told apart from an empty one
+	 */
+	static const int indexMask = (2 * capacity) - 1;
+
+	static_assert((capacity & positionMask) == 0, "The capacity of the trace must be a power of two");
+
+	/**
+	 * \brief The timer for timestamps of records
+	 */
+	QElapsedTimer m_clock;
+
+	/**
+	 * \brief Not 0 if tracing is enabled
+	 */
+	QAtomicInt m_enabled;
+
+	/**
+	 * \brief The index of the next record to write
+	 *
+	 * This is only changed by the producer
+	 */
+	QAtomicInt m_writeIndex;
+
+	/**
+	 * \brief The index of the next record to read
+	 *
+	 * This is only changed by the consumer
+	 */
+	QAtomicInt m_readIndex;
+
+	/**
+	 * \brief The number of records discarded because the ring was full
+	 */
+	QAtomicInt m_droppedRecords;
+
+	/**
+	 * \brief The records
+	 */
+	Record m_records[capacity];
+};
+
+#endif // PACKETTRACE_H
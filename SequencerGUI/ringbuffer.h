@@ -0,0 +1,234 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+
+/**
+ * \brief A fixed-capacity ring buffer
+ *
+ * Elements are stored in a statically sized array and are never moved: the
+ * buffer keeps two free running counters (the index of the first element and
+ * the index past the last one) that are masked to obtain positions in the
+ * array. This means that the capacity must be a power of two. Elements can be
+ * added either one at a time with push() or in blocks by writing directly into
+ * the memory returned by writePointer() and then calling commitWrite() (this is
+ * useful to read data from devices without intermediate copies). When the
+ * buffer is full push() discards the element and returns false.
+ */
+template <class T, unsigned int CapacityT>
+class RingBuffer
+{
+	static_assert((CapacityT > 0) && ((CapacityT & (CapacityT - 1)) == 0), "The capacity of a RingBuffer must be a power of two");
+
+public:
+	/**
+	 * \brief Constructor
+	 *
+	 * Creates an empty buffer
+	 */
+	RingBuffer()
+		: m_begin(0)
+		, m_end(0)
+	{
+	}
+
+	/**
+	 * \brief Returns the maximum number of elements in the buffer
+	 *
+	 * \return the maximum number of elements in the buffer
+	 */
+	static constexpr unsigned int capacity()
+	{
+		return CapacityT;
+	}
+
+	/**
+	 * \brief Returns the number of elements in the buffer
+	 *
+	 * \return the number of elements in the buffer
+	 */
+	unsigned int size() const
+	{
+		return m_end - m_begin;
+	}
+
+	/**
+	 * \brief Returns the number of elements that can still be added
+	 *
+	 * \return the number of elements that can still be added
+	 */
+	unsigned int freeSpace() const
+	{
+		return CapacityT - size();
+	}
+
+	/**
+	 * \brief Returns true if the buffer is empty
+	 *
+	 * \return true if the buffer is empty
+	 */
+	bool isEmpty() const
+	{
+		return m_begin == m_end;
+	}
+
+	/**
+	 * \brief Returns true if the buffer is full
+	 *
+	 * \return true if the buffer is full
+	 */
+	bool isFull() const
+	{
+		return size() == CapacityT;
+	}
+
+	/**
+	 * \brief Removes all elements
+	 */
+	void clear()
+	{
+		m_begin = m_end = 0;
+	}
+
+	/**
+	 * \brief Adds an element at the end of the buffer
+	 *
+	 * \param v the element to add
+	 * \return false if the buffer is full (the element is discarded)
+	 */
+	bool push(const T& v)
+	{
+		if (isFull()) {
+			return false;
+		}
+
+		m_data[m_end & mask] = v;
+		++m_end;
+
+		return true;
+	}
+
+	/**
+	 * \brief Returns the i-th element from the beginning of the buffer
+	 *
+	 * \param i the index of the element. It must be less than size()
+	 * \return the i-th element
+	 */
+	const T& operator[](unsigned int i) const
+	{
+		return m_data[(m_begin + i) & mask];
+	}
+
+	/**
+	 * \brief Returns the i-th element from the beginning of the buffer
+	 *
+	 * \param i the index of the element. It must be less than size()
+	 * \return the i-th element
+	 */
+	T& operator[](unsigned int i)
+	{
+		return m_data[(m_begin + i) & mask];
+	}
+
+	/**
+	 * \brief Returns the first element in the buffer
+	 *
+	 * \return the first element. Do not call on an empty buffer
+	 */
+	const T& front() const
+	{
+		return m_data[m_begin & mask];
+	}
+
+	/**
+	 * \brief Removes elements from the beginning of the buffer
+	 *
+	 * \param n the number of elements to remove. If greater than size(),
+	 *          the buffer is emptied
+	 */
+	void pop(unsigned int n = 1)
+	{
+		m_begin += std::min(n, size());
+	}
+
+	/**
+	 * \brief Returns a pointer to the contiguous free area at the end of the
+	 *        buffer
+	 *
+	 * Write at most length elements there and then call commitWrite() with
+	 * the number of elements actually written. The returned area could be
+	 * smaller than freeSpace() because it never wraps around the end of the
+	 * storage array
+	 * \param length the number of elements that can be written
+	 * \return a pointer to the first free element
+	 */
+	T* writePointer(unsigned int& length)
+	{
+		const unsigned int endPos = m_end & mask;
+
+		length = std::min(freeSpace(), CapacityT - endPos);
+
+		return &m_data[endPos];
+	}
+
+	/**
+	 * \brief Adds to the buffer elements written through writePointer()
+	 *
+	 * \param n the number of elements written. This must not be greater
+	 *          than the length returned by writePointer()
+	 */
+	void commitWrite(unsigned int n)
+	{
+		m_end += n;
+	}
+
+private:
+	/**
+	 * \brief The mask to convert counters into array positions
+	 */
+	static constexpr unsigned int mask = CapacityT - 1;
+
+	/**
+	 * \brief The storage array
+	 */
+	T m_data[CapacityT];
+
+	/**
+	 * \brief The counter of the first element
+	 *
+	 * This grows without bounds (wrapping around when it overflows), use
+	 * mask to get the position in the array
+	 */
+	unsigned int m_begin;
+
+	/**
+	 * \brief The counter one past the last element
+	 *
+	 * This grows without bounds (wrapping around when it overflows), use
+	 * mask to get the position in the array
+	 */
+	unsigned int m_end;
+};
+
+#endif // RINGBUFFER_H
@@ -21,7 +21,14 @@
 
 #include "sequence.h"
 #include <QFile>
+#include <QFileInfo>
+#include <QList>
 #include <QJsonArray>
+#include <QDataStream>
+#include <QtEndian>
+#include <cstring>
+#include <limits>
+#include <algorithm>
 
 namespace {
 	/**
@@ -42,6 +49,288 @@ namespace {
 
 		return p;
 	}
+
+	/**
+	 * \brief The magic string at the beginning of binary files
+	 */
+	const char binaryMagic[] = {'S', 'E', 'Q', 'B'};
+
+	/**
+	 * \brief The current version of the binary format
+	 */
+	const quint16 binaryVersion = 1;
+
+	/**
+	 * \brief The values for the type of coordinates in binary files
+	 */
+	enum BinaryCoordinateType : quint8 {
+		DoubleCoordinates = 0,
+		UInt8Coordinates = 1
+	};
+
+	/**
+	 * \brief The size of the header of binary files in bytes
+	 */
+	const qint64 binaryHeaderSize = 16;
+
+	/**
+	 * \brief The maximum dimension of points in binary files
+	 *
+	 * This is far more than any robot needs, larger values in the header
+	 * mean that the file is corrupted
+	 */
+	const quint32 maxBinaryDim = 1024;
+
+	/**
+	 * \brief The header of binary files
+	 */
+	struct BinaryHeader
+	{
+		/**
+		 * \brief The type of coordinates
+		 */
+		BinaryCoordinateType coordinateType;
+
+		/**
+		 * \brief The dimension of points
+		 */
+		quint32 dim;
+
+		/**
+		 * \brief The number of points in the sequence
+		 */
+		quint32 numPoints;
+
+		/**
+		 * \brief Returns the size of the record of a point in bytes
+		 *
+		 * \return the size of the record of a point in bytes
+		 */
+		qint64 recordSize() const
+		{
+			return qint64(dim) * ((coordinateType == UInt8Coordinates) ? 1 : 8) + 8;
+		}
+
+		/**
+		 * \brief Returns true if min, max and all points fit in the given
+		 *        number of bytes
+		 *
+		 * The check uses a division, so it cannot overflow whatever the
+		 * values in the header
+		 * \param dataSize the number of bytes after the header
+		 * \return true if dataSize bytes contain min, max and numPoints
+		 *         records
+		 */
+		bool recordsFit(qint64 dataSize) const
+		{
+			const qint64 numRecords = dataSize / recordSize();
+
+			return (numRecords >= 2) && (qint64(numPoints) <= (numRecords - 2));
+		}
+	};
+
+	/**
+	 * \brief Returns true if a coordinate can be stored as quint8 without
+	 *        loss
+	 *
+	 * \param v the coordinate to check
+	 * \return true if the coordinate is an integer between 0 and 255
+	 */
+	bool isUInt8Coordinate(double v)
+	{
+		return (v >= 0.0) && (v <= 255.0) && (v == static_cast<double>(static_cast<quint8>(v)));
+	}
+
+	/**
+	 * \brief Returns true if all coordinates of the point can be stored as
+	 *        quint8 without loss
+	 *
+	 * \param p the point to check
+	 * \return true if all coordinates are integers between 0 and 255
+	 */
+	bool hasUInt8Coordinates(const SequencePoint& p)
+	{
+		for (auto v: p.point) {
+			if (!isUInt8Coordinate(v)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * \brief Writes a coordinate of a point record of the binary format
+	 *
+	 * \param stream the stream to write
+	 * \param v the coordinate to write
+	 * \param type the type of coordinates
+	 */
+	void writeBinaryCoordinate(QDataStream& stream, double v, BinaryCoordinateType type)
+	{
+		if (type == UInt8Coordinates) {
+			stream << static_cast<quint8>(v);
+		} else {
+			stream << v;
+		}
+	}
+
+	/**
+	 * \brief Writes a point record of the binary format
+	 *
+	 * \param stream the stream to write
+	 * \param p the point to write
+	 * \param type the type of coordinates
+	 */
+	void writeBinaryPoint(QDataStream& stream, const SequencePoint& p, BinaryCoordinateType type)
+	{
+		for (auto v: p.point) {
+			writeBinaryCoordinate(stream, v, type);
+		}
+		stream << static_cast<qint32>(p.duration) << static_cast<qint32>(p.timeToTarget);
+	}
+
+	/**
+	 * \brief Reads a point record of the binary format
+	 *
+	 * \param stream the stream to read
+	 * \param p the point to fill. Its coordinates must already have the
+	 *          correct size
+	 * \param type the type of coordinates
+	 * \return false in case of error
+	 */
+	bool readBinaryPoint(QDataStream& stream, SequencePoint& p, BinaryCoordinateType type)
+	{
+		for (int i = 0; i < p.point.size(); ++i) {
+			if (type == UInt8Coordinates) {
+				quint8 v;
+				stream >> v;
+				p.point[i] = v;
+			} else {
+				stream >> p.point[i];
+			}
+		}
+
+		qint32 duration;
+		qint32 timeToTarget;
+		stream >> duration >> timeToTarget;
+		p.duration = duration;
+		p.timeToTarget = timeToTarget;
+
+		return stream.status() == QDataStream::Ok;
+	}
+
+	/**
+	 * \brief Reads a coordinate from a record of a mapped binary file
+	 *
+	 * \param record the address of the record
+	 * \param c the index of the coordinate
+	 * \param uint8Coordinates true if coordinates are quint8, false if they
+	 *                         are doubles
+	 * \return the value of the coordinate
+	 */
+	double decodeCoordinate(const uchar* record, int c, bool uint8Coordinates)
+	{
+		if (uint8Coordinates) {
+			return record[c];
+		}
+
+		const quint64 bits = qFromLittleEndian<quint64>(record + c * 8);
+		double v;
+		memcpy(&v, &bits, sizeof(v));
+
+		return v;
+	}
+
+	/**
+	 * \brief Reads the duration from a record of a mapped binary file
+	 *
+	 * \param record the address of the record
+	 * \param dim the dimension of points
+	 * \param uint8Coordinates true if coordinates are quint8, false if they
+	 *                         are doubles
+	 * \return the duration
+	 */
+	int decodeDuration(const uchar* record, int dim, bool uint8Coordinates)
+	{
+		return qFromLittleEndian<qint32>(record + dim * (uint8Coordinates ? 1 : 8));
+	}
+
+	/**
+	 * \brief Reads the time to target from a record of a mapped binary file
+	 *
+	 * \param record the address of the record
+	 * \param dim the dimension of points
+	 * \param uint8Coordinates true if coordinates are quint8, false if they
+	 *                         are doubles
+	 * \return the time to target
+	 */
+	int decodeTimeToTarget(const uchar* record, int dim, bool uint8Coordinates)
+	{
+		return qFromLittleEndian<qint32>(record + dim * (uint8Coordinates ? 1 : 8) + 4);
+	}
+
+	/**
+	 * \brief Decodes a record of a mapped binary file
+	 *
+	 * \param record the address of the record
+	 * \param dim the dimension of points
+	 * \param uint8Coordinates true if coordinates are quint8, false if they
+	 *                         are doubles
+	 * \return the point
+	 */
+	SequencePoint decodeRecord(const uchar* record, int dim, bool uint8Coordinates)
+	{
+		SequencePoint p(QVector<double>(dim), decodeDuration(record, dim, uint8Coordinates), decodeTimeToTarget(record, dim, uint8Coordinates));
+
+		for (int c = 0; c < dim; ++c) {
+			p.point[c] = decodeCoordinate(record, c, uint8Coordinates);
+		}
+
+		return p;
+	}
+
+	/**
+	 * \brief Configures a stream for the binary format
+	 *
+	 * \param stream the stream to configure
+	 */
+	void setupBinaryStream(QDataStream& stream)
+	{
+		stream.setVersion(QDataStream::Qt_5_0);
+		stream.setByteOrder(QDataStream::LittleEndian);
+		stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+	}
+
+	/**
+	 * \brief Reads and checks the header of a binary file
+	 *
+	 * \param stream the stream to read. It must be configured with
+	 *               setupBinaryStream()
+	 * \param header the object to fill
+	 * \return false if the header is not valid, including when the dimension
+	 *         of points is 0 or above maxBinaryDim or the number of points
+	 *         does not fit in an int
+	 */
+	bool readBinaryHeader(QDataStream& stream, BinaryHeader& header)
+	{
+		char magic[sizeof(binaryMagic)];
+		if ((stream.readRawData(magic, sizeof(magic)) != sizeof(magic)) || (memcmp(magic, binaryMagic, sizeof(magic)) != 0)) {
+			return false;
+		}
+
+		quint16 version;
+		quint8 type;
+		quint8 reserved;
+		stream >> version >> type >> reserved >> header.dim >> header.numPoints;
+
+		if ((stream.status() != QDataStream::Ok) || (version != binaryVersion) || ((type != DoubleCoordinates) && (type != UInt8Coordinates)) || (header.dim == 0) || (header.dim > maxBinaryDim) || (header.numPoints > quint32(std::numeric_limits<int>::max()))) {
+			return false;
+		}
+		header.coordinateType = static_cast<BinaryCoordinateType>(type);
+
+		return true;
+	}
 }
 
 Sequence::Sequence(unsigned int pointDim, SequencePoint minVals, SequencePoint maxVals, QObject* parent)
@@ -49,22 +338,41 @@ Sequence::Sequence(unsigned int pointDim, SequencePoint minVals, SequencePoint m
 	, m_pointDim(pointDim)
 	, m_min(validatePoint(minVals, true))
 	, m_max(validatePoint(maxVals, true))
-	, m_sequence()
+	, m_coordinates()
+	, m_durations()
+	, m_timeToTargets()
+	, m_mappedFile()
+	, m_mappedPoints(nullptr)
+	, m_numMappedPoints(0)
+	, m_mappedUInt8Coordinates(false)
 	, m_curPoint(-1)
 	, m_isModified(false)
+	, m_undoJournal()
+	, m_undoPosition(0)
+	, m_undoStepOpen(false)
+	, m_replayingUndo(false)
+	, m_updateDepth(0)
+	, m_coalesceUpdates(false)
+	, m_coalesceTimer(this)
+	, m_pendingFirst(-1)
+	, m_pendingLast(-1)
 {
+	// Notifications are coalesced once per frame (about 60 frames per second)
+	m_coalesceTimer.setSingleShot(true);
+	m_coalesceTimer.setInterval(16);
+	connect(&m_coalesceTimer, &QTimer::timeout, this, &Sequence::endCoalescedUpdate);
 }
 
 void Sequence::setCurPoint(int p)
 {
-	if (m_sequence.isEmpty()) {
+	if (numPoints() == 0) {
 		return;
 	}
 
 	if (p < 0) {
 		p = 0;
-	} else if (p >= m_sequence.length()) {
-		p = m_sequence.length() - 1;
+	} else if (p >= numPoints()) {
+		p = numPoints() - 1;
 	}
 
 	if (p != m_curPoint) {
@@ -140,8 +448,9 @@ std::unique_ptr<Sequence> Sequence::load(const QJsonDocument& json)
 	// object
 	std::unique_ptr<Sequence> s = std::make_unique<Sequence>(dim, minPoint, maxPoint);
 	// Inserting one element at a time to be able to validate them
+	s->reservePoints(list.size());
 	for (auto sp: list) {
-		s->m_sequence.append(s->validatePoint(sp));
+		s->insertPoint(s->numPoints(), s->validatePoint(sp));
 	}
 	if (!list.isEmpty()) {
 		s->m_curPoint = 0;
@@ -152,12 +461,14 @@ std::unique_ptr<Sequence> Sequence::load(const QJsonDocument& json)
 	return s;
 }
 
-bool Sequence::save(QString filename) const
+bool Sequence::save(QString filename)
 {
 	if (!isValid()) {
 		return false;
 	}
 
+	flushPendingChanges();
+
 	// This is needed because the other save function changes the value of
 	// the flag, but if cannot save the file, we must not change it to false
 	const bool oldIsModified = m_isModified;
@@ -183,19 +494,21 @@ bool Sequence::save(QString filename) const
 	return true;
 }
 
-QJsonDocument Sequence::save() const
+QJsonDocument Sequence::save()
 {
 	if (!isValid()) {
 		return QJsonDocument();
 	}
 
+	flushPendingChanges();
+
 	QJsonArray s;
 
 	// The first two elements are the min and max of points
 	s.append(m_min.toJson());
 	s.append(m_max.toJson());
-	for (auto sp: m_sequence) {
-		s.append(sp.toJson());
+	for (int i = 0; i < numPoints(); ++i) {
+		s.append((*this)[i].toJson());
 	}
 
 	m_isModified = false;
@@ -203,17 +516,250 @@ QJsonDocument Sequence::save() const
 	return QJsonDocument(s);
 }
 
+bool Sequence::isBinaryFilename(QString filename)
+{
+	return QFileInfo(filename).suffix().compare("seqb", Qt::CaseInsensitive) == 0;
+}
+
+std::unique_ptr<Sequence> Sequence::loadBinary(QString filename)
+{
+	QFile f(filename);
+
+	if (!f.open(QIODevice::ReadOnly)) {
+		return std::make_unique<Sequence>();
+	}
+
+	return loadBinary(&f);
+}
+
+std::unique_ptr<Sequence> Sequence::loadBinary(QIODevice* device)
+{
+	QDataStream stream(device);
+	setupBinaryStream(stream);
+
+	// Reading and checking the header
+	BinaryHeader header;
+	if (!readBinaryHeader(stream, header)) {
+		return std::make_unique<Sequence>();
+	}
+	const BinaryCoordinateType coordinateType = header.coordinateType;
+	const quint32 dim = header.dim;
+	const quint32 numPoints = header.numPoints;
+
+	// Checking that the device is long enough before allocating memory for
+	// points, to avoid huge allocations for corrupted files. Sequential
+	// devices are read until the data ends, without reserving memory
+	const bool sizeKnown = !device->isSequential();
+	if (sizeKnown && !header.recordsFit(device->bytesAvailable())) {
+		return std::make_unique<Sequence>();
+	}
+
+	// Reading min and max
+	SequencePoint minPoint(QVector<double>(dim), 0, 0);
+	SequencePoint maxPoint(QVector<double>(dim), 0, 0);
+	if (!readBinaryPoint(stream, minPoint, coordinateType) || !readBinaryPoint(stream, maxPoint, coordinateType)) {
+		return std::make_unique<Sequence>();
+	}
+
+	std::unique_ptr<Sequence> s = std::make_unique<Sequence>(dim, minPoint, maxPoint);
+
+	// Reading points and validating them
+	if (sizeKnown) {
+		s->reservePoints(numPoints);
+	}
+	SequencePoint sp(QVector<double>(dim), 0, 0);
+	for (quint32 i = 0; i < numPoints; ++i) {
+		if (!readBinaryPoint(stream, sp, coordinateType)) {
+			return std::make_unique<Sequence>();
+		}
+
+		s->insertPoint(s->numPoints(), s->validatePoint(sp));
+	}
+	if (numPoints != 0) {
+		s->m_curPoint = 0;
+	}
+
+	// m_isModified remains false
+
+	return s;
+}
+
+bool Sequence::saveBinary(QString filename)
+{
+	if (!isValid()) {
+		return false;
+	}
+
+	QFile f(filename);
+
+	if (!f.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+
+	return saveBinary(&f);
+}
+
+bool Sequence::saveBinary(QIODevice* device)
+{
+	if (!isValid()) {
+		return false;
+	}
+
+	flushPendingChanges();
+
+	// Using quint8 coordinates only if there is no loss of precision
+	BinaryCoordinateType coordinateType = UInt8Coordinates;
+	if (!hasUInt8Coordinates(m_min) || !hasUInt8Coordinates(m_max)) {
+		coordinateType = DoubleCoordinates;
+	}
+	// Points are read from the coordinate arrays, without building a
+	// SequencePoint for each one
+	for (int i = 0; (i < numPoints()) && (coordinateType == UInt8Coordinates); ++i) {
+		for (unsigned int c = 0; c < m_pointDim; ++c) {
+			if (!isUInt8Coordinate(pointCoordinate(i, c))) {
+				coordinateType = DoubleCoordinates;
+				break;
+			}
+		}
+	}
+
+	QDataStream stream(device);
+	setupBinaryStream(stream);
+
+	// Writing the header
+	stream.writeRawData(binaryMagic, sizeof(binaryMagic));
+	stream << binaryVersion << static_cast<quint8>(coordinateType) << quint8(0) << quint32(m_pointDim) << quint32(numPoints());
+
+	// Writing min, max and all points
+	writeBinaryPoint(stream, m_min, coordinateType);
+	writeBinaryPoint(stream, m_max, coordinateType);
+	for (int i = 0; i < numPoints(); ++i) {
+		for (unsigned int c = 0; c < m_pointDim; ++c) {
+			writeBinaryCoordinate(stream, pointCoordinate(i, c), coordinateType);
+		}
+		stream << static_cast<qint32>(pointDuration(i)) << static_cast<qint32>(pointTimeToTarget(i));
+	}
+
+	if (stream.status() != QDataStream::Ok) {
+		return false;
+	}
+
+	m_isModified = false;
+
+	return true;
+}
+
+std::unique_ptr<Sequence> Sequence::map(QString filename)
+{
+	std::unique_ptr<QFile> f = std::make_unique<QFile>(filename);
+
+	if (!f->open(QIODevice::ReadOnly)) {
+		return std::make_unique<Sequence>();
+	}
+
+	// Reading and checking the header
+	BinaryHeader header;
+	{
+		QDataStream stream(f.get());
+		setupBinaryStream(stream);
+
+		if (!readBinaryHeader(stream, header)) {
+			return std::make_unique<Sequence>();
+		}
+	}
+
+	// Checking the file is long enough and mapping it. After the check the
+	// size of the records cannot overflow
+	const qint64 recordSize = header.recordSize();
+	if (!header.recordsFit(f->size() - binaryHeaderSize)) {
+		return std::make_unique<Sequence>();
+	}
+	const qint64 fileSize = binaryHeaderSize + (qint64(header.numPoints) + 2) * recordSize;
+	const uchar* data = f->map(0, fileSize);
+	if (data == nullptr) {
+		return std::make_unique<Sequence>();
+	}
+
+	// Decoding min and max
+	const bool uint8Coordinates = (header.coordinateType == UInt8Coordinates);
+	const uchar* const minRecord = data + binaryHeaderSize;
+	const uchar* const maxRecord = minRecord + recordSize;
+	std::unique_ptr<Sequence> s = std::make_unique<Sequence>(header.dim, decodeRecord(minRecord, header.dim, uint8Coordinates), decodeRecord(maxRecord, header.dim, uint8Coordinates));
+
+	s->m_mappedFile = std::move(f);
+	s->m_mappedPoints = maxRecord + recordSize;
+	s->m_numMappedPoints = header.numPoints;
+	s->m_mappedUInt8Coordinates = uint8Coordinates;
+	if (header.numPoints != 0) {
+		s->m_curPoint = 0;
+	}
+
+	// m_isModified remains false
+
+	return s;
+}
+
+bool Sequence::isMappedFile(QString filename) const
+{
+	if (!isMapped()) {
+		return false;
+	}
+
+	// Comparing canonical paths to also catch links and relative paths. The
+	// canonical path of a file that does not exist is empty
+	const QString canonicalFilename = QFileInfo(filename).canonicalFilePath();
+
+	return !canonicalFilename.isEmpty() && (canonicalFilename == QFileInfo(m_mappedFile->fileName()).canonicalFilePath());
+}
+
+void Sequence::detach()
+{
+	if (!isMapped()) {
+		return;
+	}
+
+	// Pending notifications refer to points read from the file
+	flushPendingChanges();
+
+	// Decoding all points. Accessors still read from the file until it is
+	// released
+	m_coordinates.resize(m_numMappedPoints * m_pointDim);
+	m_durations.resize(m_numMappedPoints);
+	m_timeToTargets.resize(m_numMappedPoints);
+	for (int i = 0; i < m_numMappedPoints; ++i) {
+		for (unsigned int c = 0; c < m_pointDim; ++c) {
+			m_coordinates[i * m_pointDim + c] = pointCoordinate(i, c);
+		}
+		m_durations[i] = pointDuration(i);
+		m_timeToTargets[i] = pointTimeToTarget(i);
+	}
+
+	// Releasing the file. Closing it also unmaps it
+	m_mappedFile.reset();
+	m_mappedPoints = nullptr;
+	m_numMappedPoints = 0;
+}
+
 void Sequence::insertAfterCurrent()
 {
 	if (!isValid()) {
 		return;
 	}
 
+	detach();
+	flushPendingChanges();
+
+	// If there is no current point the sequence is empty and the point is
+	// inserted at position 0
+	const int pos = m_curPoint + 1;
+	emit pointsAboutToBeInserted(pos, pos);
 	if (m_curPoint == -1) {
-		m_sequence.append(validatePoint(defaultSequencePoint(*this)));
+		insertPoint(pos, validatePoint(defaultSequencePoint(*this)));
 	} else {
-		m_sequence.insert(m_curPoint + 1, validatePoint(m_sequence[m_curPoint]));
+		insertPoint(pos, storedPoint(m_curPoint));
 	}
+	recordPointsChange(UndoEntry::Type::Insert, pos, {storedPoint(pos)});
+	emit pointsInserted(pos, pos);
 
 	emit numPointsChanged();
 
@@ -230,14 +776,22 @@ void Sequence::insertBeforeCurrent()
 		return;
 	}
 
+	detach();
+	flushPendingChanges();
+
 	if (m_curPoint == -1) {
-		m_sequence.append(validatePoint(defaultSequencePoint(*this)));
+		emit pointsAboutToBeInserted(0, 0);
+		insertPoint(0, validatePoint(defaultSequencePoint(*this)));
+		emit pointsInserted(0, 0);
 
 		m_curPoint = 0;
 		emit curPointChanged();
 	} else {
-		m_sequence.insert(m_curPoint, validatePoint(m_sequence[m_curPoint]));
+		emit pointsAboutToBeInserted(m_curPoint, m_curPoint);
+		insertPoint(m_curPoint, storedPoint(m_curPoint));
+		emit pointsInserted(m_curPoint, m_curPoint);
 	}
+	recordPointsChange(UndoEntry::Type::Insert, m_curPoint, {storedPoint(m_curPoint)});
 
 	emit numPointsChanged();
 
@@ -256,12 +810,19 @@ void Sequence::append()
 		return;
 	}
 
-	SequencePoint p = (m_curPoint == -1) ? defaultSequencePoint(*this) : m_sequence[m_curPoint];
-	m_sequence.append(validatePoint(p));
+	detach();
+	flushPendingChanges();
+
+	SequencePoint p = (m_curPoint == -1) ? defaultSequencePoint(*this) : storedPoint(m_curPoint);
+	const int pos = numPoints();
+	emit pointsAboutToBeInserted(pos, pos);
+	insertPoint(pos, validatePoint(p));
+	recordPointsChange(UndoEntry::Type::Insert, pos, {storedPoint(pos)});
+	emit pointsInserted(pos, pos);
 
 	emit numPointsChanged();
 
-	m_curPoint = m_sequence.length() - 1;
+	m_curPoint = numPoints() - 1;
 	emit curPointChanged();
 
 	// The sequence has been modified
@@ -274,13 +835,19 @@ void Sequence::removeCurrent()
 		return;
 	}
 
-	m_sequence.removeAt(m_curPoint);
+	detach();
+	flushPendingChanges();
+
+	recordPointsChange(UndoEntry::Type::Remove, m_curPoint, {storedPoint(m_curPoint)});
+	emit pointsAboutToBeRemoved(m_curPoint, m_curPoint);
+	removePoint(m_curPoint);
+	emit pointsRemoved(m_curPoint, m_curPoint);
 
 	emit numPointsChanged();
 
-	if (m_curPoint >= m_sequence.length()) {
+	if (m_curPoint >= numPoints()) {
 		// This will set cur point to -1 if the sequence is empty
-		m_curPoint = m_sequence.length() - 1;
+		m_curPoint = numPoints() - 1;
 
 		emit curPointChanged();
 	} else {
@@ -299,8 +866,23 @@ void Sequence::clear()
 		return;
 	}
 
-	if (!m_sequence.isEmpty()) {
-		m_sequence.clear();
+	detach();
+	flushPendingChanges();
+
+	if (numPoints() != 0) {
+		QVector<SequencePoint> points;
+		points.reserve(numPoints());
+		for (int i = 0; i < numPoints(); ++i) {
+			points.append(storedPoint(i));
+		}
+		recordPointsChange(UndoEntry::Type::Clear, m_curPoint, std::move(points));
+
+		const int last = numPoints() - 1;
+		emit pointsAboutToBeRemoved(0, last);
+		m_coordinates.clear();
+		m_durations.clear();
+		m_timeToTargets.clear();
+		emit pointsRemoved(0, last);
 
 		emit numPointsChanged();
 
@@ -352,19 +934,25 @@ int Sequence::maxPointTimeToTarget() const
 	return m_max.timeToTarget;
 }
 
-const SequencePoint& Sequence::operator[](int pos) const
+SequencePoint Sequence::operator[](int pos) const
 {
-	return m_sequence[pos];
+	return isMapped() ? mappedPoint(pos) : storedPoint(pos);
 }
 
-const SequencePoint& Sequence::point() const
+SequencePoint Sequence::point() const
 {
-	return m_sequence[m_curPoint];
+	return (*this)[m_curPoint];
 }
 
 double Sequence::pointCoordinate(int pos, int c) const
 {
-	return m_sequence[pos].point[c];
+	if (isMapped()) {
+		const double v = decodeCoordinate(mappedRecord(pos), c, m_mappedUInt8Coordinates);
+
+		return std::min(m_max.point[c], std::max(m_min.point[c], v));
+	}
+
+	return m_coordinates[pos * m_pointDim + c];
 }
 
 double Sequence::pointCoordinate(int c) const
@@ -378,7 +966,13 @@ double Sequence::pointCoordinate(int c) const
 
 int Sequence::pointDuration(int pos) const
 {
-	return m_sequence[pos].duration;
+	if (isMapped()) {
+		const int d = decodeDuration(mappedRecord(pos), m_pointDim, m_mappedUInt8Coordinates);
+
+		return std::min(m_max.duration, std::max(m_min.duration, d));
+	}
+
+	return m_durations[pos];
 }
 
 int Sequence::pointDuration() const
@@ -392,7 +986,13 @@ int Sequence::pointDuration() const
 
 int Sequence::pointTimeToTarget(int pos) const
 {
-	return m_sequence[pos].timeToTarget;
+	if (isMapped()) {
+		const int t = decodeTimeToTarget(mappedRecord(pos), m_pointDim, m_mappedUInt8Coordinates);
+
+		return std::min(m_max.timeToTarget, std::max(m_min.timeToTarget, t));
+	}
+
+	return m_timeToTargets[pos];
 }
 
 int Sequence::pointTimeToTarget() const
@@ -410,25 +1010,20 @@ void Sequence::setPoint(int pos, SequencePoint p)
 		return;
 	}
 
+	detach();
+
 	// Forcing point to be compliant with the set dimension and limits
-	const SequencePoint old = m_sequence[pos];
-	m_sequence[pos] = validatePoint(p);
+	const SequencePoint newPoint = validatePoint(p);
 
 	// If the point didn't actually changed, not emitting signals
-	if (old == m_sequence[pos]) {
+	const SequencePoint oldPoint = storedPoint(pos);
+	if (newPoint == oldPoint) {
 		return;
 	}
+	storePoint(pos, newPoint);
+	recordPointsChange(UndoEntry::Type::Point, pos, {oldPoint, newPoint});
 
-	emit pointValuesChanged(pos);
-
-	// Also checking if we have to emit the signal for changes in the
-	// current point
-	if (pos == m_curPoint) {
-		emit curPointValuesChanged();
-	}
-
-	// The sequence has been modified
-	sequenceModified();
+	pointValuesModified(pos);
 }
 
 void Sequence::setPoint(SequencePoint p)
@@ -446,24 +1041,19 @@ void Sequence::setPointCoordinate(int pos, int c, double v)
 		return;
 	}
 
-	const double old = m_sequence[pos].point[c];
-	m_sequence[pos].point[c] = std::min(m_max.point[c], std::max(m_min.point[c], v));
+	detach();
+
+	double& coordinate = m_coordinates[pos * m_pointDim + c];
+	const double old = coordinate;
+	coordinate = std::min(m_max.point[c], std::max(m_min.point[c], v));
 
 	// If the point didn't actually changed, not emitting signals
-	if (old == m_sequence[pos].point[c]) {
+	if (old == coordinate) {
 		return;
 	}
+	recordValueChange(UndoEntry::Type::Coordinate, pos, c, old, coordinate);
 
-	emit pointValuesChanged(pos);
-
-	// Also checking if we have to emit the signal for changes in the
-	// current point
-	if (pos == m_curPoint) {
-		emit curPointValuesChanged();
-	}
-
-	// The sequence has been modified
-	sequenceModified();
+	pointValuesModified(pos);
 }
 
 void Sequence::setPointCoordinate(int c, double v)
@@ -481,24 +1071,18 @@ void Sequence::setDuration(int pos, int d)
 		return;
 	}
 
-	const int old = m_sequence[pos].duration;
-	m_sequence[pos].duration = std::min(m_max.duration, std::max(m_min.duration, d));
+	detach();
+
+	const int old = m_durations[pos];
+	m_durations[pos] = std::min(m_max.duration, std::max(m_min.duration, d));
 
 	// If the point didn't actually changed, not emitting signals
-	if (old == m_sequence[pos].duration) {
+	if (old == m_durations[pos]) {
 		return;
 	}
+	recordValueChange(UndoEntry::Type::Duration, pos, 0, old, m_durations[pos]);
 
-	emit pointValuesChanged(pos);
-
-	// Also checking if we have to emit the signal for changes in the
-	// current point
-	if (pos == m_curPoint) {
-		emit curPointValuesChanged();
-	}
-
-	// The sequence has been modified
-	sequenceModified();
+	pointValuesModified(pos);
 }
 
 void Sequence::setDuration(int d)
@@ -516,24 +1100,18 @@ void Sequence::setTimeToTarget(int pos, int t)
 		return;
 	}
 
-	const int old = m_sequence[pos].timeToTarget;
-	m_sequence[pos].timeToTarget = std::min(m_max.timeToTarget, std::max(m_min.timeToTarget, t));
+	detach();
+
+	const int old = m_timeToTargets[pos];
+	m_timeToTargets[pos] = std::min(m_max.timeToTarget, std::max(m_min.timeToTarget, t));
 
 	// If the point didn't actually changed, not emitting signals
-	if (old == m_sequence[pos].timeToTarget) {
+	if (old == m_timeToTargets[pos]) {
 		return;
 	}
+	recordValueChange(UndoEntry::Type::TimeToTarget, pos, 0, old, m_timeToTargets[pos]);
 
-	emit pointValuesChanged(pos);
-
-	// Also checking if we have to emit the signal for changes in the
-	// current point
-	if (pos == m_curPoint) {
-		emit curPointValuesChanged();
-	}
-
-	// The sequence has been modified
-	sequenceModified();
+	pointValuesModified(pos);
 }
 
 void Sequence::setTimeToTarget(int t)
@@ -545,6 +1123,77 @@ void Sequence::setTimeToTarget(int t)
 	setTimeToTarget(m_curPoint, t);
 }
 
+void Sequence::undo()
+{
+	if (!canUndo()) {
+		return;
+	}
+
+	--m_undoPosition;
+	m_undoStepOpen = false;
+
+	applyUndoEntry(m_undoJournal[m_undoPosition], true);
+
+	emit undoStateChanged();
+}
+
+void Sequence::redo()
+{
+	if (!canRedo()) {
+		return;
+	}
+
+	m_undoStepOpen = false;
+
+	applyUndoEntry(m_undoJournal[m_undoPosition], false);
+	++m_undoPosition;
+
+	emit undoStateChanged();
+}
+
+void Sequence::closeUndoStep()
+{
+	m_undoStepOpen = false;
+}
+
+void Sequence::beginUpdate()
+{
+	++m_updateDepth;
+}
+
+void Sequence::endUpdate()
+{
+	if (m_updateDepth == 0) {
+		return;
+	}
+
+	--m_updateDepth;
+
+	if (m_updateDepth == 0) {
+		flushPendingChanges();
+	}
+}
+
+void Sequence::setCoalesceUpdates(bool coalesce)
+{
+	if (coalesce != m_coalesceUpdates) {
+		m_coalesceUpdates = coalesce;
+
+		// Ending the automatic update, if any
+		if (!m_coalesceUpdates && m_coalesceTimer.isActive()) {
+			m_coalesceTimer.stop();
+			endUpdate();
+		}
+
+		emit coalesceUpdatesChanged();
+	}
+}
+
+void Sequence::endCoalescedUpdate()
+{
+	endUpdate();
+}
+
 SequencePoint Sequence::validatePoint(SequencePoint p, bool skipLimits) const
 {
 	// Resizing to the correct size
@@ -571,6 +1220,227 @@ SequencePoint Sequence::validatePoint(SequencePoint p, bool skipLimits) const
 	return p;
 }
 
+const uchar* Sequence::mappedRecord(int pos) const
+{
+	const qint64 recordSize = qint64(m_pointDim) * (m_mappedUInt8Coordinates ? 1 : 8) + 8;
+
+	return m_mappedPoints + pos * recordSize;
+}
+
+SequencePoint Sequence::mappedPoint(int pos) const
+{
+	// Points are validated as when they are loaded in memory
+	return validatePoint(decodeRecord(mappedRecord(pos), m_pointDim, m_mappedUInt8Coordinates));
+}
+
+void Sequence::recordValueChange(UndoEntry::Type type, int pos, int c, double oldValue, double newValue)
+{
+	if (m_replayingUndo) {
+		return;
+	}
+
+	// Checking if we can merge with the last entry
+	if (m_undoStepOpen && canUndo() && !canRedo()) {
+		UndoEntry& last = m_undoJournal.last();
+
+		if ((last.type == type) && (last.pos == pos) && (last.coordinate == c)) {
+			last.newValue = newValue;
+
+			// If we are back to the original value, the entry is useless
+			if (last.newValue == last.oldValue) {
+				m_undoJournal.removeLast();
+				--m_undoPosition;
+				m_undoStepOpen = false;
+
+				emit undoStateChanged();
+			}
+
+			return;
+		}
+	}
+
+	UndoEntry entry;
+	entry.type = type;
+	entry.pos = pos;
+	entry.coordinate = c;
+	entry.oldValue = oldValue;
+	entry.newValue = newValue;
+	addUndoEntry(std::move(entry));
+
+	m_undoStepOpen = true;
+}
+
+void Sequence::recordPointsChange(UndoEntry::Type type, int pos, QVector<SequencePoint> points)
+{
+	if (m_replayingUndo) {
+		return;
+	}
+
+	UndoEntry entry;
+	entry.type = type;
+	entry.pos = pos;
+	entry.coordinate = 0;
+	entry.oldValue = 0.0;
+	entry.newValue = 0.0;
+	entry.points = std::move(points);
+	addUndoEntry(std::move(entry));
+
+	m_undoStepOpen = false;
+}
+
+void Sequence::addUndoEntry(UndoEntry entry)
+{
+	// Discarding entries that could be redone
+	m_undoJournal.resize(m_undoPosition);
+
+	m_undoJournal.append(std::move(entry));
+	++m_undoPosition;
+
+	emit undoStateChanged();
+}
+
+void Sequence::applyUndoEntry(const UndoEntry& entry, bool undo)
+{
+	m_replayingUndo = true;
+
+	switch (entry.type) {
+		case UndoEntry::Type::Coordinate:
+			setCurPoint(entry.pos);
+			setPointCoordinate(entry.pos, entry.coordinate, undo ? entry.oldValue : entry.newValue);
+			break;
+		case UndoEntry::Type::Duration:
+			setCurPoint(entry.pos);
+			setDuration(entry.pos, static_cast<int>(undo ? entry.oldValue : entry.newValue));
+			break;
+		case UndoEntry::Type::TimeToTarget:
+			setCurPoint(entry.pos);
+			setTimeToTarget(entry.pos, static_cast<int>(undo ? entry.oldValue : entry.newValue));
+			break;
+		case UndoEntry::Type::Point:
+			setCurPoint(entry.pos);
+			setPoint(entry.pos, entry.points[undo ? 0 : 1]);
+			break;
+		case UndoEntry::Type::Insert:
+			if (undo) {
+				removePointAt(entry.pos);
+			} else {
+				insertPointAt(entry.pos, entry.points[0]);
+			}
+			break;
+		case UndoEntry::Type::Remove:
+			if (undo) {
+				insertPointAt(entry.pos, entry.points[0]);
+			} else {
+				removePointAt(entry.pos);
+			}
+			break;
+		case UndoEntry::Type::Clear:
+			if (undo) {
+				flushPendingChanges();
+
+				emit pointsAboutToBeInserted(0, entry.points.size() - 1);
+				reservePoints(entry.points.size());
+				for (const auto& p: entry.points) {
+					insertPoint(numPoints(), p);
+				}
+				emit pointsInserted(0, entry.points.size() - 1);
+
+				emit numPointsChanged();
+
+				m_curPoint = entry.pos;
+				emit curPointChanged();
+
+				sequenceModified();
+			} else {
+				clear();
+			}
+			break;
+	}
+
+	m_replayingUndo = false;
+}
+
+void Sequence::insertPointAt(int pos, const SequencePoint& p)
+{
+	flushPendingChanges();
+
+	emit pointsAboutToBeInserted(pos, pos);
+	insertPoint(pos, p);
+	emit pointsInserted(pos, pos);
+
+	emit numPointsChanged();
+
+	m_curPoint = pos;
+	emit curPointChanged();
+
+	// The index of the current point could be the same as before
+	emit curPointValuesChanged();
+
+	// The sequence has been modified
+	sequenceModified();
+}
+
+void Sequence::removePointAt(int pos)
+{
+	flushPendingChanges();
+
+	emit pointsAboutToBeRemoved(pos, pos);
+	removePoint(pos);
+	emit pointsRemoved(pos, pos);
+
+	emit numPointsChanged();
+
+	// This will set cur point to -1 if the sequence is empty
+	m_curPoint = std::min(pos, numPoints() - 1);
+	emit curPointChanged();
+
+	// The index of the current point could be the same as before
+	emit curPointValuesChanged();
+
+	// The sequence has been modified
+	sequenceModified();
+}
+
+SequencePoint Sequence::storedPoint(int pos) const
+{
+	const double* const coordinates = m_coordinates.constData() + pos * m_pointDim;
+
+	SequencePoint p(QVector<double>(m_pointDim), m_durations[pos], m_timeToTargets[pos]);
+	std::copy(coordinates, coordinates + m_pointDim, p.point.begin());
+
+	return p;
+}
+
+void Sequence::storePoint(int pos, const SequencePoint& p)
+{
+	std::copy(p.point.constBegin(), p.point.constEnd(), m_coordinates.begin() + pos * m_pointDim);
+	m_durations[pos] = p.duration;
+	m_timeToTargets[pos] = p.timeToTarget;
+}
+
+void Sequence::insertPoint(int pos, const SequencePoint& p)
+{
+	m_coordinates.insert(pos * m_pointDim, m_pointDim, 0.0);
+	m_durations.insert(pos, p.duration);
+	m_timeToTargets.insert(pos, p.timeToTarget);
+
+	storePoint(pos, p);
+}
+
+void Sequence::removePoint(int pos)
+{
+	m_coordinates.remove(pos * m_pointDim, m_pointDim);
+	m_durations.remove(pos);
+	m_timeToTargets.remove(pos);
+}
+
+void Sequence::reservePoints(int n)
+{
+	m_coordinates.reserve(n * m_pointDim);
+	m_durations.reserve(n);
+	m_timeToTargets.reserve(n);
+}
+
 void Sequence::sequenceModified()
 {
 	if (!m_isModified) {
@@ -579,3 +1449,63 @@ void Sequence::sequenceModified()
 		emit isModifiedChanged();
 	}
 }
+
+void Sequence::pointValuesModified(int pos)
+{
+	// Starting an automatic update if needed. It is ended by the timer
+	if (m_coalesceUpdates && !m_coalesceTimer.isActive()) {
+		beginUpdate();
+		m_coalesceTimer.start();
+	}
+
+	if (m_updateDepth > 0) {
+		// Extending the range of pending notifications
+		if (m_pendingFirst == -1) {
+			m_pendingFirst = m_pendingLast = pos;
+		} else {
+			m_pendingFirst = std::min(m_pendingFirst, pos);
+			m_pendingLast = std::max(m_pendingLast, pos);
+		}
+
+		return;
+	}
+
+	emit pointValuesChanged(pos);
+	emit pointsChanged(pos, pos);
+
+	// Also checking if we have to emit the signal for changes in the
+	// current point
+	if (pos == m_curPoint) {
+		emit curPointValuesChanged();
+	}
+
+	// The sequence has been modified
+	sequenceModified();
+}
+
+void Sequence::flushPendingChanges()
+{
+	if (m_pendingFirst == -1) {
+		return;
+	}
+
+	// Resetting the range before emitting signals, slots could modify the
+	// sequence
+	const int first = m_pendingFirst;
+	const int last = m_pendingLast;
+	m_pendingFirst = m_pendingLast = -1;
+
+	for (int i = first; i <= last; ++i) {
+		emit pointValuesChanged(i);
+	}
+	emit pointsChanged(first, last);
+
+	// Also checking if we have to emit the signal for changes in the
+	// current point
+	if ((m_curPoint >= first) && (m_curPoint <= last)) {
+		emit curPointValuesChanged();
+	}
+
+	// The sequence has been modified
+	sequenceModified();
+}
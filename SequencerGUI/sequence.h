@@ -23,8 +23,11 @@
 #define SEQUENCE_H
 
 #include <QObject>
-#include <QList>
+#include <QVector>
 #include <QJsonDocument>
+#include <QIODevice>
+#include <QFile>
+#include <QTimer>
 #include "utils.h"
 #include "sequencepoint.h"
 
@@ -32,18 +35,61 @@
  * \brief The class modelling a sequence of points
  *
  * This class stores a list of SequencePoints. It has methods to manage the
- * list, store to file and read it back. When constructed, you must specify the
- * dimensionality of points (i.e. how many values are there in a point) and the
- * minimum and maximum limit of values. These values cannot be changed. If a
- * SequencePoint having the wrong number of elements is passed to any function,
- * the point is truncated or filled with 0 to have the expected dimensionality.
- * Also the point is clamped to stay within the limits. This class also have a
- * notion of "current point". All functions that do not explicitly take the
- * position of the point in the sequence as parameter, act on the current point.
- * This class can be serialized as a JSON data structure. The format is simple:
- * the JSON document is a list, with the first two points that are respectively
- * the min and max values, and the remaining points the elements of the
- * sequence.
+ * list, store to file and read it back. Points are not stored as SequencePoint
+ * objects: coordinates of all points are kept in a single contiguous array,
+ * with durations and times to target in two parallel arrays, so that there is
+ * no per-point allocation. All modifications are recorded in an undo journal,
+ * see undo() and redo(). The journal stores deltas (the old and new value of
+ * a changed coordinate, the point that was inserted or removed), so its size
+ * only depends on the modifications. Consecutive changes of the same value of
+ * the same point (e.g. while dragging a slider) are merged in a single undo
+ * step until closeUndoStep() is called.
+ *
+ * Changes of the values of points are notified with the pointsChanged()
+ * signal (and pointValuesChanged() and curPointValuesChanged() for
+ * compatibility). To avoid a flood of notifications when many values change,
+ * modifications can be grouped between beginUpdate() and endUpdate(): in this
+ * case a single pointsChanged() signal covering all the modified points is
+ * emitted by the outermost endUpdate() and the isModified flag is only updated
+ * then. If the coalesceUpdates property is true, modifications happening
+ * outside of an explicit update are automatically grouped and notified at most
+ * once per frame. Insertions and removals of points are always notified
+ * immediately (pending notifications are emitted first) with the
+ * pointsAboutToBeInserted(), pointsInserted(), pointsAboutToBeRemoved() and
+ * pointsRemoved() signals, which carry the range of affected positions (see
+ * SequenceModel for a list model using them).
+ *
+ * When constructed, you must specify the dimensionality of points (i.e. how
+ * many values are there in a point) and the minimum and maximum limit of
+ * values. These values cannot be changed. If a SequencePoint having the wrong
+ * number of elements is passed to any function, the point is truncated or
+ * filled with 0 to have the expected dimensionality. Also the point is clamped
+ * to stay within the limits. This class also have a notion of "current point".
+ * All functions that do not explicitly take the position of the point in the
+ * sequence as parameter, act on the current point. This class can be serialized
+ * as a JSON data structure. The format is simple: the JSON document is a list,
+ * with the first two points that are respectively the min and max values, and
+ * the remaining points the elements of the sequence. Sequences can also be
+ * stored in a compact binary format, which is much faster to read and write for
+ * long sequences. All values are little endian. The file starts with a header:
+ *	- the magic string "SEQB" (4 bytes);
+ *	- the format version, currently 1 (quint16);
+ *	- the type of coordinates, 0 for double and 1 for quint8 (quint8);
+ *	- a reserved byte, always 0 (quint8);
+ *	- the dimension of points (quint32);
+ *	- the number of points in the sequence (quint32).
+ *
+ * After the header there are the min and max points followed by the points of
+ * the sequence, all stored as fixed-size records: the coordinates (pointDim
+ * values of the type specified in the header) followed by duration and
+ * timeToTarget (qint32). Coordinates are saved as quint8 when all of them
+ * (including min and max) are integers between 0 and 255, so that the
+ * conversion is lossless. Binary files can also be memory mapped with map(): in
+ * this case opening the file takes constant time and points are decoded from
+ * the mapped memory each time they are accessed, so memory usage does not
+ * depend on the length of the sequence. The first time the sequence is
+ * modified all points are read into memory and the file is released (see
+ * detach()).
  * \note This class makes little checks on the validity of point positions, make
  *       sure you always use valid positions. The current point, instead, always
  *       have a valid value (if the sequence is empty, its value is -1) and is
@@ -59,6 +105,9 @@ class Sequence : public QObject
 	Q_PROPERTY(int numPoints READ numPoints NOTIFY numPointsChanged)
 	Q_PROPERTY(int curPoint READ curPoint WRITE setCurPoint NOTIFY curPointChanged)
 	Q_PROPERTY(bool isModified READ isModified NOTIFY isModifiedChanged)
+	Q_PROPERTY(bool canUndo READ canUndo NOTIFY undoStateChanged)
+	Q_PROPERTY(bool canRedo READ canRedo NOTIFY undoStateChanged)
+	Q_PROPERTY(bool coalesceUpdates READ coalesceUpdates WRITE setCoalesceUpdates NOTIFY coalesceUpdatesChanged)
 
 public:
 	/**
@@ -125,7 +174,7 @@ public:
 	 */
 	int numPoints() const
 	{
-		return m_sequence.length();
+		return isMapped() ? m_numMappedPoints : m_durations.size();
 	}
 
 	/**
@@ -183,19 +232,121 @@ public:
 	/**
 	 * \brief Saves the sequence to file
 	 *
-	 * If successuful, this resets the isModified flag to false
+	 * If successuful, this resets the isModified flag to false. Pending
+	 * notifications of grouped modifications are emitted first, so that
+	 * the flag is settled before writing
 	 * \param filename the name of the file to which the sequence is saved
 	 * \return false in case of error, true otherwise
 	 */
-	bool save(QString filename) const;
+	bool save(QString filename);
 
 	/**
 	 * \brief Saves the sequence to a JSON document
 	 *
-	 * If successuful, this resets the isModified flag to false
+	 * If successuful, this resets the isModified flag to false. Pending
+	 * notifications of grouped modifications are emitted first, so that
+	 * the flag is settled before writing
 	 * \return the JSON document representing the sequence
 	 */
-	QJsonDocument save() const;
+	QJsonDocument save();
+
+	/**
+	 * \brief Returns true if the file name is for the binary format
+	 *
+	 * Binary sequences files have the .seqb extension
+	 * \param filename the name of the file
+	 * \return true if the file name is for the binary format
+	 */
+	static bool isBinaryFilename(QString filename);
+
+	/**
+	 * \brief Loads a sequence from a file in the binary format
+	 *
+	 * This returns a unique_ptr (we cannot retutrn by value because we have
+	 * no copy nor move constructor). The sequence is marked as unmodified.
+	 * \param filename the name of the file to read
+	 * \return the loaded sequence. The sequence is not valid in case of
+	 *         errors
+	 */
+	static std::unique_ptr<Sequence> loadBinary(QString filename);
+
+	/**
+	 * \brief Loads a sequence in the binary format from a device
+	 *
+	 * This returns a unique_ptr (we cannot retutrn by value because we have
+	 * no copy nor move constructor). The sequence is marked as unmodified.
+	 * \param device the device to read. It must be open
+	 * \return the loaded sequence. The sequence is not valid in case of
+	 *         errors
+	 */
+	static std::unique_ptr<Sequence> loadBinary(QIODevice* device);
+
+	/**
+	 * \brief Saves the sequence to file in the binary format
+	 *
+	 * If successuful, this resets the isModified flag to false. Pending
+	 * notifications of grouped modifications are emitted first, so that
+	 * the flag is settled before writing
+	 * \param filename the name of the file to which the sequence is saved
+	 * \return false in case of error, true otherwise
+	 */
+	bool saveBinary(QString filename);
+
+	/**
+	 * \brief Saves the sequence in the binary format to a device
+	 *
+	 * If successuful, this resets the isModified flag to false. Pending
+	 * notifications of grouped modifications are emitted first, so that
+	 * the flag is settled before writing
+	 * \param device the device to write. It must be open
+	 * \return false in case of error, true otherwise
+	 */
+	bool saveBinary(QIODevice* device);
+
+	/**
+	 * \brief Memory maps a file in the binary format
+	 *
+	 * Only the header and the min and max points are read, the other points
+	 * are decoded when accessed. The file remains mapped until the sequence
+	 * is modified or detach() is called, do not modify or truncate it in the
+	 * meantime. This returns a unique_ptr (we cannot retutrn by value
+	 * because we have no copy nor move constructor). The sequence is marked
+	 * as unmodified.
+	 * \param filename the name of the file to map
+	 * \return the mapped sequence. The sequence is not valid in case of
+	 *         errors
+	 */
+	static std::unique_ptr<Sequence> map(QString filename);
+
+	/**
+	 * \brief Returns true if points are read from a mapped file
+	 *
+	 * \return true if points are read from a mapped file
+	 */
+	bool isMapped() const
+	{
+		return (m_mappedPoints != nullptr);
+	}
+
+	/**
+	 * \brief Returns true if the given file is the one mapped by this
+	 *        sequence
+	 *
+	 * \param filename the name of the file to check
+	 * \return true if the sequence is mapped and filename refers to the
+	 *         mapped file
+	 */
+	bool isMappedFile(QString filename) const;
+
+	/**
+	 * \brief Reads all points of a mapped file into memory and releases
+	 *        the file
+	 *
+	 * This is called automatically by all functions modifying the
+	 * sequence. It does nothing if the sequence is not mapped, otherwise
+	 * pending notifications of grouped modifications are emitted first
+	 */
+	void detach();
 
 	/**
 	 * \brief Inserts a new point after the current position, equal to the
@@ -294,19 +445,23 @@ public:
 	/**
 	 * \brief Returns the point at the given position
 	 *
+	 * This returns a copy because points of mapped sequences are decoded on
+	 * the fly
 	 * \param pos the position in the sequence of the point
 	 * \return the point at the given position
 	 */
-	const SequencePoint& operator[](int pos) const;
+	SequencePoint operator[](int pos) const;
 
 	/**
 	 * \brief Returns the current point
 	 *
+	 * This returns a copy because points of mapped sequences are decoded on
+	 * the fly
 	 * \return the current point
 	 * \warning This function does not check if the current point is -1,
 	 *          only use it on a non-empty sequence!
 	 */
-	const SequencePoint& point() const;
+	SequencePoint point() const;
 
 	/**
 	 * \brief Returns a coordinate of a point
@@ -417,6 +572,89 @@ public:
 	 */
 	Q_INVOKABLE void setTimeToTarget(int t);
 
+	/**
+	 * \brief Returns true if there is a modification to undo
+	 *
+	 * \return true if there is a modification to undo
+	 */
+	bool canUndo() const
+	{
+		return (m_undoPosition > 0);
+	}
+
+	/**
+	 * \brief Returns true if there is a modification to redo
+	 *
+	 * \return true if there is a modification to redo
+	 */
+	bool canRedo() const
+	{
+		return (m_undoPosition < m_undoJournal.size());
+	}
+
+	/**
+	 * \brief Undoes the last modification
+	 *
+	 * The current point is moved to the point that is affected by the
+	 * modification
+	 */
+	Q_INVOKABLE void undo();
+
+	/**
+	 * \brief Redoes the last undone modification
+	 *
+	 * The current point is moved to the point that is affected by the
+	 * modification
+	 */
+	Q_INVOKABLE void redo();
+
+	/**
+	 * \brief Stops merging changes into the last undo step
+	 *
+	 * Call this when the user finishes an interaction that produces many
+	 * changes of the same value (e.g. when a slider is released), so that
+	 * the next change starts a new undo step
+	 */
+	Q_INVOKABLE void closeUndoStep();
+
+	/**
+	 * \brief Starts grouping notifications of modifications
+	 *
+	 * Calls can be nested, notifications are emitted by the endUpdate()
+	 * matching the outermost call
+	 */
+	Q_INVOKABLE void beginUpdate();
+
+	/**
+	 * \brief Ends grouping notifications of modifications
+	 *
+	 * If this matches the outermost call to beginUpdate(), pending
+	 * notifications are emitted
+	 */
+	Q_INVOKABLE void endUpdate();
+
+	/**
+	 * \brief Returns true if modifications are automatically grouped and
+	 *        notified at most once per frame
+	 *
+	 * \return true if modifications are notified at most once per frame
+	 */
+	bool coalesceUpdates() const
+	{
+		return m_coalesceUpdates;
+	}
+
+	/**
+	 * \brief Sets whether modifications are automatically grouped and
+	 *        notified at most once per frame
+	 *
+	 * When switching this off, pending notifications are emitted
+	 * immediately
+	 * \param coalesce if true modifications are notified at most once per
+	 *                 frame
+	 */
+	void setCoalesceUpdates(bool coalesce);
+
 signals:
 	/**
 	 * \brief The signal emitted when the number of points in the sequence
@@ -433,11 +671,62 @@ signals:
 	 * \brief The signal emitted when a point changes
 	 *
 	 * This is emitted whenever the point position, duration or time to
-	 * target changes
+	 * target changes. For modifications grouped by beginUpdate() and
+	 * endUpdate() or coalesced, this is emitted when the update ends for
+	 * all points in the range of pointsChanged(), connect to pointsChanged()
+	 * to receive a single notification
 	 * \param pos the position in the sequence of the point that changed
 	 */
 	void pointValuesChanged(int pos);
 
+	/**
+	 * \brief The signal emitted when the values of a range of points
+	 *        change
+	 *
+	 * This is emitted whenever the position, duration or time to target of
+	 * one or more points changes. Not all points in the range necessarily
+	 * changed
+	 * \param first the position in the sequence of the first point of the
+	 *              range
+	 * \param last the position in the sequence of the last point of the
+	 *             range
+	 */
+	void pointsChanged(int first, int last);
+
+	/**
+	 * \brief The signal emitted just before points are inserted
+	 *
+	 * \param first the position the first inserted point will have
+	 * \param last the position the last inserted point will have
+	 */
+	void pointsAboutToBeInserted(int first, int last);
+
+	/**
+	 * \brief The signal emitted after points have been inserted
+	 *
+	 * This is emitted before numPointsChanged()
+	 * \param first the position of the first inserted point
+	 * \param last the position of the last inserted point
+	 */
+	void pointsInserted(int first, int last);
+
+	/**
+	 * \brief The signal emitted just before points are removed
+	 *
+	 * \param first the position of the first point that will be removed
+	 * \param last the position of the last point that will be removed
+	 */
+	void pointsAboutToBeRemoved(int first, int last);
+
+	/**
+	 * \brief The signal emitted after points have been removed
+	 *
+	 * This is emitted before numPointsChanged()
+	 * \param first the position the first removed point had
+	 * \param last the position the last removed point had
+	 */
+	void pointsRemoved(int first, int last);
+
 	/**
 	 * \brief The signal emitted when one of the values of the current point
 	 *        changes
@@ -453,7 +742,86 @@ signals:
 	 */
 	void isModifiedChanged();
 
+	/**
+	 * \brief The signal emitted when canUndo or canRedo change
+	 */
+	void undoStateChanged();
+
+	/**
+	 * \brief The signal emitted when the coalesceUpdates property changes
+	 */
+	void coalesceUpdatesChanged();
+
+private slots:
+	/**
+	 * \brief Ends the update started automatically when coalesceUpdates
+	 *        is true
+	 */
+	void endCoalescedUpdate();
+
 private:
+	/**
+	 * \brief An entry of the undo journal
+	 */
+	struct UndoEntry
+	{
+		/**
+		 * \brief The possible types of modification
+		 */
+		enum class Type {
+			Coordinate,
+			Duration,
+			TimeToTarget,
+			Point,
+			Insert,
+			Remove,
+			Clear
+		};
+
+		/**
+		 * \brief The type of modification
+		 */
+		Type type;
+
+		/**
+		 * \brief The position of the modified point
+		 *
+		 * For Clear entries this is the current point before clearing
+		 */
+		int pos;
+
+		/**
+		 * \brief The index of the modified coordinate
+		 *
+		 * Only used for Coordinate entries
+		 */
+		int coordinate;
+
+		/**
+		 * \brief The old value
+		 *
+		 * Only used for Coordinate, Duration and TimeToTarget entries
+		 */
+		double oldValue;
+
+		/**
+		 * \brief The new value
+		 *
+		 * Only used for Coordinate, Duration and TimeToTarget entries
+		 */
+		double newValue;
+
+		/**
+		 * \brief The points involved in the modification
+		 *
+		 * For Point entries these are the old and the new point, for
+		 * Insert and Remove entries the inserted or removed point and
+		 * for Clear entries all removed points. This is empty for the
+		 * other entries, so that they do not allocate memory
+		 */
+		QVector<SequencePoint> points;
+	};
+
 	/**
 	 * \brief Validates a point eventually changing it so that it has the
 	 *        correct number of coordinates and all values are within the
@@ -465,12 +833,147 @@ private:
 	 */
 	SequencePoint validatePoint(SequencePoint p, bool skipLimits = false) const;
 
+	/**
+	 * \brief Returns the address of the record of a point in the mapped
+	 *        file
+	 *
+	 * \param pos the position in the sequence of the point
+	 * \return the address of the record of the point
+	 */
+	const uchar* mappedRecord(int pos) const;
+
+	/**
+	 * \brief Decodes and validates a point of the mapped file
+	 *
+	 * \param pos the position in the sequence of the point
+	 * \return the point
+	 */
+	SequencePoint mappedPoint(int pos) const;
+
+	/**
+	 * \brief Returns a point from the in-memory storage
+	 *
+	 * \param pos the position in the sequence of the point
+	 * \return the point
+	 */
+	SequencePoint storedPoint(int pos) const;
+
+	/**
+	 * \brief Overwrites a point in the in-memory storage
+	 *
+	 * \param pos the position in the sequence of the point
+	 * \param p the point. It must be already validated
+	 */
+	void storePoint(int pos, const SequencePoint& p);
+
+	/**
+	 * \brief Inserts a point in the in-memory storage
+	 *
+	 * \param pos the position at which the point is inserted. Use
+	 *            numPoints() to append
+	 * \param p the point. It must be already validated
+	 */
+	void insertPoint(int pos, const SequencePoint& p);
+
+	/**
+	 * \brief Removes a point from the in-memory storage
+	 *
+	 * \param pos the position in the sequence of the point
+	 */
+	void removePoint(int pos);
+
+	/**
+	 * \brief Reserves space in the in-memory storage
+	 *
+	 * \param n the number of points to reserve space for
+	 */
+	void reservePoints(int n);
+
 	/**
 	 * \brief Sets the sequence as modified and emites the signal if this is
 	 *        the first modification
 	 */
 	void sequenceModified();
 
+	/**
+	 * \brief Notifies that the values of a point changed
+	 *
+	 * The notification is deferred if an update is in progress
+	 * \param pos the position of the modified point
+	 */
+	void pointValuesModified(int pos);
+
+	/**
+	 * \brief Emits pending notifications of modifications
+	 *
+	 * This does not end the update in progress, further modifications are
+	 * still grouped
+	 */
+	void flushPendingChanges();
+
+	/**
+	 * \brief Records a modification of a single value in the undo journal
+	 *
+	 * If the last entry is for the same value and the undo step is still
+	 * open, the modification is merged into it
+	 * \param type the type of modification. This must be Coordinate,
+	 *             Duration or TimeToTarget
+	 * \param pos the position of the modified point
+	 * \param c the index of the modified coordinate (ignored if type is not
+	 *          Coordinate)
+	 * \param oldValue the old value
+	 * \param newValue the new value
+	 */
+	void recordValueChange(UndoEntry::Type type, int pos, int c, double oldValue, double newValue);
+
+	/**
+	 * \brief Records a modification involving whole points in the undo
+	 *        journal
+	 *
+	 * \param type the type of modification. This must be Point, Insert,
+	 *             Remove or Clear
+	 * \param pos the position of the point (or the current point for Clear
+	 *            entries)
+	 * \param points the points involved in the modification (see
+	 *               UndoEntry::points)
+	 */
+	void recordPointsChange(UndoEntry::Type type, int pos, QVector<SequencePoint> points);
+
+	/**
+	 * \brief Adds an entry to the undo journal, discarding entries that
+	 *        could be redone
+	 *
+	 * \param entry the entry to add
+	 */
+	void addUndoEntry(UndoEntry entry);
+
+	/**
+	 * \brief Applies an entry of the undo journal
+	 *
+	 * \param entry the entry to apply
+	 * \param undo if true the modification is undone, otherwise it is
+	 *             redone
+	 */
+	void applyUndoEntry(const UndoEntry& entry, bool undo);
+
+	/**
+	 * \brief Inserts a point, makes it the current point and emits signals
+	 *
+	 * This is used to undo and redo modifications
+	 * \param pos the position at which the point is inserted
+	 * \param p the point. It must be already validated
+	 */
+	void insertPointAt(int pos, const SequencePoint& p);
+
+	/**
+	 * \brief Removes a point, moves the current point to the same position
+	 *        and emits signals
+	 *
+	 * This is used to undo and redo modifications
+	 * \param pos the position of the point to remove
+	 */
+	void removePointAt(int pos);
+
 	/**
 	 * \brief The dimensionality of points
 	 *
@@ -491,9 +994,49 @@ private:
 	const SequencePoint m_max;
 
 	/**
-	 * \brief The sequence
+	 * \brief The coordinates of all points of the sequence
+	 *
+	 * Points are stored contiguously, the coordinates of the point at
+	 * position i start at index i * m_pointDim. Together with m_durations
+	 * and m_timeToTargets this avoids one allocation per point
+	 */
+	QVector<double> m_coordinates;
+
+	/**
+	 * \brief The durations of all points of the sequence
+	 */
+	QVector<int> m_durations;
+
+	/**
+	 * \brief The times to target of all points of the sequence
+	 */
+	QVector<int> m_timeToTargets;
+
+	/**
+	 * \brief The mapped file
+	 *
+	 * This is nullptr if the sequence is not mapped
+	 */
+	std::unique_ptr<QFile> m_mappedFile;
+
+	/**
+	 * \brief The record of the first point in the mapped file
+	 *
+	 * This is nullptr if the sequence is not mapped. When this is not
+	 * nullptr, the in-memory storage is empty
+	 */
+	const uchar* m_mappedPoints;
+
+	/**
+	 * \brief The number of points in the mapped file
 	 */
-	QList<SequencePoint> m_sequence;
+	int m_numMappedPoints;
+
+	/**
+	 * \brief True if coordinates in the mapped file are stored as quint8,
+	 *        false if they are doubles
+	 */
+	bool m_mappedUInt8Coordinates;
 
 	/**
 	 * \brief The current point in the sequence
@@ -506,7 +1049,64 @@ private:
 	 * \brief True if this sequence has been modified after construction or
 	 *        after the last time it was saved
 	 */
-	mutable bool m_isModified;
+	bool m_isModified;
+
+	/**
+	 * \brief The undo journal
+	 *
+	 * Entries before m_undoPosition can be undone, the others can be redone
+	 */
+	QVector<UndoEntry> m_undoJournal;
+
+	/**
+	 * \brief The number of entries of the undo journal that are applied
+	 */
+	int m_undoPosition;
+
+	/**
+	 * \brief True if modifications of the same value can be merged into
+	 *        the last entry of the undo journal
+	 */
+	bool m_undoStepOpen;
+
+	/**
+	 * \brief True while undoing or redoing a modification
+	 *
+	 * Modifications are not recorded when this is true
+	 */
+	bool m_replayingUndo;
+
+	/**
+	 * \brief The nesting level of beginUpdate() calls
+	 */
+	int m_updateDepth;
+
+	/**
+	 * \brief If true modifications are notified at most once per frame
+	 */
+	bool m_coalesceUpdates;
+
+	/**
+	 * \brief The timer ending the update started automatically when
+	 *        m_coalesceUpdates is true
+	 *
+	 * When this is active there is an automatic update in progress
+	 */
+	QTimer m_coalesceTimer;
+
+	/**
+	 * \brief The first modified point not notified yet
+	 *
+	 * This is -1 if there are no pending notifications
+	 */
+	int m_pendingFirst;
+
+	/**
+	 * \brief The last modified point not notified yet
+	 *
+	 * This is -1 if there are no pending notifications
+	 */
+	int m_pendingLast;
 };
 
 #endif // SEQUENCE_H
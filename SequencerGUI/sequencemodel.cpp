@@ -0,0 +1,209 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include "sequencemodel.h"
+
+SequenceModel::SequenceModel(Sequence* sequence, QObject* parent)
+	: QAbstractListModel(parent)
+	, m_sequence()
+	, m_curPoint(-1)
+{
+	setSequence(sequence);
+}
+
+void SequenceModel::setSequence(Sequence* sequence)
+{
+	if (sequence == m_sequence) {
+		return;
+	}
+
+	beginResetModel();
+
+	if (m_sequence) {
+		disconnect(m_sequence, 0, this, 0);
+	}
+
+	m_sequence = sequence;
+	m_curPoint = -1;
+
+	if (m_sequence) {
+		m_curPoint = m_sequence->curPoint();
+
+		connect(m_sequence, &Sequence::pointsChanged, this, &SequenceModel::pointsChanged);
+		connect(m_sequence, &Sequence::pointsAboutToBeInserted, this, &SequenceModel::pointsAboutToBeInserted);
+		connect(m_sequence, &Sequence::pointsInserted, this, &SequenceModel::pointsInserted);
+		connect(m_sequence, &Sequence::pointsAboutToBeRemoved, this, &SequenceModel::pointsAboutToBeRemoved);
+		connect(m_sequence, &Sequence::pointsRemoved, this, &SequenceModel::pointsRemoved);
+		connect(m_sequence, &Sequence::curPointChanged, this, &SequenceModel::curPointChanged);
+		connect(m_sequence, &Sequence::destroyed, this, &SequenceModel::sequenceDestroyed);
+	}
+
+	endResetModel();
+
+	emit sequenceChanged();
+}
+
+int SequenceModel::rowCount(const QModelIndex& parent) const
+{
+	if (parent.isValid() || !m_sequence) {
+		return 0;
+	}
+
+	return m_sequence->numPoints();
+}
+
+QVariant SequenceModel::data(const QModelIndex& index, int role) const
+{
+	if (!m_sequence || !index.isValid() || (index.row() >= m_sequence->numPoints())) {
+		return QVariant();
+	}
+
+	const int pos = index.row();
+
+	switch (role) {
+		case CoordinatesRole:
+			{
+				QVariantList coordinates;
+				coordinates.reserve(m_sequence->pointDim());
+				for (unsigned int c = 0; c < m_sequence->pointDim(); ++c) {
+					coordinates.append(m_sequence->pointCoordinate(pos, c));
+				}
+
+				return coordinates;
+			}
+		case DurationRole:
+			return m_sequence->pointDuration(pos);
+		case TimeToTargetRole:
+			return m_sequence->pointTimeToTarget(pos);
+		case IsCurrentRole:
+			return pos == m_sequence->curPoint();
+		default:
+			return QVariant();
+	}
+}
+
+bool SequenceModel::setData(const QModelIndex& index, const QVariant& value, int role)
+{
+	if (!m_sequence || !index.isValid() || (index.row() >= m_sequence->numPoints())) {
+		return false;
+	}
+
+	const int pos = index.row();
+
+	// The sequence notifies the change, which is then forwarded by
+	// pointsChanged()
+	switch (role) {
+		case CoordinatesRole:
+			{
+				const QVariantList coordinates = value.toList();
+				if (static_cast<unsigned int>(coordinates.size()) != m_sequence->pointDim()) {
+					return false;
+				}
+
+				SequencePoint p = (*m_sequence)[pos];
+				for (int c = 0; c < coordinates.size(); ++c) {
+					p.point[c] = coordinates[c].toDouble();
+				}
+				m_sequence->setPoint(pos, p);
+			}
+			return true;
+		case DurationRole:
+			m_sequence->setDuration(pos, value.toInt());
+			return true;
+		case TimeToTargetRole:
+			m_sequence->setTimeToTarget(pos, value.toInt());
+			return true;
+		default:
+			return false;
+	}
+}
+
+Qt::ItemFlags SequenceModel::flags(const QModelIndex& index) const
+{
+	if (!index.isValid()) {
+		return Qt::NoItemFlags;
+	}
+
+	return QAbstractListModel::flags(index) | Qt::ItemIsEditable;
+}
+
+QHash<int, QByteArray> SequenceModel::roleNames() const
+{
+	QHash<int, QByteArray> roles;
+
+	roles[CoordinatesRole] = "coordinates";
+	roles[DurationRole] = "duration";
+	roles[TimeToTargetRole] = "timeToTarget";
+	roles[IsCurrentRole] = "isCurrent";
+
+	return roles;
+}
+
+void SequenceModel::pointsChanged(int first, int last)
+{
+	emit dataChanged(index(first), index(last), {CoordinatesRole, DurationRole, TimeToTargetRole});
+}
+
+void SequenceModel::pointsAboutToBeInserted(int first, int last)
+{
+	beginInsertRows(QModelIndex(), first, last);
+}
+
+void SequenceModel::pointsInserted()
+{
+	endInsertRows();
+}
+
+void SequenceModel::pointsAboutToBeRemoved(int first, int last)
+{
+	beginRemoveRows(QModelIndex(), first, last);
+}
+
+void SequenceModel::pointsRemoved()
+{
+	endRemoveRows();
+}
+
+void SequenceModel::curPointChanged()
+{
+	const int oldCurPoint = m_curPoint;
+	m_curPoint = m_sequence->curPoint();
+
+	// Only the rows of the old and new current points change. The old one
+	// could have been removed
+	if ((oldCurPoint >= 0) && (oldCurPoint < rowCount())) {
+		emit dataChanged(index(oldCurPoint), index(oldCurPoint), {IsCurrentRole});
+	}
+	if (m_curPoint >= 0) {
+		emit dataChanged(index(m_curPoint), index(m_curPoint), {IsCurrentRole});
+	}
+}
+
+void SequenceModel::sequenceDestroyed()
+{
+	// The QPointer has already been cleared, the connections are removed
+	// by the destroyed object
+	beginResetModel();
+	m_curPoint = -1;
+	endResetModel();
+
+	emit sequenceChanged();
+}
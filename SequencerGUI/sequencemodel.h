@@ -0,0 +1,228 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef SEQUENCEMODEL_H
+#define SEQUENCEMODEL_H
+
+#include <QAbstractListModel>
+#include <QPointer>
+#include "sequence.h"
+
+/**
+ * \brief A list model exposing the points of a Sequence
+ *
+ * Each row of the model is a point of the sequence. The model has roles for
+ * the coordinates (as a list of numbers), the duration and the time to target
+ * of points, plus a role telling whether the point is the current one. All
+ * changes of the sequence are forwarded as ranged notifications (dataChanged,
+ * rowsInserted, rowsRemoved), so views (e.g. a QML ListView) only create and
+ * update the delegates of visible rows. Values are read from the sequence
+ * when requested, so this works with memory-mapped sequences without reading
+ * all points. The model does not own the sequence, it resets itself when the
+ * sequence is changed or destroyed.
+ */
+class SequenceModel : public QAbstractListModel
+{
+	Q_OBJECT
+	Q_PROPERTY(Sequence* sequence READ sequence WRITE setSequence NOTIFY sequenceChanged)
+
+public:
+	/**
+	 * \brief The roles of the model
+	 */
+	enum Roles {
+		CoordinatesRole = Qt::UserRole + 1, ///< The coordinates of the point
+		DurationRole, ///< The duration of the point
+		TimeToTargetRole, ///< The time to target of the point
+		IsCurrentRole ///< Whether the point is the current one (read-only)
+	};
+
+public:
+	/**
+	 * \brief Constructor
+	 *
+	 * \param sequence the sequence to expose. Can be nullptr
+	 * \param parent the parent object
+	 */
+	explicit SequenceModel(Sequence* sequence = nullptr, QObject* parent = 0);
+
+	/**
+	 * \brief Copy constructor is deleted
+	 *
+	 * \param other the object to copy
+	 */
+	SequenceModel(const SequenceModel& other) = delete;
+
+	/**
+	 * \brief Move constructor is deleted
+	 *
+	 * \param other the object to move into this
+	 */
+	SequenceModel(SequenceModel&& other) = delete;
+
+	/**
+	 * \brief Copy operator is deleted
+	 */
+	SequenceModel& operator=(const SequenceModel& other) = delete;
+
+	/**
+	 * \brief Move operator is deleted
+	 */
+	SequenceModel& operator=(SequenceModel&& other) = delete;
+
+	/**
+	 * \brief Destructor
+	 *
+	 * The default one is fine
+	 */
+	virtual ~SequenceModel() = default;
+
+	/**
+	 * \brief Returns the exposed sequence
+	 *
+	 * \return the exposed sequence, nullptr if there is none
+	 */
+	Sequence* sequence() const
+	{
+		return m_sequence;
+	}
+
+	/**
+	 * \brief Sets the sequence to expose
+	 *
+	 * The model is reset
+	 * \param sequence the sequence to expose. Can be nullptr
+	 */
+	void setSequence(Sequence* sequence);
+
+	/**
+	 * \brief Returns the number of rows (i.e. of points in the sequence)
+	 *
+	 * \param parent the parent index. This is a list model, so the number
+	 *               of rows is 0 for valid parents
+	 * \return the number of rows
+	 */
+	virtual int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+
+	/**
+	 * \brief Returns the data of a point
+	 *
+	 * \param index the index of the point
+	 * \param role the role to return
+	 * \return the value of the given role or an invalid QVariant
+	 */
+	virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+	/**
+	 * \brief Changes the data of a point
+	 *
+	 * The values are validated by the sequence (e.g. clamped within limits)
+	 * \param index the index of the point
+	 * \param value the new value
+	 * \param role the role to change. IsCurrentRole cannot be changed
+	 * \return true if the value was changed
+	 */
+	virtual bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole) override;
+
+	/**
+	 * \brief Returns the flags of an item
+	 *
+	 * \param index the index of the item
+	 * \return the flags of the item
+	 */
+	virtual Qt::ItemFlags flags(const QModelIndex& index) const override;
+
+	/**
+	 * \brief Returns the names of roles used by QML
+	 *
+	 * \return the names of roles
+	 */
+	virtual QHash<int, QByteArray> roleNames() const override;
+
+signals:
+	/**
+	 * \brief The signal emitted when the exposed sequence changes
+	 */
+	void sequenceChanged();
+
+private slots:
+	/**
+	 * \brief Called when the values of a range of points change
+	 *
+	 * \param first the first point of the range
+	 * \param last the last point of the range
+	 */
+	void pointsChanged(int first, int last);
+
+	/**
+	 * \brief Called before points are inserted
+	 *
+	 * \param first the position of the first inserted point
+	 * \param last the position of the last inserted point
+	 */
+	void pointsAboutToBeInserted(int first, int last);
+
+	/**
+	 * \brief Called after points have been inserted
+	 */
+	void pointsInserted();
+
+	/**
+	 * \brief Called before points are removed
+	 *
+	 * \param first the position of the first removed point
+	 * \param last the position of the last removed point
+	 */
+	void pointsAboutToBeRemoved(int first, int last);
+
+	/**
+	 * \brief Called after points have been removed
+	 */
+	void pointsRemoved();
+
+	/**
+	 * \brief Called when the current point changes
+	 */
+	void curPointChanged();
+
+	/**
+	 * \brief Called when the exposed sequence is destroyed
+	 */
+	void sequenceDestroyed();
+
+private:
+	/**
+	 * \brief The exposed sequence
+	 *
+	 * This is a QPointer because the sequence is not owned by the model
+	 */
+	QPointer<Sequence> m_sequence;
+
+	/**
+	 * \brief The current point the last time we checked
+	 *
+	 * This is used to notify the change of IsCurrentRole only for the two
+	 * affected rows
+	 */
+	int m_curPoint;
+};
+
+#endif // SEQUENCEMODEL_H
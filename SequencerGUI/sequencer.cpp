@@ -34,25 +34,51 @@ namespace {
 Sequencer::Sequencer(QObject *parent)
 	: QObject(parent)
 	, m_sequence(std::make_unique<Sequence>(pointDim, minPoint, maxPoint))
+	, m_sequenceModel(std::make_unique<SequenceModel>(m_sequence.get()))
 	, m_serialCommunication(std::make_unique<SerialCommunication>())
 {
+	// The GUI changes values continuously (e.g. when dragging sliders), so
+	// notifications are grouped once per frame
+	m_sequence->setCoalesceUpdates(true);
 }
 
 void Sequencer::newSequence()
 {
 	m_sequence = std::make_unique<Sequence>(pointDim, minPoint, maxPoint);
+	m_sequence->setCoalesceUpdates(true);
+	m_sequenceModel->setSequence(m_sequence.get());
 
 	emit sequenceChanged();
 }
 
 bool Sequencer::saveSequence(QString filename)
 {
-	return m_sequence->save(QUrl(filename).toLocalFile());
+	const QString localFilename = QUrl(filename).toLocalFile();
+
+	// Reading all points if we are overwriting the mapped file, saving to
+	// other files reads points directly from the mapped one
+	if (m_sequence->isMappedFile(localFilename)) {
+		m_sequence->detach();
+	}
+
+	if (Sequence::isBinaryFilename(localFilename)) {
+		return m_sequence->saveBinary(localFilename);
+	} else {
+		return m_sequence->save(localFilename);
+	}
 }
 
 bool Sequencer::loadSequence(QString filename)
 {
-	m_sequence = Sequence::load(QUrl(filename).toLocalFile());
+	const QString localFilename = QUrl(filename).toLocalFile();
+
+	if (Sequence::isBinaryFilename(localFilename)) {
+		m_sequence = Sequence::map(localFilename);
+	} else {
+		m_sequence = Sequence::load(localFilename);
+	}
+	m_sequence->setCoalesceUpdates(true);
+	m_sequenceModel->setSequence(m_sequence.get());
 
 	emit sequenceChanged();
 
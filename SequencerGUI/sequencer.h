@@ -25,20 +25,22 @@
 #include <QObject>
 #include "utils.h"
 #include "sequence.h"
+#include "sequencemodel.h"
 #include "serialcommunication.h"
 
 /**
  * \brief The main class of the applications
  *
  * This class is meant to be instantiated only once and to be used as the QML
- * context object. It contanins the instances of the current sequence and the
- * object used for serial communication (exposed as read-only properties). It
- * also has methods to load and save sequence files.
+ * context object. It contanins the instances of the current sequence, a list
+ * model of its points and the object used for serial communication (exposed
+ * as read-only properties). It also has methods to load and save sequence files.
  */
 class Sequencer : public QObject
 {
 	Q_OBJECT
 	Q_PROPERTY(Sequence* sequence READ sequence NOTIFY sequenceChanged)
+	Q_PROPERTY(SequenceModel* sequenceModel READ sequenceModel NOTIFY sequenceModelChanged)
 	Q_PROPERTY(SerialCommunication* serialCommunication READ serialCommunication NOTIFY serialCommunicationChanged)
 
 public:
@@ -90,6 +92,17 @@ public:
 		return m_sequence.get();
 	}
 
+	/**
+	 * \brief Returns the list model of the points of the current sequence
+	 *
+	 * The model always refers to the current sequence
+	 * \return the list model of the points of the current sequence
+	 */
+	SequenceModel* sequenceModel()
+	{
+		return m_sequenceModel.get();
+	}
+
 	/**
 	 * \brief Returns the object to use for serial communication
 	 *
@@ -106,6 +119,15 @@ signals:
 	 */
 	void sequenceChanged();
 
+	/**
+	 * \brief The signal emitted when the list model of the sequence changes
+	 *
+	 * This signal is never emitted (the model is updated when the sequence
+	 * changes), but it is needed to avoid warnings from QML (because
+	 * sequenceModel is used in property bindings)
+	 */
+	void sequenceModelChanged();
+
 	/**
 	 * \brief The signal emitted when the object for serial communication
 	 *        changes
@@ -124,6 +146,8 @@ public slots:
 	/**
 	 * \brief Saves the sequence to file
 	 *
+	 * The sequence is saved in the binary format if the file has the .seqb
+	 * extension, in the JSON format otherwise
 	 * \param filename the name of the file where the sequence is to be
 	 *        saved
 	 * \return true if saving was successful
@@ -133,6 +157,8 @@ public slots:
 	/**
 	 * \brief Loads a sequence file
 	 *
+	 * Files with the .seqb extension are memory mapped as binary sequences
+	 * (see Sequence::map()), all other files are read as JSON sequences
 	 * \param filename the name of the file to load
 	 * \return true if loading was successful
 	 */
@@ -144,6 +170,11 @@ private:
 	 */
 	std::unique_ptr<Sequence> m_sequence;
 
+	/**
+	 * \brief The list model of the points of the current sequence
+	 */
+	std::unique_ptr<SequenceModel> m_sequenceModel;
+
 	/**
 	 * \brief The object for serial communication
 	 */
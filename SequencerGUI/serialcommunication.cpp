@@ -21,37 +21,64 @@
 
 #include "serialcommunication.h"
 #include <QDebug>
+#include <QTextStream>
+#include <QFile>
+#include <algorithm>
 
 SerialCommunication::SerialCommunication(QObject* parent)
 	: QObject(parent)
 	, m_serialPortName("/dev/ttyUSB4")
 	, m_baudRate(115200)
 	, m_oneShotSequence(true)
-	, m_serialPort()
+	, m_useIOThread(false)
+	, m_framedProtocol(false)
+	, m_corruptedFrames(0)
+	, m_maxBaudRate(1000000)
+	, m_linkBaudRate(0)
+	, m_pointsPerSecond(0.0)
+	, m_packetTrace(false)
+	, m_ioThread()
+	, m_worker(nullptr)
+	, m_isConnected(false)
 	, m_sequence(nullptr)
 	, m_isStreamMode(false)
 	, m_isImmediateMode(false)
-	, m_arduinoBoot()
-	, m_incomingData()
-	, m_indexToProcess(0)
 	, m_paused(false)
-	, m_hardwareQueueFull(false)
 	, m_batteryCharge(-1.0)
-	, m_stopping(false)
+	, m_hardwareBufferDepth(0)
+	, m_followingStream(false)
+	, m_immediateRate(50)
+	, m_immediateTimer(this)
+	, m_immediatePending(false)
+	, m_coalescedUpdates(0)
+	, m_pingInterval(0)
+	, m_roundTripTimes()
+	, m_creditIntervals()
+	, m_underrunDurations()
+	, m_telemetryRate(0)
+	, m_telemetry()
 {
-	// Connecting signals from the serial port
-	connect(&m_serialPort, &QSerialPort::readyRead, this, &SerialCommunication::handleReadyRead);
-	connect(&m_serialPort, static_cast<void (QSerialPort::*)(QSerialPort::SerialPortError)>(&QSerialPort::error), this, &SerialCommunication::handleError);
+	// These are needed to pass sequence packets to the worker when it lives in
+	// another thread
+	qRegisterMetaType<QVector<QByteArray>>("QVector<QByteArray>");
+	qRegisterMetaType<LatencyHistogram>("LatencyHistogram");
+	qRegisterMetaType<TelemetrySample>("TelemetrySample");
 
-	// Connecting the signal for the Arduino boot timer. Also setting the timer to be singleShot
-	m_arduinoBoot.setSingleShot(true);
-	connect(&m_arduinoBoot, &QTimer::timeout, this, &SerialCommunication::arduinoBootFinished);
+	m_ioThread.setObjectName("SerialCommunication I/O");
+
+	// The timer limiting the rate of points in immediate mode
+	m_immediateTimer.setSingleShot(true);
+	connect(&m_immediateTimer, &QTimer::timeout, this, &SerialCommunication::immediateIntervalElapsed);
+
+	createWorker();
 }
 
 SerialCommunication::~SerialCommunication()
 {
 	stop();
 	closeSerial();
+
+	destroyWorker();
 }
 
 void SerialCommunication::setSerialPortName(QString serialPortName)
@@ -77,10 +104,112 @@ void SerialCommunication::setOneShotSequence(bool oneShot)
 	if (oneShot != m_oneShotSequence) {
 		m_oneShotSequence  = oneShot;
 
+		QMetaObject::invokeMethod(m_worker, "setOneShot", workerConnection(), Q_ARG(bool, m_oneShotSequence));
+
 		emit oneShotSequenceChanged();
 	}
 }
 
+void SerialCommunication::setUseIOThread(bool useIOThread)
+{
+	if (isConnected()) {
+		qDebug() << "SerialCommunication error: cannot change the I/O thread while the port is open";
+		return;
+	}
+
+	if (useIOThread != m_useIOThread) {
+		m_useIOThread = useIOThread;
+
+		// Re-creating the worker in the right thread
+		destroyWorker();
+		createWorker();
+
+		emit useIOThreadChanged();
+	}
+}
+
+void SerialCommunication::setFramedProtocol(bool framedProtocol)
+{
+	if (isConnected()) {
+		qDebug() << "SerialCommunication error: cannot change the protocol while the port is open";
+		return;
+	}
+
+	if (framedProtocol != m_framedProtocol) {
+		m_framedProtocol = framedProtocol;
+
+		emit framedProtocolChanged();
+	}
+}
+
+void SerialCommunication::setMaxBaudRate(int maxBaudRate)
+{
+	if (isConnected()) {
+		qDebug() << "SerialCommunication error: cannot change the maximum baud rate while the port is open";
+		return;
+	}
+
+	if (maxBaudRate != m_maxBaudRate) {
+		m_maxBaudRate = maxBaudRate;
+
+		emit maxBaudRateChanged();
+	}
+}
+
+void SerialCommunication::setPacketTrace(bool packetTrace)
+{
+	if (packetTrace != m_packetTrace) {
+		m_packetTrace = packetTrace;
+		m_worker->packetTrace().setEnabled(m_packetTrace);
+
+		emit packetTraceChanged();
+	}
+}
+
+void SerialCommunication::setImmediateRate(int immediateRate)
+{
+	if (immediateRate < 0) {
+		qDebug() << "SerialCommunication error: invalid immediate mode rate" << immediateRate;
+		return;
+	}
+
+	if (immediateRate != m_immediateRate) {
+		m_immediateRate = immediateRate;
+
+		emit immediateRateChanged();
+	}
+}
+
+void SerialCommunication::setPingInterval(int pingInterval)
+{
+	if (pingInterval < 0) {
+		qDebug() << "SerialCommunication error: invalid ping interval" << pingInterval;
+		return;
+	}
+
+	if (pingInterval != m_pingInterval) {
+		m_pingInterval = pingInterval;
+		QMetaObject::invokeMethod(m_worker, "setPingInterval", workerConnection(), Q_ARG(int, m_pingInterval));
+
+		emit pingIntervalChanged();
+	}
+}
+
+void SerialCommunication::setTelemetryRate(int telemetryRate)
+{
+	if ((telemetryRate < 0) || (telemetryRate > 255)) {
+		qDebug() << "SerialCommunication error: invalid telemetry rate" << telemetryRate;
+		return;
+	}
+
+	if (telemetryRate != m_telemetryRate) {
+		m_telemetryRate = telemetryRate;
+		QMetaObject::invokeMethod(m_worker, "setTelemetryRate", workerConnection(), Q_ARG(int, m_telemetryRate));
+
+		emit telemetryRateChanged();
+	}
+}
+
 bool SerialCommunication::openSerial()
 {
 	if (isStreaming()) {
@@ -91,22 +220,34 @@ bool SerialCommunication::openSerial()
 	// Closing the old port
 	closeSerial();
 
-	// Setting the name and baud rate of the port
-	m_serialPort.setPortName(m_serialPortName);
-	m_serialPort.setBaudRate(m_baudRate);
+	// Trying to open the port. We have to wait for the result even if the
+	// worker is in another thread
+	bool opened = false;
+	QMetaObject::invokeMethod(m_worker, "openPort", workerConnection(true), Q_RETURN_ARG(bool, opened), Q_ARG(QString, m_serialPortName), Q_ARG(int, m_baudRate), Q_ARG(bool, m_framedProtocol), Q_ARG(int, m_maxBaudRate));
 
-	// Trying to open the port
-	if (!m_serialPort.open(QIODevice::ReadWrite)) {
+	if (!opened) {
 		return false;
 	}
 
+	// The worker resets the count when the port is opened
+	if (m_corruptedFrames != 0) {
+		m_corruptedFrames = 0;
+		emit corruptedFramesChanged();
+	}
+	setLinkBaudRate(m_baudRate);
+	setPointsPerSecond(0.0);
+
+	// The worker also resets latency statistics
+	m_roundTripTimes.clear();
+	m_creditIntervals.clear();
+	m_underrunDurations.clear();
+	emit latencyStatisticsChanged();
+	m_telemetry.clear();
+
 	// Signalling that the port is open
+	m_isConnected = true;
 	emit isConnectedChanged();
 
-	// This is necessary to give time to Arduino to "boot" (the board reboots every time the serial port
-	// is opened, and then there are 0.5 seconds taken by the bootloader)
-	m_arduinoBoot.start(1000);
-
 	return true;
 }
 
@@ -118,23 +259,44 @@ bool SerialCommunication::closeSerial()
 	}
 
 	// Closing the port
-	if (m_serialPort.isOpen()) {
-		m_serialPort.close();
-		m_serialPort.clearError();
+	if (m_isConnected) {
+		QMetaObject::invokeMethod(m_worker, "closePort", workerConnection(true));
 
 		// Signalling that the port is closed
+		m_isConnected = false;
 		emit isConnectedChanged();
 
-		// Setting the battery charge to -1.0
+		// Setting the battery charge to -1.0 and forgetting the hardware
+		// buffer depth, a different board could be connected next
 		setBatteryCharge(-1.0);
+		setHardwareBufferDepth(0);
+		setLinkBaudRate(0);
 	}
 
 	return true;
 }
 
+void SerialCommunication::abortSerial()
+{
+	if (!m_isConnected) {
+		return;
+	}
+
+	// Closing the port in the worker first, it ends the stream without
+	// notifying us
+	QMetaObject::invokeMethod(m_worker, "closePort", workerConnection(true));
+
+	if (isStreaming()) {
+		m_immediateTimer.stop();
+		sequenceStreamEnded();
+	}
+
+	closeSerial();
+}
+
 bool SerialCommunication::startStream(Sequence* sequence, bool startFromCurrent)
 {
-	if (!m_serialPort.isOpen()) {
+	if (!isConnected()) {
 		qDebug() << "SerialCommunication error: cannot start streaming with a closed serial port";
 		return false;
 	}
@@ -143,13 +305,8 @@ bool SerialCommunication::startStream(Sequence* sequence, bool startFromCurrent)
 		return false;
 	}
 
-	m_incomingData.clear();
-	m_indexToProcess = 0;
-
 	// Resetting the pause flag and setting the m_is*Mode flags
 	m_paused = false;
-	m_hardwareQueueFull = false;
-	m_stopping = false;
 	setIsStreamMode(true);
 	setIsImmediateMode(false);
 
@@ -162,11 +319,15 @@ bool SerialCommunication::startStream(Sequence* sequence, bool startFromCurrent)
 	// Emitting the signal telling that we started streaming
 	emit isStreamingChanged();
 
-	// If the m_arduinoBoot timer is running, we have to wait, otherwise we explicitly call
-	// the arduinoBootFinished() function to start sending the sequence
-	if (!m_arduinoBoot.isActive()) {
-		arduinoBootFinished();
-	}
+	// Connecting the signals of the sequence telling us when points change, so
+	// that the worker streams the up-to-date sequence
+	connect(m_sequence, &Sequence::curPointChanged, this, &SerialCommunication::curPointChanged);
+	connect(m_sequence, &Sequence::pointsChanged, this, &SerialCommunication::pointsChanged);
+	connect(m_sequence, &Sequence::numPointsChanged, this, &SerialCommunication::numPointsChanged);
+
+	// The worker asks for points as it needs them. It will start streaming as
+	// soon as Arduino has booted
+	QMetaObject::invokeMethod(m_worker, "startStream", workerConnection(), Q_ARG(int, m_sequence->pointDim()), Q_ARG(int, m_sequence->numPoints()), Q_ARG(int, std::max(0, m_sequence->curPoint())), Q_ARG(bool, m_oneShotSequence));
 
 	return true;
 }
@@ -184,6 +345,8 @@ bool SerialCommunication::pauseStream()
 
 	m_paused = true;
 
+	QMetaObject::invokeMethod(m_worker, "setPaused", workerConnection(), Q_ARG(bool, true));
+
 	emit isPausedChanged();
 
 	return true;
@@ -205,15 +368,15 @@ bool SerialCommunication::resumeStream()
 
 	emit isPausedChanged();
 
-	// Processing all received packets
-	processReceivedPackets();
+	// The worker processes all packets received while paused
+	QMetaObject::invokeMethod(m_worker, "setPaused", workerConnection(), Q_ARG(bool, false));
 
 	return true;
 }
 
 bool SerialCommunication::startImmediate(Sequence* sequence)
 {
-	if (!m_serialPort.isOpen()) {
+	if (!isConnected()) {
 		qDebug() << "SerialCommunication error: cannot start streaming with a closed serial port";
 		return false;
 	}
@@ -222,16 +385,15 @@ bool SerialCommunication::startImmediate(Sequence* sequence)
 		return false;
 	}
 
-	m_incomingData.clear();
-	m_indexToProcess = 0;
-
 	// Setting the m_is*Mode flags
-	m_stopping = false;
 	setIsStreamMode(false);
 	setIsImmediateMode(true);
 
-	// Saving the sequence
+	// Saving the sequence and resetting rate limiting
 	m_sequence = sequence;
+	m_immediateTimer.stop();
+	m_immediatePending = false;
+	setCoalescedUpdates(0);
 
 	// Emitting the signal telling that we started streaming
 	emit isStreamingChanged();
@@ -240,11 +402,9 @@ bool SerialCommunication::startImmediate(Sequence* sequence)
 	connect(m_sequence, &Sequence::curPointChanged, this, &SerialCommunication::curPointChanged);
 	connect(m_sequence, &Sequence::curPointValuesChanged, this, &SerialCommunication::curPointChanged);
 
-	// If the m_arduinoBoot timer is running, we have to wait, otherwise we explicitly call
-	// the arduinoBootFinished() function to send the current point of the sequence
-	if (!m_arduinoBoot.isActive()) {
-		arduinoBootFinished();
-	}
+	// The worker sends the current point of the sequence as soon as Arduino has booted
+	const QByteArray point = (m_sequence->curPoint() != -1) ? createSequencePacketForPoint(m_sequence->curPoint()) : QByteArray();
+	QMetaObject::invokeMethod(m_worker, "startImmediate", workerConnection(), Q_ARG(int, m_sequence->pointDim()), Q_ARG(QByteArray, point));
 
 	return true;
 }
@@ -256,11 +416,17 @@ bool SerialCommunication::stop()
 		return false;
 	}
 
-	// Setting the stopping flag
-	m_stopping = true;
+	// In immediate mode the last change could be waiting for the rate limit,
+	// sending it before stopping so that the robot reaches the last pose
+	if (isImmediateMode()) {
+		if (m_immediatePending) {
+			sendImmediatePoint();
+		}
+		m_immediateTimer.stop();
+	}
 
-	// Sending packet to stop streaming
-	sendData(QByteArray("H"));
+	// Telling the worker to send the packet to stop streaming
+	QMetaObject::invokeMethod(m_worker, "stop", workerConnection());
 
 	// If we are in immediate mode, we can end here, otherwise we must wait
 	// for the hardware to tell us that the sequence is finished
@@ -271,243 +437,347 @@ bool SerialCommunication::stop()
 	return true;
 }
 
-void SerialCommunication::handleReadyRead()
-{
-	// Getting data and adding to the buffer
-	m_incomingData.append(m_serialPort.readAll());
-
-	// Processing received data
-	processReceivedPackets();
-}
-
-void SerialCommunication::handleError(QSerialPort::SerialPortError error)
-{
-	if (error != QSerialPort::NoError) {
-		const QString errorString = "Error streaming: " + m_serialPort.errorString();
-		emit streamError(errorString);
-		qDebug() << errorString;
-
-//		QString errorString = "Error streaming, error code: ";
-
-//		switch (error) {
-//			case QSerialPort::DeviceNotFoundError:
-//				errorString += "DeviceNotFoundError (an error occurred while attempting to open an non-existing device)";
-//				break;
-//			case QSerialPort::PermissionError:
-//				errorString += "PermissionError (an error occurred while attempting to open an already opened device by another process or a user not having enough permission and credentials to open)";
-//				break;
-//			case QSerialPort::OpenError:
-//				errorString += "OpenError (an error occurred while attempting to open an already opened device in this object)";
-//				break;
-//			case QSerialPort::NotOpenError:
-//				errorString += "NotOpenError (this error occurs when an operation is executed that can only be successfully performed if the device is open)";
-//				break;
-//			case QSerialPort::ParityError:
-//				errorString += "ParityError (parity error detected by the hardware while reading data)";
-//				break;
-//			case QSerialPort::FramingError:
-//				errorString += "FramingError (framing error detected by the hardware while reading data)";
-//				break;
-//			case QSerialPort::BreakConditionError:
-//				errorString += "BreakConditionError (break condition detected by the hardware on the input line)";
-//				break;
-//			case QSerialPort::WriteError:
-//				errorString += "WriteError (an I/O error occurred while writing the data)";
-//				break;
-//			case QSerialPort::ReadError:
-//				errorString += "ReadError (an I/O error occurred while reading the data)";
-//				break;
-//			case QSerialPort::ResourceError:
-//				errorString += "ResourceError (an I/O error occurred when a resource becomes unavailable, e.g. when the device is unexpectedly removed from the system)";
-//				break;
-//			case QSerialPort::UnsupportedOperationError:
-//				errorString += "UnsupportedOperationError (the requested device operation is not supported or prohibited by the running operating system)";
-//				break;
-//			case QSerialPort::TimeoutError:
-//				errorString += "TimeoutError (a timeout error occurred)";
-//				break;
-//			case QSerialPort::UnknownError:
-//			default:
-//				errorString += "UnknownError (an unidentified error occurred)";
-//				break;
-//		}
-
-//		emit streamError(errorString);
-//		qDebug() << "Serial error." << errorString;
-	}
-}
-
-void SerialCommunication::arduinoBootFinished()
-{
-	// If we are streaming, sending data, otherwise doing nothing
-	if (isStreaming()) {
-		// First sending the start packet
-		QByteArray startPacket;
-		if (isStreamMode()) {
-			startPacket.append('S');
-		} else if (isImmediateMode()) {
-			startPacket.append('I');
+void SerialCommunication::curPointChanged()
+{
+	if (isImmediateMode()) {
+		if (m_immediateTimer.isActive()) {
+			// Too early, the point is sent when the interval elapses. If a
+			// change was already waiting, it will never be sent
+			if (m_immediatePending) {
+				setCoalescedUpdates(m_coalescedUpdates + 1);
+			}
+			m_immediatePending = true;
 		} else {
-			qFatal("Unknown mode, we should never get here");
+			sendImmediatePoint();
 		}
-		// Adding the number of dimension of point to the start packet
-		startPacket.append(m_sequence->pointDim() & 0xFF);
-		sendData(startPacket);
+	} else if (isStreamMode() && !m_followingStream) {
+		// The current point was changed externally, it is the next point to stream
+		QMetaObject::invokeMethod(m_worker, "setNextPoint", workerConnection(), Q_ARG(int, m_sequence->curPoint()));
+	}
+}
 
-		// Now sending the first sequence packet if present
-		if (m_sequence->curPoint() != -1) {
-			sendData(createSequencePacketForPoint(m_sequence->point()));
-		}
+void SerialCommunication::immediateIntervalElapsed()
+{
+	if (isImmediateMode() && m_immediatePending) {
+		sendImmediatePoint();
+	}
+}
+
+void SerialCommunication::pointsChanged(int first, int last)
+{
+	if (Q_UNLIKELY(!isStreamMode())) {
+		return;
+	}
+
+	// The worker only has a window of points. Longer ranges (e.g. grouped
+	// changes) make it drop the window instead of encoding points it does
+	// not have
+	if ((last - first) >= SerialWorker::pointWindow) {
+		QMetaObject::invokeMethod(m_worker, "resetPoints", workerConnection(), Q_ARG(int, m_sequence->numPoints()), Q_ARG(int, -1));
+		return;
+	}
+
+	for (int pos = first; pos <= last; ++pos) {
+		QMetaObject::invokeMethod(m_worker, "setPoint", workerConnection(), Q_ARG(int, pos), Q_ARG(QByteArray, createSequencePacketForPoint(pos)));
+	}
+}
+
+void SerialCommunication::numPointsChanged()
+{
+	if (Q_UNLIKELY(!isStreamMode())) {
+		return;
+	}
+
+	QMetaObject::invokeMethod(m_worker, "resetPoints", workerConnection(), Q_ARG(int, m_sequence->numPoints()), Q_ARG(int, std::max(0, m_sequence->curPoint())));
+}
+
+void SerialCommunication::workerPointsRequested(int first, int count, int generation)
+{
+	// The sequence could have changed since the request, in that case the
+	// worker ignores the answer because the generation is old
+	if (!isStreamMode() || (m_sequence->numPoints() == 0)) {
+		return;
+	}
+	const int numPoints = m_sequence->numPoints();
+
+	QVector<QByteArray> packets;
+	packets.reserve(count);
+	for (int i = 0; i < count; ++i) {
+		packets.append(createSequencePacketForPoint((first + i) % numPoints));
+	}
+
+	QMetaObject::invokeMethod(m_worker, "addPoints", workerConnection(), Q_ARG(QVector<QByteArray>, packets), Q_ARG(int, generation));
+}
+
+void SerialCommunication::workerStreamPositionChanged()
+{
+	// Taking the position even if we are no longer streaming, so that the worker
+	// notifies us again
+	const int position = m_worker->takeStreamPosition();
+
+	if (!isStreamMode()) {
+		return;
+	}
+
+	m_followingStream = true;
+	m_sequence->setCurPoint(position);
+	m_followingStream = false;
+}
+
+void SerialCommunication::workerStreamEnded()
+{
+	if (isStreamMode()) {
+		sequenceStreamEnded();
+	}
+}
+
+void SerialCommunication::workerBatteryChargeChanged(float charge)
+{
+	// The port could have been closed while the signal was queued
+	if (isConnected()) {
+		setBatteryCharge(charge);
+	}
+}
 
-		// If we are in stream mode, we have to move the current point forward
-		if (isStreamMode()) {
-			incrementCurPoint();
+void SerialCommunication::workerCorruptedFramesChanged(int count)
+{
+	// The port could have been closed or reopened while the signal was
+	// queued
+	if (isConnected() && (count != m_corruptedFrames)) {
+		m_corruptedFrames = count;
+
+		emit corruptedFramesChanged();
+	}
+}
+
+QString SerialCommunication::dumpPacketTrace()
+{
+	// The trace can be read while the worker records packets in another
+	// thread
+	QString trace;
+	QTextStream stream(&trace);
+	m_worker->packetTrace().dump(stream);
+	stream.flush();
+
+	return trace;
+}
+
+bool SerialCommunication::saveLatencyStatistics(QString filename) const
+{
+	QFile file(filename);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		qDebug() << "SerialCommunication error: cannot open" << filename;
+		return false;
+	}
+
+	QTextStream stream(&file);
+	stream << "histogram,bucket_min_us,bucket_max_us,count\n";
+	m_roundTripTimes.writeCsv(stream, "round_trip");
+	m_creditIntervals.writeCsv(stream, "credit_interval");
+	m_underrunDurations.writeCsv(stream, "underrun");
+	stream.flush();
+
+	return true;
+}
+
+void SerialCommunication::resetLatencyStatistics()
+{
+	QMetaObject::invokeMethod(m_worker, "resetLatencyStatistics", workerConnection());
+}
+
+void SerialCommunication::workerLatencyStatisticsChanged(LatencyHistogram roundTripTimes, LatencyHistogram creditIntervals, LatencyHistogram underrunDurations)
+{
+	// The port could have been closed while the signal was queued
+	if (isConnected()) {
+		m_roundTripTimes = roundTripTimes;
+		m_creditIntervals = creditIntervals;
+		m_underrunDurations = underrunDurations;
+
+		emit latencyStatisticsChanged();
+	}
+}
+
+QVariantList SerialCommunication::telemetry() const
+{
+	QVariantList samples;
+	for (unsigned int i = 0; i < m_telemetry.size(); ++i) {
+		samples.append(telemetryToMap(m_telemetry[i]));
+	}
+
+	return samples;
+}
+
+QVariantMap SerialCommunication::lastTelemetry() const
+{
+	if (m_telemetry.isEmpty()) {
+		return QVariantMap();
+	}
+
+	return telemetryToMap(m_telemetry[m_telemetry.size() - 1]);
+}
+
+bool SerialCommunication::saveTelemetry(QString filename) const
+{
+	QFile file(filename);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+		qDebug() << "SerialCommunication error: cannot open" << filename;
+		return false;
+	}
+
+	// The number of PWM columns is the largest number of servos in samples
+	int numChannels = 0;
+	for (unsigned int i = 0; i < m_telemetry.size(); ++i) {
+		numChannels = std::max(numChannels, m_telemetry[i].pwm.size());
+	}
+
+	QTextStream stream(&file);
+	stream << "time_ms,started_points,sequence_index,duration_ms,time_to_target_ms,phase,point_time_ms,tick_overruns,max_lateness_us,max_tick_us";
+	for (int c = 0; c < numChannels; ++c) {
+		stream << ",pwm" << c;
+	}
+	stream << "\n";
+	for (unsigned int i = 0; i < m_telemetry.size(); ++i) {
+		const TelemetrySample& sample = m_telemetry[i];
+		stream << sample.time << "," << sample.startedPoints << "," << sample.sequenceIndex << "," << sample.duration << "," << sample.timeToTarget << "," << int(sample.phase) << "," << sample.pointTime << "," << sample.tickOverruns << "," << sample.maxLateness << "," << sample.maxTickDuration;
+		for (int c = 0; c < numChannels; ++c) {
+			stream << ",";
+			if (c < sample.pwm.size()) {
+				stream << sample.pwm[c];
+			}
 		}
+		stream << "\n";
 	}
+	stream.flush();
+
+	return true;
 }
 
-void SerialCommunication::curPointChanged()
+void SerialCommunication::clearTelemetry()
 {
-	// Safety check that we are in immediate mode (this slot is only connected in immediate mode)
-	if (Q_UNLIKELY(!isImmediateMode())) {
-		qDebug() << "Received curPointChanged() signal but not in immediate mode";
+	m_telemetry.clear();
+}
 
+void SerialCommunication::workerTelemetryReceived(TelemetrySample sample)
+{
+	// The port could have been closed while the signal was queued
+	if (!isConnected()) {
 		return;
 	}
 
-	// Sending the current point if present
-	if (m_sequence->curPoint() != -1) {
-		sendData(createSequencePacketForPoint(m_sequence->point()));
+	// Discarding the oldest sample if the buffer is full
+	if (m_telemetry.isFull()) {
+		m_telemetry.pop();
+	}
+	m_telemetry.push(sample);
+
+	emit telemetryReceived();
+}
+
+void SerialCommunication::workerLinkBaudRateChanged(int baudRate)
+{
+	// The port could have been closed while the signal was queued
+	if (isConnected()) {
+		setLinkBaudRate(baudRate);
 	}
 }
 
-QByteArray SerialCommunication::createSequencePacketForPoint(const SequencePoint& p) const
+void SerialCommunication::workerStreamRateMeasured(float pointsPerSecond)
 {
-	QByteArray pkt(5 + p.point.size(), 0);
+	// The port could have been closed while the signal was queued
+	if (isConnected()) {
+		setPointsPerSecond(pointsPerSecond);
+	}
+}
+
+void SerialCommunication::workerBufferDepthReceived(int depth)
+{
+	// The port could have been closed while the signal was queued
+	if (isConnected()) {
+		setHardwareBufferDepth(depth);
+	}
+}
+
+QByteArray SerialCommunication::createSequencePacketForPoint(int pos) const
+{
+	const int pointDim = m_sequence->pointDim();
+	const int duration = m_sequence->pointDuration(pos);
+	const int timeToTarget = m_sequence->pointTimeToTarget(pos);
+
+	QByteArray pkt(5 + pointDim, 0);
 
 	// Packet type
 	pkt[0] = 'P';
 
 	// Point duration
-	pkt[1] = (p.duration >> 8) & 0xFF;
-	pkt[2] = p.duration & 0xFF;
+	pkt[1] = (duration >> 8) & 0xFF;
+	pkt[2] = duration & 0xFF;
 
 	// Point time to target
-	pkt[3] = (p.timeToTarget >> 8) & 0xFF;
-	pkt[4] = p.timeToTarget & 0xFF;
+	pkt[3] = (timeToTarget >> 8) & 0xFF;
+	pkt[4] = timeToTarget & 0xFF;
 
 	// Values
-	for (int c = 0; c < p.point.size(); ++c) {
-		pkt[5 + c] = static_cast<unsigned int>(p.point[c]) & 0xFF;
+	for (int c = 0; c < pointDim; ++c) {
+		pkt[5 + c] = static_cast<unsigned int>(m_sequence->pointCoordinate(pos, c)) & 0xFF;
 	}
 
 	return pkt;
 }
 
-void SerialCommunication::processReceivedPackets()
+void SerialCommunication::createWorker()
 {
-	// If we are not in pause, we can process all the packets, also old ones
-	if (!m_paused) {
-		m_indexToProcess = 0;
-	}
-
-	// If this is true, we only received part of a packet
-	bool partialPacket = false;
-	while ((m_indexToProcess < m_incomingData.size()) && (!partialPacket)) {
-		if ((m_incomingData[m_indexToProcess] == 'N') && isStreamMode()) {
-			if (m_paused || m_stopping) {
-				// Skipping this packet, we are paused or stopping
-				++m_indexToProcess;
-			} else {
-				qDebug() << "RECEIVED BUFFER NOT FULL";
-
-				// Buffer not full, we can send the current point in the sequence and move
-				// the current point forward
-				m_hardwareQueueFull = false;
-				if (m_sequence->curPoint() != -1) {
-					sendData(createSequencePacketForPoint(m_sequence->point()));
-				}
-				incrementCurPoint();
-
-				// Removing packet from buffer. The next index to process remains the current one
-				m_incomingData.remove(m_indexToProcess, 1);
-			}
-		} else if ((m_incomingData[m_indexToProcess] == 'F') && isStreamMode()) {
-			if (m_paused || m_stopping) {
-				// Skipping this packet, we are paused
-				++m_indexToProcess;
-			} else {
-				qDebug() << "RECEIVED BUFFER FULL";
-
-				// Buffer full
-				m_hardwareQueueFull = true;
-
-				// Removing packet from buffer. The next index to process remains the current one
-				m_incomingData.remove(m_indexToProcess, 1);
-			}
-		} else if (m_incomingData[m_indexToProcess] == 'E') {
-			if (m_paused) {
-				// Skipping this packet, we are paused
-				++m_indexToProcess;
-			} else {
-				qDebug() << "RECEIVED SEQUENCE ENDED";
-
-				// Calling the sequenceStreamEnded() function. This will also terminate the
-				// while cycle, because the m_incomingData buffer will be cleared
-				sequenceStreamEnded();
-			}
-		} else if (m_incomingData[m_indexToProcess] == 'D') {
-			// Debug packet, printing and emitting signal if the message is complete
-			if (m_incomingData.size() < (m_indexToProcess + 2)) {
-				partialPacket = true;
-			} else {
-				// Reading message length
-				int msgLength = static_cast<unsigned char>(m_incomingData[m_indexToProcess + 1]);
-
-				// Checking we have the whole message
-				if (m_incomingData.size() < (m_indexToProcess + 2 + msgLength)) {
-					partialPacket = true;
-				} else {
-					// We have the whole message, putting in a QString
-					const QString msg(m_incomingData.mid(m_indexToProcess + 2, msgLength));
-
-					// Emitting signal and printing
-					emit debugMessage(msg);
-					qDebug() << "Debug packet, content:" << msg;
-
-					// Removing packet from our buffer. The next index to process remains
-					// the current one
-					m_incomingData.remove(m_indexToProcess, 2 + msgLength);
-				}
-			}
-		} else if (m_incomingData[m_indexToProcess] == 'B') {
-			// Battery packet, checking that the packet is finished and updating the charge
-			if (m_incomingData.size() < (m_indexToProcess + 2)) {
-				partialPacket = true;
-			} else {
-				// Reading charge level
-				int chargeLevel = static_cast<unsigned char>(m_incomingData[m_indexToProcess + 1]);
-
-				// Setting the charge level
-				setBatteryCharge((float(chargeLevel) / 255.0) * 100.0);
-
-				// Removing packet from our buffer. The next index to process remains
-				// the current one
-				m_incomingData.remove(m_indexToProcess, 2);
-			}
-		} else {
-			if ((m_incomingData[m_indexToProcess] == 'N') || (m_incomingData[m_indexToProcess] == 'F')) {
-				qDebug() << "Received spurious N or F packet";
-			} else {
-				const QString errorString = QString("Received unknown or invalid packet type %1 (ascii %2)").arg(static_cast<unsigned int>(m_incomingData[m_indexToProcess])).arg(m_incomingData[m_indexToProcess]);
-				emit streamError(errorString);
-				qDebug() << errorString;
-			}
+	m_worker = new SerialWorker();
+	m_worker->packetTrace().setEnabled(m_packetTrace);
+	m_worker->setPingInterval(m_pingInterval);
+	m_worker->setTelemetryRate(m_telemetryRate);
+
+	if (m_useIOThread) {
+		m_worker->moveToThread(&m_ioThread);
+		m_ioThread.start();
+	}
+
+	// Connecting signals from the worker. When the worker is in another thread,
+	// these are queued connections
+	connect(m_worker, &SerialWorker::streamPositionChanged, this, &SerialCommunication::workerStreamPositionChanged);
+	// Always queued, so that the answer never reaches the worker while it is
+	// sending points
+	connect(m_worker, &SerialWorker::pointsRequested, this, &SerialCommunication::workerPointsRequested, Qt::QueuedConnection);
+	connect(m_worker, &SerialWorker::streamEnded, this, &SerialCommunication::workerStreamEnded);
+	connect(m_worker, &SerialWorker::streamError, this, &SerialCommunication::streamError);
+	connect(m_worker, &SerialWorker::debugMessage, this, &SerialCommunication::debugMessage);
+	connect(m_worker, &SerialWorker::batteryChargeChanged, this, &SerialCommunication::workerBatteryChargeChanged);
+	connect(m_worker, &SerialWorker::bufferDepthReceived, this, &SerialCommunication::workerBufferDepthReceived);
+	connect(m_worker, &SerialWorker::corruptedFramesChanged, this, &SerialCommunication::workerCorruptedFramesChanged);
+	connect(m_worker, &SerialWorker::linkBaudRateChanged, this, &SerialCommunication::workerLinkBaudRateChanged);
+	connect(m_worker, &SerialWorker::streamRateMeasured, this, &SerialCommunication::workerStreamRateMeasured);
+	connect(m_worker, &SerialWorker::latencyStatisticsChanged, this, &SerialCommunication::workerLatencyStatisticsChanged);
+	connect(m_worker, &SerialWorker::telemetryReceived, this, &SerialCommunication::workerTelemetryReceived);
+}
 
-			// Removing the unknown character. The next index to process remains the current one
-			m_incomingData.remove(m_indexToProcess, 1);
-		}
+void SerialCommunication::destroyWorker()
+{
+	// Closing the port in the thread of the worker whatever its state. stop()
+	// and closeSerial() can fail, for example if the stream has not ended yet
+	QMetaObject::invokeMethod(m_worker, "shutdown", workerConnection(true));
+
+	if (m_ioThread.isRunning()) {
+		m_ioThread.quit();
+		m_ioThread.wait();
 	}
+
+	// The port is closed at this point, so it is safe to delete the worker here
+	// even if it lived in the I/O thread
+	delete m_worker;
+	m_worker = nullptr;
+}
+
+Qt::ConnectionType SerialCommunication::workerConnection(bool blocking) const
+{
+	if (!m_ioThread.isRunning()) {
+		return Qt::DirectConnection;
+	}
+
+	return blocking ? Qt::BlockingQueuedConnection : Qt::QueuedConnection;
 }
 
 void SerialCommunication::sequenceStreamEnded()
@@ -523,84 +793,120 @@ void SerialCommunication::sequenceStreamEnded()
 
 	// Resetting flags
 	m_paused = false;
-	m_hardwareQueueFull = false;
-	m_stopping = false;
 	setIsStreamMode(false);
 	setIsImmediateMode(false);
+}
+
+void SerialCommunication::setIsStreamMode(bool v)
+{
+	if (v != m_isStreamMode) {
+		m_isStreamMode = v;
 
-	m_incomingData.clear();
-	m_indexToProcess = 0;
+		emit isStreamModeChanged();
+	}
 }
 
-void SerialCommunication::incrementCurPoint()
+void SerialCommunication::setIsImmediateMode(bool v)
 {
-	const int curPoint = m_sequence->curPoint();
+	if (v != m_isImmediateMode) {
+		m_isImmediateMode = v;
 
-	if (curPoint == (m_sequence->numPoints() - 1)) {
-		// We are at the last point, checking what to do
-		if (oneShotSequence()) {
-			// Stopping
-			stop();
-		} else {
-			// Restarting from the beginning
-			m_sequence->setCurPoint(0);
-		}
-	} else {
-		m_sequence->setCurPoint(curPoint + 1);
+		emit isImmediateModeChanged();
 	}
 }
 
-void SerialCommunication::sendData(const QByteArray& dataToSend)
+void SerialCommunication::setBatteryCharge(float v)
 {
-	if (dataToSend.isEmpty()) {
-		return;
+	if (v < 0.0) {
+		v = -1.0;
 	}
 
-	if (!dataToSend.isEmpty()) {
-		QString strData = QChar(dataToSend[0]);
-		for (int i = 1; i < dataToSend.size(); ++i) {
-			strData += " " + QString::number(dataToSend[i]);
-		}
-		qDebug() << "SENDING DATA: " << strData;
+	if (v != m_batteryCharge) {
+		m_batteryCharge = v;
+
+		emit batteryChargeChanged();
 	}
+}
 
-	// Writing data
-	qint64 bytesWritten = m_serialPort.write(dataToSend);
+void SerialCommunication::setHardwareBufferDepth(int depth)
+{
+	if (depth != m_hardwareBufferDepth) {
+		m_hardwareBufferDepth = depth;
 
-	if (bytesWritten == -1) {
-		qDebug() << "Error writing data";
-	} else if (bytesWritten != dataToSend.size()) {
-		qDebug() << "Cannot write all data";
+		emit hardwareBufferDepthChanged();
 	}
 }
 
-void SerialCommunication::setIsStreamMode(bool v)
+void SerialCommunication::sendImmediatePoint()
 {
-	if (v != m_isStreamMode) {
-		m_isStreamMode = v;
+	m_immediatePending = false;
 
-		emit isStreamModeChanged();
+	// Sending the current point if present
+	if (m_sequence->curPoint() != -1) {
+		QMetaObject::invokeMethod(m_worker, "sendPoint", workerConnection(), Q_ARG(QByteArray, createSequencePacketForPoint(m_sequence->curPoint())));
+	}
+
+	if (m_immediateRate > 0) {
+		m_immediateTimer.start(std::max(1, 1000 / m_immediateRate));
 	}
 }
 
-void SerialCommunication::setIsImmediateMode(bool v)
+void SerialCommunication::setCoalescedUpdates(int coalescedUpdates)
 {
-	if (v != m_isImmediateMode) {
-		m_isImmediateMode = v;
+	if (coalescedUpdates != m_coalescedUpdates) {
+		m_coalescedUpdates = coalescedUpdates;
 
-		emit isImmediateModeChanged();
+		emit coalescedUpdatesChanged();
 	}
 }
 
-void SerialCommunication::setBatteryCharge(float v)
+QVariantList SerialCommunication::histogramBuckets(const LatencyHistogram& histogram)
 {
-	if (v < 0.0) {
-		v = -1.0;
+	QVariantList buckets;
+	for (int i = 0; i < LatencyHistogram::numBuckets; ++i) {
+		buckets.append(histogram.bucketCount(i));
 	}
 
-	if (v != m_batteryCharge) {
-		m_batteryCharge = v;
+	return buckets;
+}
 
-		emit batteryChargeChanged();
+QVariantMap SerialCommunication::telemetryToMap(const TelemetrySample& sample)
+{
+	QVariantList pwm;
+	for (int v: sample.pwm) {
+		pwm.append(v);
+	}
+
+	QVariantMap map;
+	map["time"] = sample.time;
+	map["startedPoints"] = sample.startedPoints;
+	map["sequenceIndex"] = sample.sequenceIndex;
+	map["duration"] = sample.duration;
+	map["timeToTarget"] = sample.timeToTarget;
+	map["phase"] = int(sample.phase);
+	map["pointTime"] = sample.pointTime;
+	map["tickOverruns"] = sample.tickOverruns;
+	map["maxLateness"] = sample.maxLateness;
+	map["maxTickDuration"] = sample.maxTickDuration;
+	map["pwm"] = pwm;
+
+	return map;
+}
+
+void SerialCommunication::setLinkBaudRate(int baudRate)
+{
+	if (baudRate != m_linkBaudRate) {
+		m_linkBaudRate = baudRate;
+
+		emit linkBaudRateChanged();
+	}
+}
+
+void SerialCommunication::setPointsPerSecond(float pointsPerSecond)
+{
+	if (pointsPerSecond != m_pointsPerSecond) {
+		m_pointsPerSecond = pointsPerSecond;
+
+		emit pointsPerSecondChanged();
 	}
 }
@@ -22,12 +22,16 @@
 #ifndef SERIALCOMMUNICATION_H
 #define SERIALCOMMUNICATION_H
 
-#include <QSerialPort>
 #include <QByteArray>
+#include <QVector>
 #include <QObject>
+#include <QThread>
 #include <QTimer>
+#include <QVariantList>
+#include <QVariantMap>
 #include <memory>
 #include "sequence.h"
+#include "serialworker.h"
 
 /**
  * \brief The class handling the communication with Arduino through the serial
@@ -47,9 +51,15 @@
  * continuously (i.e. the sequnce is restarted from the beginning after the last
  * point is reached). The startImmediate() function starts the immediate
  * modality, which terminates when the stop() function is called. When in
- * immediate mode, this connects to the curPointChanged() signal of the stream,
- * thus sending a new command every time the current point in the sequence
- * changes.  In either cases the streamStopped() signal is emitted when points
+ * immediate mode, this connects to the curPointChanged() and
+ * curPointValuesChanged() signals of the stream, thus sending a new command
+ * every time the current point in the sequence or its values (coordinates,
+ * duration or time to target) change. Commands are rate limited: a change is
+ * sent at once if nothing was sent in the last 1/immediateRate seconds,
+ * otherwise the current point is sent when that time has elapsed, so changes
+ * in between are coalesced and only the latest pose is sent. The number of
+ * changes that were not sent is available through the coalescedUpdates
+ * property. In either cases the streamStopped() signal is emitted when points
  * are no longer streamed. When in one modality it is not possible to call a
  * function of the other modality (functions will return false). It is also an
  * error when functions of one modality are called before the modality is
@@ -59,16 +69,31 @@
  * following. The packets the PC may send to the hardware are the following
  * ones:
  *	- sequence packet
+ *	- delta sequence packet
  *	- start sequence
  *	- start immediate mode
  *	- stop
+ *	- link speed request
+ *	- link test
+ *	- link confirm
+ *	- ping
+ *	- telemetry rate
  *
  * The packes the hardware may send to the PC are the following ones:
+ *	- stream accepted
  *	- sequence buffer not full
  *	- sequence buffer full
+ *	- credits
+ *	- frame discarded
  *	- sequence finished
  *	- debug packet
  *	- battery charge packet
+ *	- link speed
+ *	- link test echo
+ *	- link confirmed
+ *	- ping echo
+ *	- underrun
+ *	- telemetry
  *
  * The "start sequence" and "start immediate mode" packets tell the hardware in
  * which modality it should work. The "start sequence" makes the hardware expect
@@ -79,7 +104,23 @@
  * full, to avoid delays in sequence timings. If the hardware sent a "sequence
  * buffer full" packet, it will send a "sequence buffer not full" packet as soon
  * as the buffer is no longer full (this "sequence buffer not full" packet can
- * be sent at any time, not only in response to a packet from the PC). To
+ * be sent at any time, not only in response to a packet from the PC). This
+ * costs a full round trip for each point, so the hardware can instead use
+ * windowed flow control if the PC sent a "protocol version" packet with
+ * version 1 or later before the "start sequence" packet (older firmware
+ * ignores it, older PCs don't send it and keep getting "sequence buffer (not)
+ * full" packets): in response to the "start sequence" packet the hardware sends a
+ * "stream accepted" packet with the number of points its buffer can hold (this
+ * is the maximum number of points the PC can have in flight and is available
+ * through the hardwareBufferDepth property), then a
+ * "credits" packet with the number of free slots in its buffer (not counting
+ * the first sequence packet, that the PC always sends right after the "start
+ * sequence" packet), and then it sends a new "credits" packet each time slots
+ * that were not already granted become free. Each credit allows the PC to send
+ * one sequence packet, so the buffer is kept full even with points whose
+ * duration is shorter than the round trip. Hardware using credits never sends
+ * "sequence buffer (not) full" packets, while for hardware not using them a
+ * "sequence buffer not full" packet is equivalent to a single credit. To
  * terminate sequence execution the PC sends a "stop" packet. The hardware then
  * answers with a "sequence finished" packet as soon as the last point is
  * reached and kept for its whose duration. The "start immediate mode" packet
@@ -90,6 +131,106 @@
  * immediate mode, the PC sends a "stop" packet. Packets sent before either
  * "start sequence" or "start immediate mode" are discarded.
  *
+ * Sequence packets carry all positions of a point. In stream mode, once the
+ * hardware has sent the "stream accepted" packet (older firmware does not
+ * send it and does not understand delta packets), points are sent as "delta
+ * sequence" packets, carrying only the positions that differ from those of the
+ * point sent just before, unless the full packet is shorter. The hardware
+ * takes the other positions from the last point it received. Delta packets
+ * are computed when points are sent, so they are always relative to the
+ * previous point on the wire, even when the stream jumps to another point or
+ * restarts from the beginning.
+ *
+ * If the framedProtocol property is true, packets in both
+ * directions are sent inside frames, so that bytes lost or corrupted on the
+ * line are detected instead of being decoded as garbage. A frame is the sync
+ * byte 0x7E, the length of the payload (1 byte), the payload (one packet) and
+ * the CRC-8 (polynomial 0x07, initial value 0) of length and payload. Inside a
+ * frame, the bytes 0x7E and 0x7D are sent as 0x7D followed by the byte xor
+ * 0x20, so a sync byte always starts a frame and the receiver resynchronizes
+ * at the next frame. Frames that are truncated or have a wrong length or CRC
+ * are discarded and counted. The hardware switches to framed mode when it
+ * receives the first frame. When it discards a frame it sends a "frame
+ * discarded" packet and gives back the credit of the lost point. It then
+ * discards delta sequence packets until a full sequence packet arrives, so
+ * the next point we send after a "frame discarded" packet is a full sequence
+ * packet. The corruptedFrames property counts both the frames we discarded
+ * and those the hardware discarded. Bytes received between frames mean that
+ * the sync byte of a frame was lost, they are treated as a corrupted frame.
+ * Lost points are skipped. A lost "credits" packet would stall the stream:
+ * if we have had no credits for half a second the PC sends a "credit resync"
+ * packet and the hardware answers with the absolute number of credits we have
+ * (all its free slots, since we have no points in flight). Credit packets
+ * received while waiting for the answer are ignored, and the request is
+ * repeated until the stream can go on. A lost "stop" or "sequence finished"
+ * packet is not recovered. Older firmware only knows unframed packets.
+ *
+ * The hardware starts at the baudRate property (115200 by default). After it
+ * has booted and before anything else is sent, if the maxBaudRate property
+ * is greater, the PC sends a "link speed request" packet with the fastest
+ * supported speed not above maxBaudRate. The hardware answers with a "link
+ * speed" packet containing the speed it agrees to (the requested one or its
+ * own maximum), then both sides switch to it. The PC sends a "link test"
+ * packet at the new rate and the hardware echoes it. If the echo is correct
+ * the PC sends a "link confirm" packet, which the hardware answers with a
+ * "link confirmed" packet; the confirm packet is sent up to three times if
+ * the answer is missing. When the answer arrives the new rate is kept and is
+ * available through the linkBaudRate property. If the echo is wrong or
+ * missing or no confirm packet is answered, the PC goes back to the starting
+ * rate; the hardware does the same if it receives no confirm packet within
+ * one second from the switch, so the PC waits for it before sending other
+ * packets. The link is only lost if the hardware receives a confirm packet
+ * but all its answers are lost. Older firmware
+ * does not answer the request and the link stays at the starting rate. At the
+ * end of each stream the pointsPerSecond property is set to the rate at which
+ * points were streamed, the figure of merit for link speed and protocol
+ * changes.
+ *
+ * To tune the buffer depth and the baud rate, latencies are collected in
+ * histograms (see LatencyHistogram), exposed as lists of bucket counts and
+ * saved as CSV by saveLatencyStatistics(). If the pingInterval property is
+ * not 0, a "ping" packet with a timestamp is sent periodically in any
+ * modality; the hardware echoes the timestamp together with its own clock
+ * and the round trip time is recorded. In stream mode the time between
+ * consecutive "credits" (or "sequence buffer not full") packets is recorded,
+ * which is the time the hardware takes to play points. When the buffer of
+ * the hardware runs empty in stream mode (an underrun: a point ended before
+ * the next one arrived), the hardware sends an "underrun" packet with its
+ * duration as soon as the next point arrives. Pings are disabled by default
+ * because older firmware does not understand them. In stream mode a lost
+ * ping frame is taken by the hardware as a lost point, giving back one
+ * credit more than needed, so pings should not be too frequent on noisy
+ * lines.
+ *
+ * To check that the timing of the robot matches the timing of the sequence,
+ * set the telemetryRate property: the PC sends a "telemetry rate" packet and
+ * the hardware periodically sends "telemetry" packets in any modality, with
+ * the number of the point being played, its phase (moving or holding), the
+ * time since it started, timing statistics of the control loop and the PWM of
+ * each servo. In stream mode the number of the point is mapped to the index in
+ * the sequence and the authored timing of the point is added (see
+ * TelemetrySample). The last samples are kept in a ring buffer for live
+ * plotting, see telemetry() and saveTelemetry(). Telemetry is disabled by
+ * default because older firmware does not understand the request. Telemetry
+ * packets take link bandwidth: at low baud rates high telemetry rates can
+ * cause underruns.
+ *
+ * The actual I/O is performed by a SerialWorker object. If the useIOThread
+ * property is true, the worker lives in a dedicated thread, so that reading,
+ * parsing and answering packets from the hardware is not delayed when the GUI
+ * thread is busy (e.g. rendering QML). In stream mode the worker asks for the
+ * next points a window at a time, so only those points are converted to
+ * sequence packets. Changes to single points are forwarded to it, while larger
+ * changes or points added or removed make it drop the window and ask again. The
+ * current point of the sequence is updated when the worker notifies that the
+ * stream moved forward (notifications are coalesced, so the current point can
+ * skip some points when the GUI thread is slow). The useIOThread property can
+ * only be changed when the serial port is closed.
+ *
+ * Packets are not logged. For debugging, set the packetTrace property to
+ * true: sent and received packets are then stored in binary form in a
+ * PacketTrace, which is formatted only when dumpPacketTrace() is called.
+ *
  * The debug packet is used by the hardware for debugging purpouse. It contains
  * a string of maximum length 255 bytes which is simply displayed (no other
  * action is performed). The battery charge packet is used to communicate the
@@ -103,9 +244,21 @@
  * significant byte first) - positions (numElements bytes, one byte per point
  * dimension)
  *
+ * "delta sequence packet" (changedMask has bit i set if the position of
+ * element i is in the packet, numElements must not be greater than 16)
+ * the character 'U' (1 byte) - step duration (2 bytes, milliseconds, most
+ * significant byte first) - step time to target (2 bytes, milliseconds, most
+ * significant byte first) - changedMask (2 bytes, most significant byte
+ * first) - positions (one byte for each bit set in changedMask, in order of
+ * increasing element index)
+ *
  * "start sequence" (numElements is the dimension of each point of the sequence)
  * the character 'S' (1 byte) - numElements (1 byte)
  *
+ * "protocol version" (version is 1 if the PC knows the "stream accepted",
+ * "credits", "credit resync answer", "delta sequence" and "underrun" packets)
+ * the character 'Q' (1 byte) - version (1 byte)
+ *
  * "start immediate mode" (numElements is the dimension of each point of the
  * sequence)
  * the character 'I' (1 byte) - numElements (1 byte)
@@ -113,12 +266,30 @@
  * "stop"
  * the character 'H' (1 byte)
  *
+ * "stream accepted" (bufferDepth is the number of sequence packets the
+ * hardware can buffer)
+ * the character 'A' (1 byte) - bufferDepth (1 byte)
+ *
  * "sequence buffer not full"
  * the character 'N' (1 byte)
  *
  * "sequence buffer full"
  * the character 'F' (1 byte)
  *
+ * "credits" (newCredits is the number of additional sequence packets the
+ * hardware can accept)
+ * the character 'C' (1 byte) - newCredits (1 byte)
+ *
+ * "credit resync"
+ * the character 'R' (1 byte)
+ *
+ * "credit resync answer" (credits is the absolute number of sequence packets
+ * the hardware can accept)
+ * the character 'G' (1 byte) - credits (1 byte)
+ *
+ * "frame discarded" (only sent in framed mode)
+ * the character 'K' (1 byte)
+ *
  * "sequence finished"
  * the characted 'E' (1 byte)
  *
@@ -129,6 +300,48 @@
  * "battery charge packet" (battery charge is 0 to indicate depleted battery,
  * 255 for fully charged batteries)
  * the character 'B' (1 byte) - battery charge (1 byte)
+ *
+ * "link speed request" and "link speed" (speed is 0 for 115200, 1 for
+ * 250000, 2 for 500000 and 3 for 1000000 baud)
+ * the character 'L' (1 byte) - speed (1 byte)
+ *
+ * "link test" and "link test echo" (the test pattern is 0x55 0xAA 0x00 0xFF
+ * 0x7E 0x7D 0x0F 0xF0)
+ * the character 'T' (1 byte) - test pattern (8 bytes)
+ *
+ * "link confirm" and "link confirmed"
+ * the character 'V' (1 byte)
+ *
+ * "ping" (timestamp is opaque for the hardware, we use microseconds)
+ * the character 'Y' (1 byte) - timestamp (4 bytes, most significant byte
+ * first)
+ *
+ * "ping echo" (hardwareTime is the value of micros() on the hardware when
+ * the echo is sent)
+ * the character 'Y' (1 byte) - timestamp of the ping (4 bytes, most
+ * significant byte first) - hardwareTime (4 bytes, most significant byte
+ * first)
+ *
+ * "underrun" (duration is in milliseconds, at most 65535)
+ * the character 'W' (1 byte) - duration (2 bytes, most significant byte
+ * first)
+ *
+ * "telemetry rate" (rate is the number of telemetry packets per second, 0 to
+ * stop them. The hardware can send less packets than requested)
+ * the character 'M' (1 byte) - rate (1 byte)
+ *
+ * "telemetry" (startedPoints is the number of points started since the
+ * stream started, phase is 0 if no point is being played, 1 if servos are
+ * moving and 2 if they are holding the position, pointTime is the time since
+ * the point started in milliseconds, tickOverruns the number of control ticks
+ * that ended late and maxLateness the maximum lateness of point starts in
+ * microseconds since the stream started, maxTickDuration the longest control
+ * tick since the previous telemetry packet in microseconds. All 16 bits
+ * values are sent most significant byte first and saturate at 65535)
+ * the character 'M' (1 byte) - startedPoints (2 bytes, lower 16 bits) -
+ * phase (1 byte) - pointTime (2 bytes) - tickOverruns (2 bytes) -
+ * maxLateness (2 bytes) - maxTickDuration (2 bytes) - numChannels (1 byte) -
+ * PWM of each servo (numChannels values of 2 bytes)
  */
 class SerialCommunication : public QObject
 {
@@ -142,6 +355,33 @@ class SerialCommunication : public QObject
 	Q_PROPERTY(bool isImmediateMode READ isImmediateMode NOTIFY isImmediateModeChanged)
 	Q_PROPERTY(bool isPaused READ isPaused NOTIFY isPausedChanged)
 	Q_PROPERTY(float batteryCharge READ batteryCharge NOTIFY batteryChargeChanged)
+	Q_PROPERTY(int hardwareBufferDepth READ hardwareBufferDepth NOTIFY hardwareBufferDepthChanged)
+	Q_PROPERTY(bool useIOThread READ useIOThread WRITE setUseIOThread NOTIFY useIOThreadChanged)
+	Q_PROPERTY(bool framedProtocol READ framedProtocol WRITE setFramedProtocol NOTIFY framedProtocolChanged)
+	Q_PROPERTY(int corruptedFrames READ corruptedFrames NOTIFY corruptedFramesChanged)
+	Q_PROPERTY(int maxBaudRate READ maxBaudRate WRITE setMaxBaudRate NOTIFY maxBaudRateChanged)
+	Q_PROPERTY(int linkBaudRate READ linkBaudRate NOTIFY linkBaudRateChanged)
+	Q_PROPERTY(float pointsPerSecond READ pointsPerSecond NOTIFY pointsPerSecondChanged)
+	Q_PROPERTY(bool packetTrace READ packetTrace WRITE setPacketTrace NOTIFY packetTraceChanged)
+	Q_PROPERTY(int immediateRate READ immediateRate WRITE setImmediateRate NOTIFY immediateRateChanged)
+	Q_PROPERTY(int coalescedUpdates READ coalescedUpdates NOTIFY coalescedUpdatesChanged)
+	Q_PROPERTY(int pingInterval READ pingInterval WRITE setPingInterval NOTIFY pingIntervalChanged)
+	Q_PROPERTY(QVariantList roundTripTimeHistogram READ roundTripTimeHistogram NOTIFY latencyStatisticsChanged)
+	Q_PROPERTY(QVariantList creditIntervalHistogram READ creditIntervalHistogram NOTIFY latencyStatisticsChanged)
+	Q_PROPERTY(QVariantList underrunHistogram READ underrunHistogram NOTIFY latencyStatisticsChanged)
+	Q_PROPERTY(float meanRoundTripTime READ meanRoundTripTime NOTIFY latencyStatisticsChanged)
+	Q_PROPERTY(float maxRoundTripTime READ maxRoundTripTime NOTIFY latencyStatisticsChanged)
+	Q_PROPERTY(int underruns READ underruns NOTIFY latencyStatisticsChanged)
+	Q_PROPERTY(int telemetryRate READ telemetryRate WRITE setTelemetryRate NOTIFY telemetryRateChanged)
+
+public:
+	/**
+	 * \brief The maximum number of telemetry samples kept
+	 *
+	 * This is almost a minute and a half of samples at 50 packets per
+	 * second, the maximum rate of the firmware
+	 */
+	static const unsigned int telemetryCapacity = 4096;
 
 public:
 	/**
@@ -233,6 +473,268 @@ public:
 	 */
 	void setOneShotSequence(bool oneShot);
 
+	/**
+	 * \brief Returns true if serial I/O is performed in a dedicated thread
+	 *
+	 * \return true if serial I/O is performed in a dedicated thread
+	 */
+	bool useIOThread() const
+	{
+		return m_useIOThread;
+	}
+
+	/**
+	 * \brief Sets whether serial I/O is performed in a dedicated thread
+	 *
+	 * This does nothing if the serial port is open
+	 * \param useIOThread if true serial I/O is performed in a dedicated
+	 *                    thread, otherwise in the thread of this object
+	 */
+	void setUseIOThread(bool useIOThread);
+
+	/**
+	 * \brief Returns true if packets are sent and received inside frames
+	 *
+	 * \return true if packets are sent and received inside frames
+	 */
+	bool framedProtocol() const
+	{
+		return m_framedProtocol;
+	}
+
+	/**
+	 * \brief Sets whether packets are sent and received inside frames
+	 *
+	 * This does nothing if the serial port is open. This is false by
+	 * default because older firmware does not support frames
+	 * \param framedProtocol if true packets are sent and received inside
+	 *                       frames
+	 */
+	void setFramedProtocol(bool framedProtocol);
+
+	/**
+	 * \brief Returns the number of corrupted frames since the port was
+	 *        opened
+	 *
+	 * This counts both the frames we received and discarded and those the
+	 * hardware told us it discarded
+	 * \return the number of corrupted frames
+	 */
+	int corruptedFrames() const
+	{
+		return m_corruptedFrames;
+	}
+
+	/**
+	 * \brief Returns the maximum baud rate to negotiate with the hardware
+	 *
+	 * \return the maximum baud rate to negotiate
+	 */
+	int maxBaudRate() const
+	{
+		return m_maxBaudRate;
+	}
+
+	/**
+	 * \brief Sets the maximum baud rate to negotiate with the hardware
+	 *
+	 * This does nothing if the serial port is open. Set to the value of the
+	 * baudRate property to disable negotiation
+	 * \param maxBaudRate the maximum baud rate to negotiate
+	 */
+	void setMaxBaudRate(int maxBaudRate);
+
+	/**
+	 * \brief Returns the current baud rate of the link
+	 *
+	 * This is the value of the baudRate property until a faster rate has
+	 * been negotiated and verified, 0 if the port is closed
+	 * \return the current baud rate of the link
+	 */
+	int linkBaudRate() const
+	{
+		return m_linkBaudRate;
+	}
+
+	/**
+	 * \brief Returns the number of points per second streamed in the last
+	 *        stream
+	 *
+	 * This is measured from the start of the stream to the "sequence
+	 * finished" packet. It is 0 if no stream has finished since the port
+	 * was opened
+	 * \return the number of points per second of the last stream
+	 */
+	float pointsPerSecond() const
+	{
+		return m_pointsPerSecond;
+	}
+
+	/**
+	 * \brief Returns true if packets exchanged with the hardware are traced
+	 *
+	 * \return true if packets are traced
+	 */
+	bool packetTrace() const
+	{
+		return m_packetTrace;
+	}
+
+	/**
+	 * \brief Enables or disables the trace of packets exchanged with the
+	 *        hardware
+	 *
+	 * This can be changed at any time
+	 * \param packetTrace if true packets are traced
+	 */
+	void setPacketTrace(bool packetTrace);
+
+	/**
+	 * \brief Returns the maximum number of points per second sent in
+	 *        immediate mode
+	 *
+	 * \return the maximum number of points per second sent in immediate
+	 *         mode, 0 if there is no limit
+	 */
+	int immediateRate() const
+	{
+		return m_immediateRate;
+	}
+
+	/**
+	 * \brief Sets the maximum number of points per second sent in
+	 *        immediate mode
+	 *
+	 * This can be changed at any time, the new rate is used from the next
+	 * point sent
+	 * \param immediateRate the maximum number of points per second, 0 to
+	 *                      send every change immediately. Negative values
+	 *                      are ignored
+	 */
+	void setImmediateRate(int immediateRate);
+
+	/**
+	 * \brief Returns the number of changes of the current point that were
+	 *        not sent because a newer one replaced them
+	 *
+	 * This is reset when immediate mode starts
+	 * \return the number of coalesced changes
+	 */
+	int coalescedUpdates() const
+	{
+		return m_coalescedUpdates;
+	}
+
+	/**
+	 * \brief Returns the interval between ping packets
+	 *
+	 * \return the interval between ping packets in milliseconds, 0 if pings
+	 *         are not sent
+	 */
+	int pingInterval() const
+	{
+		return m_pingInterval;
+	}
+
+	/**
+	 * \brief Sets the interval between ping packets
+	 *
+	 * This can be changed at any time. Only enable pings with firmware
+	 * supporting them
+	 * \param pingInterval the interval between ping packets in
+	 *                     milliseconds, 0 to not send pings. Negative values
+	 *                     are ignored
+	 */
+	void setPingInterval(int pingInterval);
+
+	/**
+	 * \brief Returns the number of telemetry packets per second the hardware
+	 *        sends
+	 *
+	 * \return the number of telemetry packets per second, 0 if telemetry is
+	 *         disabled
+	 */
+	int telemetryRate() const
+	{
+		return m_telemetryRate;
+	}
+
+	/**
+	 * \brief Sets the number of telemetry packets per second the hardware
+	 *        sends
+	 *
+	 * This can be changed at any time. Only enable telemetry with firmware
+	 * supporting it. The hardware limits the rate to what it can sustain
+	 * \param telemetryRate the number of telemetry packets per second, 0 to
+	 *                      disable telemetry. Values outside 0 - 255 are
+	 *                      ignored
+	 */
+	void setTelemetryRate(int telemetryRate);
+
+	/**
+	 * \brief Returns the histogram of round trip times of ping packets
+	 *
+	 * \return the number of round trip times in each bucket of a
+	 *         LatencyHistogram
+	 */
+	QVariantList roundTripTimeHistogram() const
+	{
+		return histogramBuckets(m_roundTripTimes);
+	}
+
+	/**
+	 * \brief Returns the histogram of times between credit packets in
+	 *        stream mode
+	 *
+	 * \return the number of times in each bucket of a LatencyHistogram
+	 */
+	QVariantList creditIntervalHistogram() const
+	{
+		return histogramBuckets(m_creditIntervals);
+	}
+
+	/**
+	 * \brief Returns the histogram of durations of underruns in stream mode
+	 *
+	 * \return the number of durations in each bucket of a LatencyHistogram
+	 */
+	QVariantList underrunHistogram() const
+	{
+		return histogramBuckets(m_underrunDurations);
+	}
+
+	/**
+	 * \brief Returns the mean round trip time of ping packets
+	 *
+	 * \return the mean round trip time in milliseconds, 0 if no ping echo
+	 *         was received
+	 */
+	float meanRoundTripTime() const
+	{
+		return m_roundTripTimes.mean() / 1000.0;
+	}
+
+	/**
+	 * \brief Returns the maximum round trip time of ping packets
+	 *
+	 * \return the maximum round trip time in milliseconds, 0 if no ping
+	 *         echo was received
+	 */
+	float maxRoundTripTime() const
+	{
+		return m_roundTripTimes.max() / 1000.0;
+	}
+
+	/**
+	 * \brief Returns the number of underruns reported by the hardware
+	 *
+	 * \return the number of underruns
+	 */
+	int underruns() const
+	{
+		return m_underrunDurations.count();
+	}
+
 	/**
 	 * \brief Opens the serial port
 	 *
@@ -251,6 +753,16 @@ public:
 	 */
 	Q_INVOKABLE bool closeSerial();
 
+	/**
+	 * \brief Ends any stream without waiting for the hardware and closes
+	 *        the serial port
+	 *
+	 * Use this when the hardware does not answer, e.g. if the "sequence
+	 * finished" packet does not arrive after stop(). The hardware is not
+	 * notified. If the port is already closed, this does nothing
+	 */
+	Q_INVOKABLE void abortSerial();
+
 	/**
 	 * \brief Starts streaming the sequence
 	 *
@@ -302,6 +814,71 @@ public:
 	 */
 	Q_INVOKABLE bool stop();
 
+	/**
+	 * \brief Returns the packets traced since the last call and removes
+	 *        them from the trace
+	 *
+	 * See PacketTrace::dump() for the format. The trace is lost when the
+	 * useIOThread property changes
+	 * \return the traced packets, one per line
+	 */
+	Q_INVOKABLE QString dumpPacketTrace();
+
+	/**
+	 * \brief Saves the latency histograms to a CSV file
+	 *
+	 * The file has the columns histogram (round_trip, credit_interval or
+	 * underrun), bucket_min_us, bucket_max_us (empty for the last bucket)
+	 * and count. Histograms are those last published by the worker (at most
+	 * half a second old)
+	 * \param filename the name of the file to write
+	 * \return false in case of error
+	 */
+	Q_INVOKABLE bool saveLatencyStatistics(QString filename) const;
+
+	/**
+	 * \brief Clears the latency histograms
+	 *
+	 * This is also done when the port is opened
+	 */
+	Q_INVOKABLE void resetLatencyStatistics();
+
+	/**
+	 * \brief Returns the telemetry samples received most recently
+	 *
+	 * At most telemetryCapacity samples are kept, older samples are
+	 * discarded. Samples are cleared when the port is opened
+	 * \return the samples, from the oldest to the newest, as maps with the
+	 *         same keys as lastTelemetry()
+	 */
+	Q_INVOKABLE QVariantList telemetry() const;
+
+	/**
+	 * \brief Returns the last telemetry sample received
+	 *
+	 * The keys of the map are the names of the fields of TelemetrySample
+	 * (pwm is a list of integers)
+	 * \return the last sample, an empty map if no sample was received
+	 */
+	Q_INVOKABLE QVariantMap lastTelemetry() const;
+
+	/**
+	 * \brief Saves the telemetry samples to a CSV file
+	 *
+	 * The file has one row per sample with the columns time_ms,
+	 * started_points, sequence_index, duration_ms, time_to_target_ms, phase,
+	 * point_time_ms, tick_overruns, max_lateness_us, max_tick_us and one
+	 * column pwm<i> per servo
+	 * \param filename the name of the file to write
+	 * \return false in case of error
+	 */
+	Q_INVOKABLE bool saveTelemetry(QString filename) const;
+
+	/**
+	 * \brief Removes all telemetry samples
+	 */
+	Q_INVOKABLE void clearTelemetry();
+
 	/**
 	 * \brief Return true if the serial port is open
 	 *
@@ -309,7 +886,7 @@ public:
 	 */
 	bool isConnected() const
 	{
-		return m_serialPort.isOpen();
+		return m_isConnected;
 	}
 
 	/**
@@ -366,6 +943,19 @@ public:
 		return m_batteryCharge;
 	}
 
+	/**
+	 * \brief Returns the number of points the hardware can buffer
+	 *
+	 * This is sent by the hardware when a stream starts. It is 0 if the
+	 * hardware has not sent it (older firmware or no stream started since
+	 * the port was opened)
+	 * \return the number of points the hardware can buffer
+	 */
+	int hardwareBufferDepth() const
+	{
+		return m_hardwareBufferDepth;
+	}
+
 signals:
 	/**
 	 * \brief The signal emitted when the serial port name changes
@@ -428,82 +1018,239 @@ signals:
 	 */
 	void batteryChargeChanged();
 
-private slots:
 	/**
-	 * \brief The slot called when there is data ready to be read
+	 * \brief The signal emitted when the number of points the hardware can
+	 *        buffer changes
 	 */
-	void handleReadyRead();
+	void hardwareBufferDepthChanged();
 
 	/**
-	 * \brief The function called when there is an error in the serial
-	 *        communication
-	 *
-	 * \param error the error code
+	 * \brief The signal emitted when the useIOThread property changes
+	 */
+	void useIOThreadChanged();
+
+	/**
+	 * \brief The signal emitted when the framedProtocol property changes
+	 */
+	void framedProtocolChanged();
+
+	/**
+	 * \brief The signal emitted when the number of corrupted frames changes
+	 */
+	void corruptedFramesChanged();
+
+	/**
+	 * \brief The signal emitted when the maxBaudRate property changes
 	 */
-	void handleError(QSerialPort::SerialPortError error);
+	void maxBaudRateChanged();
 
 	/**
-	 * \brief The slot called a second after the serial port is opened to
-	 *        start sending data
+	 * \brief The signal emitted when the baud rate of the link changes
+	 */
+	void linkBaudRateChanged();
+
+	/**
+	 * \brief The signal emitted when the pointsPerSecond property changes
+	 */
+	void pointsPerSecondChanged();
+
+	/**
+	 * \brief The signal emitted when the packetTrace property changes
+	 */
+	void packetTraceChanged();
+
+	/**
+	 * \brief The signal emitted when the immediateRate property changes
+	 */
+	void immediateRateChanged();
+
+	/**
+	 * \brief The signal emitted when the number of coalesced changes
+	 *        changes
+	 */
+	void coalescedUpdatesChanged();
+
+	/**
+	 * \brief The signal emitted when the pingInterval property changes
+	 */
+	void pingIntervalChanged();
+
+	/**
+	 * \brief The signal emitted when the latency histograms change
+	 */
+	void latencyStatisticsChanged();
+
+	/**
+	 * \brief The signal emitted when the telemetryRate property changes
+	 */
+	void telemetryRateChanged();
+
+	/**
+	 * \brief The signal emitted when a telemetry sample is received
 	 *
-	 * This is needed to give Arduino time to boot. This function is also
-	 * called if a sequence is started after arduino has booted. Basically
-	 * this function automatically sends data if called from the timer and
-	 * streaming has already been requested. If called from the timer but
-	 * streaming hasn't been requested yet, it does nothing. When streaming
-	 * is requested, this function is called by either startStream() or
-	 * startImmediate() and starts sending data.
+	 * The sample is available through lastTelemetry()
 	 */
-	void arduinoBootFinished();
+	void telemetryReceived();
 
+private slots:
 	/**
 	 * \brief The slot called when the current point in the sequence changes
 	 *
-	 * This is connected to both the curPointChanged() and the
-	 * curPointValuesChanged() signals of the sequence
+	 * In immediate mode this is connected to both the curPointChanged() and
+	 * the curPointValuesChanged() signals of the sequence and sends the
+	 * current point, subject to rate limiting. In stream mode this is connected to the
+	 * curPointChanged() signal and tells the worker which is the next point
+	 * to stream
 	 */
 	void curPointChanged();
 
+	/**
+	 * \brief The slot called when the minimum interval between points sent
+	 *        in immediate mode has elapsed
+	 *
+	 * If the current point changed meanwhile, it is sent now
+	 */
+	void immediateIntervalElapsed();
+
+	/**
+	 * \brief The slot called in stream mode when points of the sequence
+	 *        change
+	 *
+	 * \param first the position in the sequence of the first point that
+	 *              changed
+	 * \param last the position in the sequence of the last point that
+	 *             changed
+	 */
+	void pointsChanged(int first, int last);
+
+	/**
+	 * \brief The slot called in stream mode when the number of points in
+	 *        the sequence changes
+	 */
+	void numPointsChanged();
+
+	/**
+	 * \brief The slot called when the worker has streamed points
+	 *
+	 * This updates the current point of the sequence
+	 */
+	void workerStreamPositionChanged();
+
+	/**
+	 * \brief The slot called when the worker asks for the next points to
+	 *        stream
+	 *
+	 * \param first the index of the first point
+	 * \param count the number of points. Indices wrap at the end of the
+	 *              sequence
+	 * \param generation the generation to pass back to the worker
+	 */
+	void workerPointsRequested(int first, int count, int generation);
+
+	/**
+	 * \brief The slot called when the worker has finished streaming
+	 */
+	void workerStreamEnded();
+
+	/**
+	 * \brief The slot called when the battery charge read by the worker
+	 *        changes
+	 *
+	 * \param charge the battery charge in percentage or -1 if unknown
+	 */
+	void workerBatteryChargeChanged(float charge);
+
+	/**
+	 * \brief The slot called when the worker receives the number of points
+	 *        the hardware can buffer
+	 *
+	 * \param depth the number of points the hardware can buffer
+	 */
+	void workerBufferDepthReceived(int depth);
+
+	/**
+	 * \brief The slot called when the number of corrupted frames counted
+	 *        by the worker changes
+	 *
+	 * \param count the number of corrupted frames
+	 */
+	void workerCorruptedFramesChanged(int count);
+
+	/**
+	 * \brief The slot called when the worker has negotiated a faster baud
+	 *        rate
+	 *
+	 * \param baudRate the new baud rate of the link
+	 */
+	void workerLinkBaudRateChanged(int baudRate);
+
+	/**
+	 * \brief The slot called when the worker has measured the rate of a
+	 *        stream
+	 *
+	 * \param pointsPerSecond the number of points streamed per second
+	 */
+	void workerStreamRateMeasured(float pointsPerSecond);
+
+	/**
+	 * \brief The slot called when the worker publishes latency histograms
+	 *
+	 * \param roundTripTimes the round trip times of ping packets
+	 * \param creditIntervals the times between credit packets
+	 * \param underrunDurations the durations of underruns
+	 */
+	void workerLatencyStatisticsChanged(LatencyHistogram roundTripTimes, LatencyHistogram creditIntervals, LatencyHistogram underrunDurations);
+
+	/**
+	 * \brief The slot called when the worker receives a telemetry packet
+	 *
+	 * \param sample the decoded telemetry packet
+	 */
+	void workerTelemetryReceived(TelemetrySample sample);
+
 private:
 	/**
-	 * \brief Returns a sequence packet for the given point
+	 * \brief Returns a sequence packet for the given point of m_sequence
 	 *
-	 * This function doesn't check that p has the length that was used in
-	 * the start stream or start immediate package, ensure this externally
-	 * (this condition is fulfilled if the same sequence is used for the
-	 * start and this function, as it should be)
-	 * \param p the point for which to create a packet
+	 * Values are read directly from the sequence, without creating a
+	 * SequencePoint object
+	 * \param pos the position in the sequence of the point for which to
+	 *            create a packet
 	 * \return the packet for the point
 	 */
-	QByteArray createSequencePacketForPoint(const SequencePoint& p) const;
+	QByteArray createSequencePacketForPoint(int pos) const;
 
 	/**
-	 * \brief Processes received packets
+	 * \brief Creates the worker, in a new thread if m_useIOThread is true
 	 */
-	void processReceivedPackets();
+	void createWorker();
 
 	/**
-	 * \brief The function to call when the sequence is no longer streamed
+	 * \brief Destroys the worker, stopping its thread if needed
 	 *
-	 * This is called when either immediate mode stops or the "sequence
-	 * finished" packet is received
+	 * The worker is always shut down in its own thread before the thread
+	 * is stopped, even if the port could not be closed normally
 	 */
-	void sequenceStreamEnded();
+	void destroyWorker();
 
 	/**
-	 * \brief Moves the current point forward
+	 * \brief Returns the type of connection to use to invoke methods of
+	 *        the worker
 	 *
-	 * This function moves the current point forward by one. If we reach the
-	 * end of the sequence in stream mode, terminates the streaming.
+	 * \param blocking if true and the worker lives in another thread, the
+	 *                 invocation blocks until the method returns
+	 * \return the type of connection to use to invoke methods of the
+	 *         worker
 	 */
-	void incrementCurPoint();
+	Qt::ConnectionType workerConnection(bool blocking = false) const;
 
 	/**
-	 * \brief The function that actually sends data
+	 * \brief The function to call when the sequence is no longer streamed
 	 *
-	 * \param dataToSend the data to send through the serial port
+	 * This is called when either immediate mode stops or the worker tells
+	 * that the sequence has finished
 	 */
-	void sendData(const QByteArray& dataToSend);
+	void sequenceStreamEnded();
 
 	/**
 	 * \brief Changes the value of the m_isStreamMode flag and emits the
@@ -530,6 +1277,62 @@ private:
 	 */
 	void setBatteryCharge(float v);
 
+	/**
+	 * \brief Changes the number of points the hardware can buffer and
+	 *        emits the changed signal if needed
+	 *
+	 * \param depth the new number of points the hardware can buffer
+	 */
+	void setHardwareBufferDepth(int depth);
+
+	/**
+	 * \brief Sends the current point to the worker in immediate mode
+	 *
+	 * If there is a rate limit, this also starts the interval before the
+	 * next point can be sent
+	 */
+	void sendImmediatePoint();
+
+	/**
+	 * \brief Changes the number of coalesced changes and emits the changed
+	 *        signal if needed
+	 *
+	 * \param coalescedUpdates the new number of coalesced changes
+	 */
+	void setCoalescedUpdates(int coalescedUpdates);
+
+	/**
+	 * \brief Returns the bucket counts of a histogram as a list
+	 *
+	 * \param histogram the histogram
+	 * \return the number of durations in each bucket
+	 */
+	static QVariantList histogramBuckets(const LatencyHistogram& histogram);
+
+	/**
+	 * \brief Returns a telemetry sample as a map
+	 *
+	 * \param sample the sample
+	 * \return the fields of the sample, see lastTelemetry()
+	 */
+	static QVariantMap telemetryToMap(const TelemetrySample& sample);
+
+	/**
+	 * \brief Changes the baud rate of the link and emits the changed signal
+	 *        if needed
+	 *
+	 * \param baudRate the new baud rate of the link
+	 */
+	void setLinkBaudRate(int baudRate);
+
+	/**
+	 * \brief Changes the number of points per second of the last stream and
+	 *        emits the changed signal if needed
+	 *
+	 * \param pointsPerSecond the new number of points per second
+	 */
+	void setPointsPerSecond(float pointsPerSecond);
+
 	/**
 	 * \brief The name of the serial port to open
 	 */
@@ -548,9 +1351,56 @@ private:
 	bool m_oneShotSequence;
 
 	/**
-	 * \brief The serial communication port
+	 * \brief Whether serial I/O is performed in a dedicated thread
 	 */
-	QSerialPort m_serialPort;
+	bool m_useIOThread;
+
+	/**
+	 * \brief Whether packets are sent and received inside frames
+	 */
+	bool m_framedProtocol;
+
+	/**
+	 * \brief The number of corrupted frames since the port was opened
+	 */
+	int m_corruptedFrames;
+
+	/**
+	 * \brief The maximum baud rate to negotiate with the hardware
+	 */
+	int m_maxBaudRate;
+
+	/**
+	 * \brief The current baud rate of the link, 0 if the port is closed
+	 */
+	int m_linkBaudRate;
+
+	/**
+	 * \brief The number of points per second streamed in the last stream
+	 */
+	float m_pointsPerSecond;
+
+	/**
+	 * \brief Whether packets exchanged with the hardware are traced
+	 */
+	bool m_packetTrace;
+
+	/**
+	 * \brief The thread in which the worker lives if m_useIOThread is true
+	 */
+	QThread m_ioThread;
+
+	/**
+	 * \brief The object performing serial I/O
+	 *
+	 * This has no parent, because it could live in another thread
+	 */
+	SerialWorker* m_worker;
+
+	/**
+	 * \brief True if the serial port is open
+	 */
+	bool m_isConnected;
 
 	/**
 	 * \brief The sequence to stream
@@ -570,43 +1420,84 @@ private:
 	bool m_isImmediateMode;
 
 	/**
-	 * \brief The timer to wait for Arduino boot to finish
+	 * \brief If true streaming is paused in stream mode
+	 */
+	bool m_paused;
+
+	/**
+	 * \brief The current charge level of the battery
+	 */
+	float m_batteryCharge;
+
+	/**
+	 * \brief The number of points the hardware can buffer, 0 if unknown
+	 */
+	int m_hardwareBufferDepth;
+
+	/**
+	 * \brief True while we are changing the current point of the sequence
+	 *        following the stream
 	 *
-	 * See arduinoBootFinished() description
+	 * This is needed to avoid telling the worker to move to the point it
+	 * has just reached
 	 */
-	QTimer m_arduinoBoot;
+	bool m_followingStream;
 
 	/**
-	 * \brief The buffer of data from the serial port
+	 * \brief The maximum number of points per second sent in immediate
+	 *        mode, 0 if there is no limit
 	 */
-	QByteArray m_incomingData;
+	int m_immediateRate;
 
 	/**
-	 * \brief The index in m_incomingData to process
+	 * \brief The timer for the minimum interval between points sent in
+	 *        immediate mode
 	 */
-	int m_indexToProcess;
+	QTimer m_immediateTimer;
 
 	/**
-	 * \brief If true streaming is paused in stream mode
+	 * \brief True if the current point changed after the last point was
+	 *        sent in immediate mode
 	 */
-	bool m_paused;
+	bool m_immediatePending;
 
 	/**
-	 * \brief True if we cannot send more sequence points because the queue
-	 *        of the hardware is full
+	 * \brief The number of changes of the current point that were not sent
+	 *        in immediate mode
 	 */
-	bool m_hardwareQueueFull;
+	int m_coalescedUpdates;
 
 	/**
-	 * \brief The current charge level of the battery
+	 * \brief The interval between ping packets in milliseconds, 0 if pings
+	 *        are not sent
 	 */
-	float m_batteryCharge;
+	int m_pingInterval;
+
+	/**
+	 * \brief The histogram of round trip times of ping packets
+	 */
+	LatencyHistogram m_roundTripTimes;
+
+	/**
+	 * \brief The histogram of times between credit packets
+	 */
+	LatencyHistogram m_creditIntervals;
+
+	/**
+	 * \brief The histogram of durations of underruns
+	 */
+	LatencyHistogram m_underrunDurations;
+
+	/**
+	 * \brief The number of telemetry packets per second the hardware sends,
+	 *        0 if telemetry is disabled
+	 */
+	int m_telemetryRate;
 
 	/**
-	 * \brief True if we have sent a stop sequence packet and are waiting
-	 *        for the end of the sequence
+	 * \brief The telemetry samples received most recently
 	 */
-	bool m_stopping;
+	RingBuffer<TelemetrySample, telemetryCapacity> m_telemetry;
 };
 
 #endif // SERIALCOMMUNICATION_H
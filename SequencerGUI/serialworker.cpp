@@ -0,0 +1,1410 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include "serialworker.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+	// The byte starting a frame
+	const unsigned char frameSync = 0x7E;
+
+	// The byte escaping sync and escape bytes inside frames
+	const unsigned char frameEscape = 0x7D;
+
+	// The value escaped bytes are xored with
+	const unsigned char frameEscapeXor = 0x20;
+
+	// Updates a CRC-8 (polynomial 0x07, initial value 0) with one byte
+	unsigned char crc8Update(unsigned char crc, unsigned char v)
+	{
+		crc ^= v;
+		for (int i = 0; i < 8; ++i) {
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+		}
+
+		return crc;
+	}
+
+	// Computes the CRC-8 of a buffer
+	unsigned char crc8(const char* data, int length)
+	{
+		unsigned char crc = 0;
+		for (int i = 0; i < length; ++i) {
+			crc = crc8Update(crc, static_cast<unsigned char>(data[i]));
+		}
+
+		return crc;
+	}
+
+	// The baud rates of link speeds. The hardware starts at the first one
+	const int linkSpeedBaudRates[] = {115200, 250000, 500000, 1000000};
+
+	// The number of link speeds
+	const int numLinkSpeeds = sizeof(linkSpeedBaudRates) / sizeof(linkSpeedBaudRates[0]);
+
+	// The data of the link test packet. It contains the bytes that are escaped
+	// in frames and alternating bits
+	const char linkTestData[] = {'\x55', '\xAA', '\x00', '\xFF', '\x7E', '\x7D', '\x0F', '\xF0'};
+
+	// The number of bytes of the link test packet after the packet type
+	const int linkTestLength = sizeof(linkTestData);
+
+	// The version of the stream protocol we speak, sent before starting a
+	// stream. Hardware speaking it uses credits for flow control
+	const char protocolVersion = 1;
+
+	// How many milliseconds we wait for the answer to the link speed request
+	// and for the echo of the link test packet
+	const int linkReplyTimeout = 500;
+
+	// How many milliseconds we wait for the answer to a link confirm packet
+	// and how many times we send it. All attempts end well before the
+	// hardware gives up waiting (one second after changing the rate)
+	const int linkConfirmTimeout = 100;
+	const int linkConfirmMaxAttempts = 3;
+
+	// How many milliseconds we wait without credits before asking the
+	// hardware how many we have, in case a credit packet was lost. The
+	// request is repeated with the same interval while we have none
+	const int creditResyncTimeout = 500;
+
+	// The number of bytes of the echo of a ping packet after the packet type:
+	// our timestamp and the one of the hardware
+	const int pingEchoLength = 8;
+
+	// The number of bytes of the fixed part of a telemetry packet after the
+	// packet type. The last byte is the number of PWM values that follow
+	const int telemetryHeaderLength = 12;
+
+	// How often statistics of latencies are published, in milliseconds
+	const int latencyPublishInterval = 500;
+
+	// How many milliseconds we wait after a failed link test, so that the
+	// hardware goes back to the starting baud rate (it waits 1 second after
+	// changing the rate)
+	const int linkRevertTime = 1200;
+
+	// Appends a byte of a frame to the buffer, escaping it if needed
+	void appendEscaped(QByteArray& frame, unsigned char v)
+	{
+		if ((v == frameSync) || (v == frameEscape)) {
+			frame.append(static_cast<char>(frameEscape));
+			frame.append(static_cast<char>(v ^ frameEscapeXor));
+		} else {
+			frame.append(static_cast<char>(v));
+		}
+	}
+}
+
+SerialWorker::SerialWorker(QObject* parent)
+	: QObject(parent)
+	, m_serialPort(this)
+	, m_arduinoBoot(this)
+	, m_linkTimer(this)
+	, m_linkState(LinkState::Booting)
+	, m_startBaudRate(0)
+	, m_maxBaudRate(0)
+	, m_linkBaudRate(0)
+	, m_linkTestEcho()
+	, m_linkConfirmAttempts(0)
+	, m_pingTimer(this)
+	, m_pingInterval(0)
+	, m_pingEcho()
+	, m_underrunDuration(0)
+	, m_latencyClock()
+	, m_latencyTimer(this)
+	, m_latencyChanged(false)
+	, m_roundTripTimes()
+	, m_creditIntervals()
+	, m_underrunDurations()
+	, m_lastCreditTime(-1)
+	, m_telemetryRate(0)
+	, m_telemetryPacket()
+	, m_framed(false)
+	, m_mode(Mode::Idle)
+	, m_pointDim(0)
+	, m_numPoints(0)
+	, m_window()
+	, m_windowGeneration(0)
+	, m_pointsRequested(false)
+	, m_immediatePoint()
+	, m_nextPoint(0)
+	, m_oneShot(true)
+	, m_paused(false)
+	, m_credits(0)
+	, m_creditTimer(this)
+	, m_creditResync(false)
+	, m_bufferDepth(0)
+	, m_lastSentPoint()
+	, m_stopping(false)
+	, m_incomingData()
+	, m_decoderState(DecoderState::PacketType)
+	, m_debugMessageLength(0)
+	, m_debugMessage()
+	, m_frameStarted(false)
+	, m_frameSynchronized(false)
+	, m_frameDiscarding(false)
+	, m_frameEscape(false)
+	, m_frame()
+	, m_corruptedFrames(0)
+	, m_streamTimer()
+	, m_streamedPoints(0)
+	, m_sentPoints()
+	, m_deferredSequenceEnded(false)
+	, m_batteryCharge(-1.0)
+	, m_streamPosition(0)
+	, m_streamPositionPending(0)
+	, m_packetTrace()
+{
+	// A debug message is never longer than 255 characters, a frame has at
+	// most 255 bytes of payload plus length and CRC
+	m_debugMessage.reserve(255);
+	m_frame.reserve(257);
+
+	// Connecting signals from the serial port
+	connect(&m_serialPort, &QSerialPort::readyRead, this, &SerialWorker::handleReadyRead);
+	connect(&m_serialPort, static_cast<void (QSerialPort::*)(QSerialPort::SerialPortError)>(&QSerialPort::error), this, &SerialWorker::handleError);
+
+	// Connecting the signal for the Arduino boot timer. Also setting the timer to be singleShot
+	m_arduinoBoot.setSingleShot(true);
+	connect(&m_arduinoBoot, &QTimer::timeout, this, &SerialWorker::arduinoBootFinished);
+
+	// The timer for the steps of link speed negotiation
+	m_linkTimer.setSingleShot(true);
+	connect(&m_linkTimer, &QTimer::timeout, this, &SerialWorker::linkTimeout);
+
+	// The timer to recover from lost credit packets
+	m_creditTimer.setSingleShot(true);
+	connect(&m_creditTimer, &QTimer::timeout, this, &SerialWorker::creditTimeout);
+
+	// The timers to send pings and to publish latency statistics
+	connect(&m_pingTimer, &QTimer::timeout, this, &SerialWorker::sendPing);
+	connect(&m_latencyTimer, &QTimer::timeout, this, &SerialWorker::publishLatencyStatistics);
+}
+
+SerialWorker::~SerialWorker()
+{
+	closePort();
+}
+
+int SerialWorker::takeStreamPosition()
+{
+	// Resetting the flag before reading, so that a position published in the
+	// meantime triggers a new notification
+	m_streamPositionPending.fetchAndStoreOrdered(0);
+
+	return m_streamPosition.loadAcquire();
+}
+
+bool SerialWorker::openPort(QString portName, int baudRate, bool framed, int maxBaudRate)
+{
+	// Closing the old port
+	closePort();
+
+	m_framed = framed;
+	m_corruptedFrames = 0;
+	m_startBaudRate = baudRate;
+	m_maxBaudRate = maxBaudRate;
+	m_linkBaudRate = baudRate;
+	m_linkState = LinkState::Booting;
+
+	// Setting the name and baud rate of the port
+	m_serialPort.setPortName(portName);
+	m_serialPort.setBaudRate(baudRate);
+
+	// Trying to open the port
+	if (!m_serialPort.open(QIODevice::ReadWrite)) {
+		return false;
+	}
+
+	// This is necessary to give time to Arduino to "boot" (the board reboots every time the serial port
+	// is opened, and then there are 0.5 seconds taken by the bootloader)
+	m_arduinoBoot.start(1000);
+
+	// Starting to measure latencies. Pings are only sent once the link is ready
+	m_latencyClock.start();
+	resetLatencyStatistics();
+	m_latencyTimer.start(latencyPublishInterval);
+	if (m_pingInterval > 0) {
+		m_pingTimer.start(m_pingInterval);
+	}
+
+	return true;
+}
+
+void SerialWorker::closePort()
+{
+	endStream();
+	m_arduinoBoot.stop();
+	m_linkTimer.stop();
+	m_linkState = LinkState::Booting;
+	m_pingTimer.stop();
+	m_latencyTimer.stop();
+
+	// Closing the port
+	if (m_serialPort.isOpen()) {
+		m_serialPort.close();
+		m_serialPort.clearError();
+
+		// Setting the battery charge to -1.0
+		setBatteryCharge(-1.0);
+	}
+}
+
+void SerialWorker::shutdown()
+{
+	closePort();
+
+	// Nobody listens to our signals anymore
+	disconnect();
+}
+
+void SerialWorker::startStream(int pointDim, int numPoints, int firstPoint, bool oneShot)
+{
+	resetDecoder();
+
+	m_mode = Mode::Stream;
+	m_pointDim = pointDim;
+	m_numPoints = numPoints;
+	m_nextPoint = firstPoint;
+	dropWindow();
+	m_oneShot = oneShot;
+	m_paused = false;
+	m_credits = 0;
+	m_creditTimer.stop();
+	m_creditResync = false;
+	m_bufferDepth = 0;
+	m_lastSentPoint.clear();
+	m_stopping = false;
+	m_lastCreditTime = -1;
+
+	// Asking for the first points, they usually arrive while Arduino boots
+	requestPoints();
+
+	// If Arduino is booting or we are negotiating the link speed, we have to wait,
+	// otherwise we explicitly call the arduinoBootFinished() function to start
+	// sending the sequence
+	if (m_linkState == LinkState::Ready) {
+		arduinoBootFinished();
+	}
+}
+
+void SerialWorker::startImmediate(int pointDim, QByteArray point)
+{
+	resetDecoder();
+
+	m_mode = Mode::Immediate;
+	m_pointDim = pointDim;
+	m_immediatePoint = point;
+	m_nextPoint = 0;
+	m_paused = false;
+	m_credits = 0;
+	m_creditTimer.stop();
+	m_creditResync = false;
+	m_stopping = false;
+
+	// If Arduino is booting or we are negotiating the link speed, we have to wait,
+	// otherwise we explicitly call the arduinoBootFinished() function to send the
+	// current point of the sequence
+	if (m_linkState == LinkState::Ready) {
+		arduinoBootFinished();
+	}
+}
+
+void SerialWorker::sendPoint(QByteArray point)
+{
+	if (m_mode != Mode::Immediate) {
+		return;
+	}
+
+	// If Arduino is still booting (or we are negotiating the link speed) we only
+	// keep the last point, it will be sent by arduinoBootFinished()
+	if (m_linkState != LinkState::Ready) {
+		m_immediatePoint = point;
+	} else {
+		sendData(point);
+	}
+}
+
+void SerialWorker::setPaused(bool paused)
+{
+	if ((m_mode != Mode::Stream) || (paused == m_paused)) {
+		return;
+	}
+
+	m_paused = paused;
+
+	// Processing packets received while we were paused
+	if (!m_paused) {
+		processDeferredPackets();
+	}
+}
+
+void SerialWorker::setOneShot(bool oneShot)
+{
+	m_oneShot = oneShot;
+}
+
+void SerialWorker::setNextPoint(int p)
+{
+	if ((m_mode != Mode::Stream) || (p < 0) || (p >= m_numPoints)) {
+		return;
+	}
+
+	// Keeping the points of the window that follow the new position
+	const unsigned int offset = (p - m_nextPoint + m_numPoints) % m_numPoints;
+	if (offset < m_window.size()) {
+		m_window.pop(offset);
+	} else {
+		dropWindow();
+	}
+
+	m_nextPoint = p;
+
+	requestPoints();
+}
+
+void SerialWorker::setPoint(int pos, QByteArray point)
+{
+	if ((m_mode != Mode::Stream) || (pos < 0) || (pos >= m_numPoints)) {
+		return;
+	}
+
+	// With short sequences the window could contain the point more than once
+	for (unsigned int offset = (pos - m_nextPoint + m_numPoints) % m_numPoints; offset < m_window.size(); offset += m_numPoints) {
+		m_window[offset] = point;
+	}
+}
+
+void SerialWorker::addPoints(QVector<QByteArray> points, int generation)
+{
+	if ((m_mode != Mode::Stream) || (generation != m_windowGeneration)) {
+		return;
+	}
+	m_pointsRequested = false;
+
+	// While waiting the window is only shortened at its beginning, so the
+	// points still follow it
+	for (const QByteArray& point: points) {
+		if (!m_window.push(point)) {
+			break;
+		}
+	}
+
+	sendAvailablePoints();
+}
+
+void SerialWorker::resetPoints(int numPoints, int nextPoint)
+{
+	if (m_mode != Mode::Stream) {
+		return;
+	}
+
+	m_numPoints = numPoints;
+	if (nextPoint >= 0) {
+		m_nextPoint = nextPoint;
+	}
+	m_nextPoint = std::max(0, std::min(m_nextPoint, m_numPoints - 1));
+	dropWindow();
+
+	requestPoints();
+}
+
+void SerialWorker::stop()
+{
+	if (m_mode == Mode::Idle) {
+		return;
+	}
+
+	// If Arduino is still booting (or we are negotiating the link speed) we
+	// haven't sent anything yet, we can stop immediately
+	if (m_linkState != LinkState::Ready) {
+		const bool wasStreamMode = (m_mode == Mode::Stream);
+		endStream();
+		if (wasStreamMode) {
+			emit streamEnded();
+		}
+
+		return;
+	}
+
+	// Setting the stopping flag
+	m_stopping = true;
+
+	// Sending packet to stop streaming
+	sendData(QByteArray("H"));
+
+	// If we are in immediate mode, we can end here, otherwise we must wait
+	// for the hardware to tell us that the sequence is finished
+	if (m_mode == Mode::Immediate) {
+		endStream();
+	}
+}
+
+void SerialWorker::handleReadyRead()
+{
+	// Reading data directly into the free area of the buffer and processing it.
+	// The decoder consumes all data, so the buffer is empty at each iteration
+	while (m_serialPort.bytesAvailable() > 0) {
+		unsigned int length;
+		char* const dest = m_incomingData.writePointer(length);
+
+		const qint64 bytesRead = m_serialPort.read(dest, length);
+		if (bytesRead <= 0) {
+			break;
+		}
+		m_incomingData.commitWrite(bytesRead);
+
+		// Without frames we don't know where packets start, tracing data as
+		// it arrives
+		if (!m_framed) {
+			m_packetTrace.record(PacketTrace::Direction::Received, dest, bytesRead);
+		}
+
+		processReceivedPackets();
+	}
+}
+
+void SerialWorker::handleError(QSerialPort::SerialPortError error)
+{
+	if (error != QSerialPort::NoError) {
+		const QString errorString = "Error streaming: " + m_serialPort.errorString();
+		emit streamError(errorString);
+		qDebug() << errorString;
+	}
+}
+
+void SerialWorker::arduinoBootFinished()
+{
+	// Negotiating the link speed first, if needed. This function is called
+	// again when negotiation ends
+	if ((m_linkState == LinkState::Booting) && startLinkNegotiation()) {
+		return;
+	}
+	m_linkState = LinkState::Ready;
+
+	// Telling the hardware how often to send telemetry. Older firmware does
+	// not understand the request, so nothing is sent if telemetry is disabled
+	if (m_telemetryRate > 0) {
+		sendTelemetryRate();
+	}
+
+	// If we are streaming, sending data, otherwise doing nothing
+	if (m_mode == Mode::Idle) {
+		return;
+	}
+
+	// Telling the hardware which packets we know. Older firmware ignores this
+	if (m_mode == Mode::Stream) {
+		QByteArray versionPacket;
+		versionPacket.append('Q');
+		versionPacket.append(protocolVersion);
+		sendData(versionPacket);
+	}
+
+	// Then sending the start packet
+	QByteArray startPacket;
+	startPacket.append((m_mode == Mode::Stream) ? 'S' : 'I');
+	// Adding the number of dimension of point to the start packet
+	startPacket.append(m_pointDim & 0xFF);
+	sendData(startPacket);
+
+	if (m_mode == Mode::Stream) {
+		// Sending the first sequence packet and moving forward. The hardware
+		// always has room for the first point, credits it sends after the
+		// start packet are for the following ones
+		m_streamTimer.start();
+		m_streamedPoints = 0;
+		m_sentPoints.clear();
+		m_credits = 1;
+		sendAvailablePoints();
+	} else if (!m_immediatePoint.isEmpty()) {
+		// Sending the last point requested
+		sendData(m_immediatePoint);
+	}
+}
+
+void SerialWorker::processReceivedPackets()
+{
+	while (!m_incomingData.isEmpty()) {
+		const char c = m_incomingData.front();
+		m_incomingData.pop();
+
+		if (m_framed) {
+			decodeFrameByte(c);
+		} else {
+			decodePacketByte(c);
+		}
+	}
+}
+
+void SerialWorker::decodeFrameByte(char c)
+{
+	const unsigned char v = static_cast<unsigned char>(c);
+
+	// A sync byte always starts a new frame. If we were in the middle of a
+	// frame, some bytes were lost
+	if (v == frameSync) {
+		if (m_frameStarted && !m_frame.isEmpty()) {
+			countCorruptedFrame();
+		}
+		m_frameStarted = true;
+		m_frameDiscarding = false;
+		m_frameEscape = false;
+		m_frame.clear();
+
+		return;
+	}
+
+	// Discarding bytes until the next frame starts. Before the first valid
+	// frame these can be packets the hardware sends before switching to
+	// framed mode, otherwise the sync byte of a frame was lost
+	if (!m_frameStarted) {
+		if (m_frameSynchronized && !m_frameDiscarding) {
+			countCorruptedFrame();
+			m_frameDiscarding = true;
+		}
+
+		return;
+	}
+
+	if (v == frameEscape) {
+		m_frameEscape = true;
+
+		return;
+	} else if (m_frameEscape) {
+		m_frame.append(static_cast<char>(v ^ frameEscapeXor));
+		m_frameEscape = false;
+	} else {
+		m_frame.append(c);
+	}
+
+	// The first byte is the length of the payload, then there are the
+	// payload and the CRC
+	const int payloadLength = static_cast<unsigned char>(m_frame[0]);
+	if (payloadLength == 0) {
+		countCorruptedFrame();
+		m_frameStarted = false;
+		m_frameDiscarding = true;
+
+		return;
+	} else if (m_frame.size() < (payloadLength + 2)) {
+		return;
+	}
+	m_frameStarted = false;
+
+	if (crc8(m_frame.constData(), payloadLength + 1) != static_cast<unsigned char>(m_frame[payloadLength + 1])) {
+		countCorruptedFrame();
+
+		return;
+	}
+	m_frameSynchronized = true;
+
+	// Decoding the packet in the payload. A frame contains exactly one packet,
+	// so the decoder must be waiting for a new packet at the end. The payload
+	// is copied because decoding can end the stream and reset the decoder
+	const QByteArray payload = m_frame.mid(1, payloadLength);
+	m_packetTrace.record(PacketTrace::Direction::Received, payload.constData(), payload.size());
+	for (int i = 0; i < payload.size(); ++i) {
+		decodePacketByte(payload[i]);
+	}
+	if (m_decoderState != DecoderState::PacketType) {
+		countCorruptedFrame();
+		m_decoderState = DecoderState::PacketType;
+	}
+}
+
+void SerialWorker::decodePacketByte(char c)
+{
+	switch (m_decoderState) {
+		case DecoderState::PacketType:
+			if ((c == 'N') && (m_mode == Mode::Stream)) {
+				processBufferNotFull();
+			} else if ((c == 'F') && (m_mode == Mode::Stream)) {
+				processBufferFull();
+			} else if (c == 'E') {
+				processSequenceEnded();
+			} else if (c == 'D') {
+				m_decoderState = DecoderState::DebugLength;
+			} else if (c == 'B') {
+				m_decoderState = DecoderState::BatteryCharge;
+			} else if (c == 'C') {
+				m_decoderState = DecoderState::Credits;
+			} else if (c == 'G') {
+				m_decoderState = DecoderState::CreditResync;
+			} else if (c == 'A') {
+				m_decoderState = DecoderState::BufferDepth;
+			} else if (c == 'K') {
+				processFrameDiscarded();
+			} else if (c == 'L') {
+				m_decoderState = DecoderState::LinkSpeed;
+			} else if (c == 'V') {
+				processLinkConfirmed();
+			} else if (c == 'T') {
+				m_linkTestEcho.clear();
+				m_decoderState = DecoderState::LinkTest;
+			} else if (c == 'Y') {
+				m_pingEcho.clear();
+				m_decoderState = DecoderState::PingEcho;
+			} else if (c == 'W') {
+				m_decoderState = DecoderState::UnderrunHigh;
+			} else if (c == 'M') {
+				m_telemetryPacket.clear();
+				m_decoderState = DecoderState::Telemetry;
+			} else if ((c == 'N') || (c == 'F')) {
+				qDebug() << "Received spurious N or F packet";
+			} else {
+				const QString errorString = QString("Received unknown or invalid packet type %1 (ascii %2)").arg(static_cast<unsigned int>(c)).arg(c);
+				emit streamError(errorString);
+				qDebug() << errorString;
+			}
+			break;
+		case DecoderState::DebugLength:
+			m_debugMessageLength = static_cast<unsigned char>(c);
+			m_debugMessage.clear();
+			m_decoderState = DecoderState::DebugMessage;
+			break;
+		case DecoderState::DebugMessage:
+			m_debugMessage.append(c);
+			break;
+		case DecoderState::BatteryCharge:
+			// Setting the charge level
+			setBatteryCharge((float(static_cast<unsigned char>(c)) / 255.0) * 100.0);
+
+			m_decoderState = DecoderState::PacketType;
+			break;
+		case DecoderState::Credits:
+			// Going back to the initial state first, processing credits
+			// could end the stream and reset the decoder
+			m_decoderState = DecoderState::PacketType;
+
+			if (m_mode == Mode::Stream) {
+				processCredits(static_cast<unsigned char>(c));
+			} else {
+				qDebug() << "Received spurious C packet";
+			}
+			break;
+		case DecoderState::CreditResync:
+			// Going back to the initial state first, processing credits
+			// could end the stream and reset the decoder
+			m_decoderState = DecoderState::PacketType;
+
+			if (m_mode == Mode::Stream) {
+				processCreditResync(static_cast<unsigned char>(c));
+			} else {
+				qDebug() << "Received spurious G packet";
+			}
+			break;
+		case DecoderState::BufferDepth:
+			m_decoderState = DecoderState::PacketType;
+
+			if (m_mode == Mode::Stream) {
+				processStreamAccepted(static_cast<unsigned char>(c));
+			} else {
+				qDebug() << "Received spurious A packet";
+			}
+			break;
+		case DecoderState::LinkSpeed:
+			m_decoderState = DecoderState::PacketType;
+
+			processLinkSpeed(static_cast<unsigned char>(c));
+			break;
+		case DecoderState::LinkTest:
+			m_linkTestEcho.append(c);
+
+			if (m_linkTestEcho.size() == linkTestLength) {
+				m_decoderState = DecoderState::PacketType;
+
+				processLinkTestEcho();
+			}
+			break;
+		case DecoderState::PingEcho:
+			m_pingEcho.append(c);
+
+			if (m_pingEcho.size() == pingEchoLength) {
+				m_decoderState = DecoderState::PacketType;
+
+				processPingEcho();
+			}
+			break;
+		case DecoderState::UnderrunHigh:
+			m_underrunDuration = static_cast<unsigned char>(c) << 8;
+			m_decoderState = DecoderState::UnderrunLow;
+			break;
+		case DecoderState::UnderrunLow:
+			m_underrunDuration |= static_cast<unsigned char>(c);
+			m_decoderState = DecoderState::PacketType;
+
+			// The hardware measures underruns in milliseconds
+			m_underrunDurations.add(quint32(m_underrunDuration) * 1000);
+			m_latencyChanged = true;
+			break;
+		case DecoderState::Telemetry:
+			m_telemetryPacket.append(c);
+
+			// The length of the packet is only known once the number of PWM
+			// values has been received
+			if ((m_telemetryPacket.size() >= telemetryHeaderLength) && (m_telemetryPacket.size() == (telemetryHeaderLength + 2 * static_cast<unsigned char>(m_telemetryPacket[telemetryHeaderLength - 1])))) {
+				m_decoderState = DecoderState::PacketType;
+
+				processTelemetry();
+			}
+			break;
+	}
+
+	// Checking if the debug message is complete. This is done here so that
+	// messages of length 0 are also handled
+	if ((m_decoderState == DecoderState::DebugMessage) && (m_debugMessage.size() == m_debugMessageLength)) {
+		// We have the whole message, putting in a QString
+		const QString msg(m_debugMessage);
+
+		// Emitting signal and printing
+		emit debugMessage(msg);
+		qDebug() << "Debug packet, content:" << msg;
+
+		m_decoderState = DecoderState::PacketType;
+	}
+}
+
+bool SerialWorker::startLinkNegotiation()
+{
+	// Looking for the highest speed we support that is faster than the
+	// starting one
+	int speed = -1;
+	for (int i = 0; i < numLinkSpeeds; ++i) {
+		if ((linkSpeedBaudRates[i] > m_startBaudRate) && (linkSpeedBaudRates[i] <= m_maxBaudRate)) {
+			speed = i;
+		}
+	}
+	if (speed == -1) {
+		return false;
+	}
+
+	QByteArray packet;
+	packet.append('L');
+	packet.append(static_cast<char>(speed));
+	sendData(packet);
+
+	m_linkState = LinkState::Negotiating;
+	m_linkTimer.start(linkReplyTimeout);
+
+	return true;
+}
+
+void SerialWorker::processLinkSpeed(int speed)
+{
+	if (m_linkState != LinkState::Negotiating) {
+		qDebug() << "Received spurious L packet";
+
+		return;
+	}
+
+	// The hardware has already switched to the new rate
+	const int baudRate = linkSpeedBaudRates[std::min(speed, numLinkSpeeds - 1)];
+	if (baudRate == m_linkBaudRate) {
+		linkReady();
+	} else if (!m_serialPort.setBaudRate(baudRate)) {
+		// We cannot follow the hardware, waiting for it to go back to the
+		// starting rate
+		qDebug() << "Cannot set baud rate" << baudRate;
+
+		m_linkState = LinkState::Reverting;
+		m_linkTimer.start(linkRevertTime);
+	} else {
+		// Checking that the link works at the new rate
+		QByteArray packet;
+		packet.append('T');
+		packet.append(linkTestData, linkTestLength);
+		sendData(packet);
+
+		m_linkState = LinkState::Testing;
+		m_linkTimer.start(linkReplyTimeout);
+	}
+}
+
+void SerialWorker::processLinkTestEcho()
+{
+	if (m_linkState != LinkState::Testing) {
+		qDebug() << "Received spurious T packet";
+
+		return;
+	}
+
+	if (m_linkTestEcho == QByteArray(linkTestData, linkTestLength)) {
+		// The link works in both directions, but the hardware doesn't know
+		// whether its echo arrived. It only keeps the new rate when we
+		// confirm it
+		m_linkState = LinkState::Confirming;
+		m_linkConfirmAttempts = 0;
+		sendLinkConfirm();
+	} else {
+		linkTestFailed();
+	}
+}
+
+void SerialWorker::sendLinkConfirm()
+{
+	QByteArray packet;
+	packet.append('V');
+	sendData(packet);
+
+	++m_linkConfirmAttempts;
+	m_linkTimer.start(linkConfirmTimeout);
+}
+
+void SerialWorker::processLinkConfirmed()
+{
+	// Answers to repeated confirm packets arrive when we are already done
+	if (m_linkState != LinkState::Confirming) {
+		return;
+	}
+
+	m_linkBaudRate = m_serialPort.baudRate();
+	emit linkBaudRateChanged(m_linkBaudRate);
+
+	linkReady();
+}
+
+void SerialWorker::linkTimeout()
+{
+	switch (m_linkState) {
+		case LinkState::Negotiating:
+			// Older firmware does not answer, staying at the starting rate
+			linkReady();
+			break;
+		case LinkState::Testing:
+			linkTestFailed();
+			break;
+		case LinkState::Confirming:
+			// If no confirm packet arrived the hardware goes back to the starting
+			// rate. If all answers were lost instead it keeps the new rate
+			// and the link is lost, but this needs all attempts to fail
+			if (m_linkConfirmAttempts < linkConfirmMaxAttempts) {
+				sendLinkConfirm();
+			} else {
+				linkTestFailed();
+			}
+			break;
+		case LinkState::Reverting:
+			linkReady();
+			break;
+		default:
+			break;
+	}
+}
+
+void SerialWorker::linkTestFailed()
+{
+	qDebug() << "Link test failed at" << m_serialPort.baudRate() << "baud, going back to" << m_startBaudRate;
+
+	// The hardware goes back to the starting rate if it doesn't receive the
+	// link confirm packet. Waiting for it before sending anything
+	m_serialPort.setBaudRate(m_startBaudRate);
+	m_linkState = LinkState::Reverting;
+	m_linkTimer.start(linkRevertTime);
+}
+
+void SerialWorker::linkReady()
+{
+	m_linkTimer.stop();
+	m_linkState = LinkState::Ready;
+
+	// Starting what was requested while negotiating
+	arduinoBootFinished();
+}
+
+void SerialWorker::setPingInterval(int interval)
+{
+	m_pingInterval = interval;
+
+	if (m_pingInterval <= 0) {
+		m_pingTimer.stop();
+	} else if (m_serialPort.isOpen()) {
+		m_pingTimer.start(m_pingInterval);
+	}
+}
+
+void SerialWorker::setTelemetryRate(int rate)
+{
+	m_telemetryRate = rate;
+
+	// If the link is not ready, the rate is sent when it is
+	if (m_linkState == LinkState::Ready) {
+		sendTelemetryRate();
+	}
+}
+
+void SerialWorker::resetLatencyStatistics()
+{
+	m_roundTripTimes.clear();
+	m_creditIntervals.clear();
+	m_underrunDurations.clear();
+	m_lastCreditTime = -1;
+
+	emit latencyStatisticsChanged(m_roundTripTimes, m_creditIntervals, m_underrunDurations);
+	m_latencyChanged = false;
+}
+
+void SerialWorker::sendPing()
+{
+	// Nothing but link speed packets can be sent before the link is ready
+	if (m_linkState != LinkState::Ready) {
+		return;
+	}
+
+	// The timestamp is echoed back, so we don't need to remember it. Only
+	// the lower 32 bits are sent, differences are correct even when they
+	// wrap
+	const quint32 timestamp = quint32(m_latencyClock.nsecsElapsed() / 1000);
+
+	QByteArray packet;
+	packet.append('Y');
+	packet.append((timestamp >> 24) & 0xFF);
+	packet.append((timestamp >> 16) & 0xFF);
+	packet.append((timestamp >> 8) & 0xFF);
+	packet.append(timestamp & 0xFF);
+	sendData(packet);
+}
+
+void SerialWorker::processPingEcho()
+{
+	// The first four bytes are our timestamp, the others the time of the
+	// hardware when it answered, which we don't use
+	quint32 timestamp = 0;
+	for (int i = 0; i < 4; ++i) {
+		timestamp = (timestamp << 8) | static_cast<unsigned char>(m_pingEcho[i]);
+	}
+
+	const quint32 now = quint32(m_latencyClock.nsecsElapsed() / 1000);
+	m_roundTripTimes.add(now - timestamp);
+	m_latencyChanged = true;
+}
+
+void SerialWorker::sendTelemetryRate()
+{
+	QByteArray packet;
+	packet.append('M');
+	packet.append(m_telemetryRate & 0xFF);
+	sendData(packet);
+}
+
+void SerialWorker::processTelemetry()
+{
+	// Reads a 16 bits value, most significant byte first
+	auto word = [this](int i) {
+		return (static_cast<unsigned char>(m_telemetryPacket[i]) << 8) | static_cast<unsigned char>(m_telemetryPacket[i + 1]);
+	};
+
+	TelemetrySample sample;
+	sample.time = m_latencyClock.elapsed();
+	sample.startedPoints = word(0);
+	sample.phase = static_cast<TelemetrySample::Phase>(static_cast<unsigned char>(m_telemetryPacket[2]));
+	sample.pointTime = word(3);
+	sample.tickOverruns = word(5);
+	sample.maxLateness = word(7);
+	sample.maxTickDuration = word(9);
+	for (int i = telemetryHeaderLength; i < m_telemetryPacket.size(); i += 2) {
+		sample.pwm.append(word(i));
+	}
+
+	// The hardware is at most a few points behind us, so the number of points
+	// it started can be recovered from its lower 16 bits. The point being
+	// played is the last one started. Packets sent before the hardware
+	// received the start of the stream give a negative number
+	if ((m_mode == Mode::Stream) && (sample.phase != TelemetrySample::NoPoint)) {
+		const int lag = static_cast<quint16>(m_streamedPoints - sample.startedPoints);
+		const int playing = m_streamedPoints - lag - 1;
+		const int firstKept = m_streamedPoints - static_cast<int>(m_sentPoints.size());
+		if ((playing >= firstKept) && (playing < m_streamedPoints)) {
+			// Adding the timing of the point as authored
+			const SentPoint& point = m_sentPoints[playing - firstKept];
+			sample.sequenceIndex = point.index;
+			sample.duration = point.duration;
+			sample.timeToTarget = point.timeToTarget;
+		}
+	}
+
+	emit telemetryReceived(sample);
+}
+
+void SerialWorker::publishLatencyStatistics()
+{
+	if (m_latencyChanged) {
+		m_latencyChanged = false;
+
+		emit latencyStatisticsChanged(m_roundTripTimes, m_creditIntervals, m_underrunDurations);
+	}
+}
+
+void SerialWorker::processFrameDiscarded()
+{
+	// The lost frame could be a point the next delta packet is relative to,
+	// the next point is sent in full
+	countCorruptedFrame();
+}
+
+void SerialWorker::countCorruptedFrame()
+{
+	m_lastSentPoint.clear();
+
+	++m_corruptedFrames;
+
+	emit corruptedFramesChanged(m_corruptedFrames);
+}
+
+void SerialWorker::processBufferNotFull()
+{
+	// Older firmware sends this packet each time there is room for one
+	// point, which is the same as one credit
+	processCredits(1);
+}
+
+void SerialWorker::processBufferFull()
+{
+	// Nothing to do, older firmware sends a "buffer not full" packet when
+	// there is room for another point
+}
+
+void SerialWorker::processStreamAccepted(int depth)
+{
+	m_bufferDepth = depth;
+
+	emit bufferDepthReceived(depth);
+}
+
+void SerialWorker::processCredits(int credits)
+{
+	// Measuring the time between credit packets, which is the time the
+	// hardware takes to free slots
+	const qint64 now = m_latencyClock.nsecsElapsed() / 1000;
+	if (m_lastCreditTime >= 0) {
+		m_creditIntervals.add(quint32(std::min(now - m_lastCreditTime, qint64(0xFFFFFFFF))));
+		m_latencyChanged = true;
+	}
+	m_lastCreditTime = now;
+
+	if (m_stopping) {
+		// Skipping this packet, we are stopping
+		return;
+	}
+
+	// The answer to the resync request includes these credits
+	if (m_creditResync) {
+		return;
+	}
+
+	// Credits received while paused are used when the stream is resumed. The
+	// hardware never has more free slots than the depth of its buffer
+	m_credits += credits;
+	if (m_bufferDepth > 0) {
+		m_credits = std::min(m_credits, m_bufferDepth);
+	}
+
+	sendAvailablePoints();
+}
+
+void SerialWorker::sendAvailablePoints()
+{
+	// The stream could end while sending points (for one-shot sequences), so we
+	// check it is still active at each iteration
+	while ((m_credits > 0) && (m_mode == Mode::Stream) && !m_paused && !m_stopping) {
+		if (m_window.isEmpty()) {
+			// Nothing to send. A one-shot stream of an empty sequence
+			// terminates here, otherwise we wait for the points we asked for
+			if ((m_numPoints == 0) && m_oneShot) {
+				stop();
+			}
+
+			break;
+		}
+
+		streamNextPoint();
+	}
+
+	requestPoints();
+
+	// Waiting for credits. Only firmware sending the "stream accepted"
+	// packet answers resync requests
+	if ((m_credits == 0) && (m_mode == Mode::Stream) && !m_paused && !m_stopping && (m_bufferDepth > 0) && !m_creditResync) {
+		m_creditTimer.start(creditResyncTimeout);
+	}
+}
+
+void SerialWorker::processCreditResync(int credits)
+{
+	if (!m_creditResync || m_stopping) {
+		return;
+	}
+	m_creditResync = false;
+
+	// Points sent before the request have all reached the hardware (we had
+	// no credits for a while), so this replaces our count
+	m_credits = std::min(credits, m_bufferDepth);
+
+	sendAvailablePoints();
+}
+
+void SerialWorker::creditTimeout()
+{
+	if ((m_credits > 0) || (m_mode != Mode::Stream) || m_paused || m_stopping) {
+		m_creditResync = false;
+
+		return;
+	}
+
+	m_creditResync = true;
+	sendData(QByteArray(1, 'R'));
+
+	// If the answer is lost, asking again
+	m_creditTimer.start(creditResyncTimeout);
+}
+
+void SerialWorker::processSequenceEnded()
+{
+	if (m_mode != Mode::Stream) {
+		qDebug() << "Received spurious E packet";
+
+		return;
+	}
+
+	if (m_paused) {
+		// Recording the packet, it will be processed when the stream is resumed
+		m_deferredSequenceEnded = true;
+
+		return;
+	}
+
+	qDebug() << "RECEIVED SEQUENCE ENDED";
+
+	// The rate at which points were sent, which is also the rate at which the
+	// hardware consumed them
+	const qint64 elapsed = m_streamTimer.elapsed();
+	if (elapsed > 0) {
+		emit streamRateMeasured(float(m_streamedPoints) * 1000.0f / float(elapsed));
+	}
+
+	// Statistics of the stream are complete, publishing them now
+	publishLatencyStatistics();
+
+	// Ending the stream. This also clears the buffer of incoming data, so the
+	// loop in processReceivedPackets() terminates
+	endStream();
+
+	emit streamEnded();
+}
+
+void SerialWorker::processDeferredPackets()
+{
+	// Taking the deferred packet and resetting it before processing, because
+	// processing can end the stream and reset the decoder
+	const bool sequenceEnded = m_deferredSequenceEnded;
+	m_deferredSequenceEnded = false;
+
+	// Using the credits received while paused
+	sendAvailablePoints();
+
+	if (sequenceEnded && (m_mode == Mode::Stream)) {
+		processSequenceEnded();
+	}
+}
+
+void SerialWorker::resetDecoder()
+{
+	m_incomingData.clear();
+	m_decoderState = DecoderState::PacketType;
+	m_debugMessageLength = 0;
+	m_debugMessage.clear();
+	m_frameStarted = false;
+	m_frameSynchronized = false;
+	m_frameDiscarding = false;
+	m_frameEscape = false;
+	m_frame.clear();
+	m_deferredSequenceEnded = false;
+}
+
+void SerialWorker::requestPoints()
+{
+	// The window is refilled when half empty, so that points are already
+	// there when credits arrive
+	if ((m_mode != Mode::Stream) || m_pointsRequested || (m_numPoints == 0) || (m_window.size() > (m_window.capacity() / 2))) {
+		return;
+	}
+	m_pointsRequested = true;
+
+	const int first = (m_nextPoint + static_cast<int>(m_window.size())) % m_numPoints;
+	emit pointsRequested(first, static_cast<int>(m_window.freeSpace()), m_windowGeneration);
+}
+
+void SerialWorker::dropWindow()
+{
+	m_window.clear();
+	++m_windowGeneration;
+	m_pointsRequested = false;
+}
+
+void SerialWorker::streamNextPoint()
+{
+	const QByteArray point = m_window.front();
+	m_window.pop();
+
+	sendData(encodePoint(point));
+	m_lastSentPoint = point;
+	--m_credits;
+	++m_streamedPoints;
+
+	// The sequence packet has the duration and the time to target after
+	// the packet type
+	SentPoint sentPoint;
+	sentPoint.index = m_nextPoint;
+	sentPoint.duration = (static_cast<unsigned char>(point[1]) << 8) | static_cast<unsigned char>(point[2]);
+	sentPoint.timeToTarget = (static_cast<unsigned char>(point[3]) << 8) | static_cast<unsigned char>(point[4]);
+	if (m_sentPoints.isFull()) {
+		m_sentPoints.pop();
+	}
+	m_sentPoints.push(sentPoint);
+
+	if (m_nextPoint >= (m_numPoints - 1)) {
+		// We are at the last point, checking what to do
+		if (m_oneShot) {
+			// Stopping
+			stop();
+		} else {
+			// Restarting from the beginning
+			m_nextPoint = 0;
+		}
+	} else {
+		++m_nextPoint;
+	}
+
+	publishStreamPosition();
+}
+
+QByteArray SerialWorker::encodePoint(const QByteArray& point) const
+{
+	// The header of sequence packets: packet type, duration and time to target
+	const int headerSize = 5;
+
+	// Older firmware does not send the "stream accepted" packet and does not
+	// know delta packets. The mask of changed elements has 16 bits
+	if ((m_bufferDepth == 0) || (m_lastSentPoint.size() != point.size()) || (m_pointDim > 16)) {
+		return point;
+	}
+
+	unsigned int changedMask = 0;
+	QByteArray positions;
+	for (int i = 0; i < m_pointDim; ++i) {
+		if (point[headerSize + i] != m_lastSentPoint[headerSize + i]) {
+			changedMask |= 1u << i;
+			positions.append(point[headerSize + i]);
+		}
+	}
+
+	// The delta packet also has the two bytes of the mask
+	if ((positions.size() + 2) >= m_pointDim) {
+		return point;
+	}
+
+	QByteArray packet = point.left(headerSize);
+	packet[0] = 'U';
+	packet.append((changedMask >> 8) & 0xFF);
+	packet.append(changedMask & 0xFF);
+	packet.append(positions);
+
+	return packet;
+}
+
+void SerialWorker::endStream()
+{
+	m_mode = Mode::Idle;
+	m_numPoints = 0;
+	dropWindow();
+	m_immediatePoint.clear();
+	m_nextPoint = 0;
+	m_paused = false;
+	m_credits = 0;
+	m_creditTimer.stop();
+	m_creditResync = false;
+	m_lastSentPoint.clear();
+	m_stopping = false;
+	m_lastCreditTime = -1;
+
+	resetDecoder();
+}
+
+void SerialWorker::publishStreamPosition()
+{
+	m_streamPosition.storeRelease(m_nextPoint);
+
+	if (m_streamPositionPending.testAndSetOrdered(0, 1)) {
+		emit streamPositionChanged();
+	}
+}
+
+void SerialWorker::sendData(const QByteArray& dataToSend)
+{
+	if (dataToSend.isEmpty()) {
+		return;
+	}
+
+	m_packetTrace.record(PacketTrace::Direction::Sent, dataToSend.constData(), dataToSend.size());
+
+	// Putting the packet inside a frame, if needed. The CRC covers length and
+	// payload
+	QByteArray frame;
+	if (m_framed) {
+		const unsigned char length = static_cast<unsigned char>(dataToSend.size());
+		unsigned char crc = crc8Update(0, length);
+
+		frame.reserve((dataToSend.size() + 2) * 2 + 1);
+		frame.append(static_cast<char>(frameSync));
+		appendEscaped(frame, length);
+		for (int i = 0; i < dataToSend.size(); ++i) {
+			const unsigned char v = static_cast<unsigned char>(dataToSend[i]);
+			crc = crc8Update(crc, v);
+			appendEscaped(frame, v);
+		}
+		appendEscaped(frame, crc);
+	}
+	const QByteArray& data = m_framed ? frame : dataToSend;
+
+	// Writing data
+	qint64 bytesWritten = m_serialPort.write(data);
+
+	if (bytesWritten == -1) {
+		qDebug() << "Error writing data";
+	} else if (bytesWritten != data.size()) {
+		qDebug() << "Cannot write all data";
+	}
+}
+
+void SerialWorker::setBatteryCharge(float v)
+{
+	if (v < 0.0) {
+		v = -1.0;
+	}
+
+	if (v != m_batteryCharge) {
+		m_batteryCharge = v;
+
+		emit batteryChargeChanged(m_batteryCharge);
+	}
+}
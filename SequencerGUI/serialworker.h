@@ -0,0 +1,1110 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef SERIALWORKER_H
+#define SERIALWORKER_H
+
+#include <QSerialPort>
+#include <QByteArray>
+#include <QVector>
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include "ringbuffer.h"
+#include "packettrace.h"
+#include "latencyhistogram.h"
+#include "telemetrysample.h"
+
+/**
+ * \brief The object performing the actual serial I/O for SerialCommunication
+ *
+ * This class owns the serial port, decodes packets coming from the hardware
+ * and sends packets to it. It knows nothing about Sequence objects: in stream
+ * mode it keeps a window of the next points to stream, already converted to
+ * sequence packets, so that it can answer flow control packets by itself. When
+ * the window is half empty the pointsRequested() signal asks for the following
+ * points, which are added with addPoints(). Requests carry a generation that
+ * changes each time the window is dropped (e.g. when points are added to or
+ * removed from the sequence), so that late answers are ignored.
+ * This allows moving the object to a dedicated thread, so that the stream is
+ * not delayed when the GUI thread is busy. See SerialCommunication for the
+ * description of the communication protocol.
+ *
+ * All public slots can be called either directly (when this lives in the same
+ * thread as the caller) or through queued or blocking queued invocations (when
+ * this lives in a different thread). Signals are only emitted from the thread
+ * this object lives in. The position of the stream is not sent with each
+ * packet: the streamPositionChanged() signal is emitted once until
+ * takeStreamPosition() is called, so that the receiver only gets the last
+ * position no matter how many points were sent in the meantime.
+ *
+ * Data coming from the hardware is read into a fixed-size ring buffer and fed
+ * to an incremental decoder that keeps the state of partially received packets
+ * between reads, so bytes are never moved around in memory. Flow control
+ * packets received while the stream is paused are not kept in the buffer:
+ * credits are accumulated and the "sequence finished" packet is recorded in a
+ * flag, they are processed when the stream is resumed. In framed mode a first
+ * decoder extracts and checks frames and passes their payload to the packet
+ * decoder.
+ */
+class SerialWorker : public QObject
+{
+	Q_OBJECT
+
+public:
+	/**
+	 * \brief Constructor
+	 *
+	 * \param parent the parent object
+	 */
+	explicit SerialWorker(QObject* parent = nullptr);
+
+	/**
+	 * \brief Destructor
+	 *
+	 * Closes the port if open
+	 */
+	virtual ~SerialWorker();
+
+	/**
+	 * \brief Copy constructor is deleted
+	 *
+	 * \param other the object to copy
+	 */
+	SerialWorker(const SerialWorker& other) = delete;
+
+	/**
+	 * \brief Move constructor is deleted
+	 *
+	 * \param other the object to move into this
+	 */
+	SerialWorker(SerialWorker&& other) = delete;
+
+	/**
+	 * \brief Copy operator is deleted
+	 */
+	SerialWorker& operator=(const SerialWorker& other) = delete;
+
+	/**
+	 * \brief Move operator is deleted
+	 */
+	SerialWorker& operator=(SerialWorker&& other) = delete;
+
+	/**
+	 * \brief Returns the index of the next point that will be streamed
+	 *
+	 * This can be called from any thread. After this is called, the
+	 * streamPositionChanged() signal is emitted again when the position
+	 * changes
+	 * \return the index of the next point that will be streamed
+	 */
+	int takeStreamPosition();
+
+	/**
+	 * \brief Returns the trace of packets exchanged with the hardware
+	 *
+	 * Packets are recorded from the thread this object lives in, the trace
+	 * can be enabled and dumped from another thread (see PacketTrace)
+	 * \return the trace of packets
+	 */
+	PacketTrace& packetTrace()
+	{
+		return m_packetTrace;
+	}
+
+	/**
+	 * \brief The maximum number of encoded points kept ahead of the stream
+	 */
+	static const int pointWindow = 64;
+
+public slots:
+	/**
+	 * \brief Opens the serial port
+	 *
+	 * If a port was already opened, closes it before opening the new one.
+	 * This also resets the count of corrupted frames. After Arduino has
+	 * booted, a faster baud rate (up to maxBaudRate) is negotiated with the
+	 * hardware, see startLinkNegotiation()
+	 * \param portName the name of the port to open
+	 * \param baudRate the baud rate the hardware starts with
+	 * \param framed if true packets are sent and received inside frames
+	 * \param maxBaudRate the maximum baud rate to negotiate. If this is not
+	 *                    greater than baudRate, no negotiation takes place
+	 * \return false in case of error, true if the port was opened
+	 *         successfully
+	 */
+	bool openPort(QString portName, int baudRate, bool framed, int maxBaudRate);
+
+	/**
+	 * \brief Closes the serial port
+	 *
+	 * Any stream is terminated without notifying the hardware
+	 */
+	void closePort();
+
+	/**
+	 * \brief Closes the port and stops all activity before the worker is
+	 *        destroyed
+	 *
+	 * This must be called in the thread the worker lives in, before the
+	 * thread is stopped. It works whatever the state of the stream, timers
+	 * and the serial port are released in their own thread so the worker
+	 * can then be deleted from any thread
+	 */
+	void shutdown();
+
+	/**
+	 * \brief Sets how often ping packets are sent to measure the round trip
+	 *        time
+	 *
+	 * Pings are only sent while the port is open and the link is ready.
+	 * Older firmware does not understand ping packets, so they are
+	 * disabled by default
+	 * \param interval the interval between pings in milliseconds, 0 to not
+	 *                 send pings
+	 */
+	void setPingInterval(int interval);
+
+	/**
+	 * \brief Sets how many telemetry packets per second the hardware should
+	 *        send
+	 *
+	 * The rate is sent to the hardware when the link is ready and each time
+	 * it changes. Older firmware does not understand the request, so
+	 * telemetry is disabled by default
+	 * \param rate the number of telemetry packets per second (at most 255),
+	 *             0 to disable telemetry
+	 */
+	void setTelemetryRate(int rate);
+
+	/**
+	 * \brief Clears the latency histograms
+	 *
+	 * This is also done when the port is opened. The empty histograms are
+	 * published immediately
+	 */
+	void resetLatencyStatistics();
+
+	/**
+	 * \brief Starts streaming points
+	 *
+	 * Points are requested through the pointsRequested() signal
+	 * \param pointDim the dimension of points
+	 * \param numPoints the number of points in the sequence
+	 * \param firstPoint the index of the first point to stream
+	 * \param oneShot if true the stream stops after the last point,
+	 *                otherwise it restarts from the first one
+	 */
+	void startStream(int pointDim, int numPoints, int firstPoint, bool oneShot);
+
+	/**
+	 * \brief Starts the immediate mode
+	 *
+	 * \param pointDim the dimension of points
+	 * \param point the sequence packet of the point to send first. If
+	 *              empty, nothing is sent until sendPoint() is called
+	 */
+	void startImmediate(int pointDim, QByteArray point);
+
+	/**
+	 * \brief Sends a point in immediate mode
+	 *
+	 * If the hardware is still booting, the point is sent as soon as it
+	 * finishes
+	 * \param point the sequence packet to send
+	 */
+	void sendPoint(QByteArray point);
+
+	/**
+	 * \brief Pauses or resumes the stream
+	 *
+	 * \param paused if true the stream is paused, otherwise it is resumed
+	 */
+	void setPaused(bool paused);
+
+	/**
+	 * \brief Sets whether the stream should stop after the last point
+	 *
+	 * \param oneShot if true the stream stops after the last point,
+	 *                otherwise it restarts from the first one
+	 */
+	void setOneShot(bool oneShot);
+
+	/**
+	 * \brief Sets the index of the next point to stream
+	 *
+	 * \param p the index of the next point to stream
+	 */
+	void setNextPoint(int p);
+
+	/**
+	 * \brief Changes the packet of a point being streamed
+	 *
+	 * Points outside the window are ignored, they are encoded again when
+	 * requested
+	 * \param pos the index of the point to change
+	 * \param point the new sequence packet
+	 */
+	void setPoint(int pos, QByteArray point);
+
+	/**
+	 * \brief Adds points at the end of the window
+	 *
+	 * This is the answer to the pointsRequested() signal. Answers to
+	 * requests made before the window was dropped are ignored
+	 * \param points the sequence packets of the points
+	 * \param generation the generation of the request
+	 */
+	void addPoints(QVector<QByteArray> points, int generation);
+
+	/**
+	 * \brief Drops the window and requests points again
+	 *
+	 * This is used when points are added to or removed from the sequence or
+	 * when too many points change to send them one by one
+	 * \param numPoints the number of points in the sequence
+	 * \param nextPoint the index of the next point to stream. If negative,
+	 *                  the next point does not change
+	 */
+	void resetPoints(int numPoints, int nextPoint);
+
+	/**
+	 * \brief Stops the stream
+	 *
+	 * In stream mode the streamEnded() signal is emitted when the hardware
+	 * tells it has finished playing points, in immediate mode the stream
+	 * ends immediately and the signal is not emitted
+	 */
+	void stop();
+
+signals:
+	/**
+	 * \brief The signal emitted when the next point to stream changes
+	 *
+	 * This is not emitted again until takeStreamPosition() is called
+	 */
+	void streamPositionChanged();
+
+	/**
+	 * \brief The signal emitted to ask for the next points to stream
+	 *
+	 * The answer is a call to addPoints(). Indices wrap at the end of the
+	 * sequence
+	 * \param first the index of the first point
+	 * \param count the number of points
+	 * \param generation the generation to pass back to addPoints()
+	 */
+	void pointsRequested(int first, int count, int generation);
+
+	/**
+	 * \brief The signal emitted when the hardware has finished playing
+	 *        the stream
+	 */
+	void streamEnded();
+
+	/**
+	 * \brief The signal emitted if there is an error writing or reading
+	 *        from the serial port
+	 *
+	 * \param error a description of the error
+	 */
+	void streamError(QString error);
+
+	/**
+	 * \brief The signal emitted when we receive a debug message from the
+	 *        hardware
+	 *
+	 * \param msg the message the hardware sent
+	 */
+	void debugMessage(QString msg);
+
+	/**
+	 * \brief The signal emitted when the battery charge changes
+	 *
+	 * \param charge the battery charge in percentage or -1 if unknown
+	 */
+	void batteryChargeChanged(float charge);
+
+	/**
+	 * \brief The signal emitted when the hardware tells how many points it
+	 *        can buffer
+	 *
+	 * \param depth the number of points the hardware can buffer
+	 */
+	void bufferDepthReceived(int depth);
+
+	/**
+	 * \brief The signal emitted when the number of corrupted frames changes
+	 *
+	 * \param count the number of corrupted frames since the port was
+	 *              opened
+	 */
+	void corruptedFramesChanged(int count);
+
+	/**
+	 * \brief The signal emitted when a faster baud rate has been negotiated
+	 *        and verified
+	 *
+	 * \param baudRate the new baud rate of the link
+	 */
+	void linkBaudRateChanged(int baudRate);
+
+	/**
+	 * \brief The signal emitted when the hardware signals the end of a
+	 *        stream
+	 *
+	 * \param pointsPerSecond the number of points sent per second from the
+	 *                        start to the end of the stream
+	 */
+	void streamRateMeasured(float pointsPerSecond);
+
+	/**
+	 * \brief The signal emitted with updated latency histograms
+	 *
+	 * This is emitted at most twice per second if histograms changed and
+	 * when a stream ends
+	 * \param roundTripTimes the round trip times of ping packets
+	 * \param creditIntervals the times between credit (or "buffer not
+	 *                        full") packets in stream mode
+	 * \param underrunDurations the durations of the underruns reported by
+	 *                          the hardware
+	 */
+	void latencyStatisticsChanged(LatencyHistogram roundTripTimes, LatencyHistogram creditIntervals, LatencyHistogram underrunDurations);
+
+	/**
+	 * \brief The signal emitted when a telemetry packet is received
+	 *
+	 * \param sample the decoded telemetry packet
+	 */
+	void telemetryReceived(TelemetrySample sample);
+
+private slots:
+	/**
+	 * \brief The slot called when there is data ready to be read
+	 */
+	void handleReadyRead();
+
+	/**
+	 * \brief The function called when there is an error in the serial
+	 *        communication
+	 *
+	 * \param error the error code
+	 */
+	void handleError(QSerialPort::SerialPortError error);
+
+	/**
+	 * \brief The slot called a second after the serial port is opened to
+	 *        start sending data
+	 *
+	 * This is needed to give Arduino time to boot. If a stream was requested
+	 * while Arduino was booting, it is started here. This is also called
+	 * directly by startStream() and startImmediate() when Arduino has
+	 * already booted. If the link speed has to be negotiated, this only
+	 * starts negotiation and is called again when it ends
+	 */
+	void arduinoBootFinished();
+
+	/**
+	 * \brief The slot called when the hardware doesn't answer during link
+	 *        speed negotiation or when the hardware has gone back to the
+	 *        starting baud rate
+	 */
+	void linkTimeout();
+
+	/**
+	 * \brief The slot called when we had no credits for
+	 *        creditResyncTimeout milliseconds in stream mode
+	 *
+	 * A credit packet from the hardware could have been lost, so we ask
+	 * the hardware for the absolute number of credits we have. This is
+	 * repeated until the stream can go on
+	 */
+	void creditTimeout();
+
+	/**
+	 * \brief The slot called periodically to send a ping packet
+	 */
+	void sendPing();
+
+	/**
+	 * \brief Emits latencyStatisticsChanged() if histograms changed since
+	 *        the last time
+	 */
+	void publishLatencyStatistics();
+
+private:
+	/**
+	 * \brief The possible modalities
+	 */
+	enum class Mode {
+		Idle,
+		Stream,
+		Immediate
+	};
+
+	/**
+	 * \brief The possible states of the decoder of incoming packets
+	 */
+	enum class DecoderState {
+		PacketType,
+		DebugLength,
+		DebugMessage,
+		BatteryCharge,
+		Credits,
+		CreditResync,
+		BufferDepth,
+		LinkSpeed,
+		LinkTest,
+		PingEcho,
+		UnderrunHigh,
+		UnderrunLow,
+		Telemetry
+	};
+
+	/**
+	 * \brief The possible states of the link
+	 */
+	enum class LinkState {
+		Booting,
+		Negotiating,
+		Testing,
+		Confirming,
+		Reverting,
+		Ready
+	};
+
+	/**
+	 * \brief A point sent in the current stream
+	 */
+	struct SentPoint {
+		/**
+		 * \brief The index of the point in the sequence
+		 */
+		int index;
+
+		/**
+		 * \brief The duration of the point
+		 */
+		int duration;
+
+		/**
+		 * \brief The time to target of the point
+		 */
+		int timeToTarget;
+	};
+
+	/**
+	 * \brief Processes received packets
+	 *
+	 * This consumes all bytes in m_incomingData, running the decoder state
+	 * machines
+	 */
+	void processReceivedPackets();
+
+	/**
+	 * \brief Processes one byte received in framed mode
+	 *
+	 * When a valid frame is complete, its payload is passed to
+	 * decodePacketByte(). Once a valid frame has been received, bytes
+	 * received between frames mean that the sync byte of a frame was lost
+	 * and are counted as one corrupted frame
+	 * \param c the byte received
+	 */
+	void decodeFrameByte(char c);
+
+	/**
+	 * \brief Decodes one byte of a packet
+	 *
+	 * \param c the byte to decode
+	 */
+	void decodePacketByte(char c);
+
+	/**
+	 * \brief Processes a "frame discarded" packet
+	 *
+	 * The hardware lost a frame, the next point must be sent as a full
+	 * sequence packet
+	 */
+	void processFrameDiscarded();
+
+	/**
+	 * \brief Counts a corrupted frame and emits corruptedFramesChanged()
+	 *
+	 * The next point is sent as a full sequence packet, the lost frame could
+	 * have been a 'K' packet from the hardware
+	 */
+	void countCorruptedFrame();
+
+	/**
+	 * \brief Processes the answer to a credit resync request
+	 *
+	 * \param credits the absolute number of credits we have
+	 */
+	void processCreditResync(int credits);
+
+	/**
+	 * \brief Starts negotiating the link speed
+	 *
+	 * This sends a link speed packet with the fastest speed that is allowed
+	 * by m_maxBaudRate and faster than the starting baud rate
+	 * \return false if there is nothing to negotiate
+	 */
+	bool startLinkNegotiation();
+
+	/**
+	 * \brief Processes a link speed packet
+	 *
+	 * The hardware has switched to the given speed, we do the same and send
+	 * the link test packet
+	 * \param speed the link speed agreed by the hardware
+	 */
+	void processLinkSpeed(int speed);
+
+	/**
+	 * \brief Processes the echo of the link test packet
+	 *
+	 * If the echo is correct we ask the hardware to keep the new baud rate
+	 * (see sendLinkConfirm()), otherwise both sides go back to the starting
+	 * one
+	 */
+	void processLinkTestEcho();
+
+	/**
+	 * \brief Sends a link confirm packet
+	 *
+	 * The hardware keeps the new baud rate only if it receives this packet
+	 * and answers with the same packet. The packet is sent again if the
+	 * answer does not arrive in time, see linkTimeout()
+	 */
+	void sendLinkConfirm();
+
+	/**
+	 * \brief Processes the answer to the link confirm packet
+	 *
+	 * Both sides now use the new baud rate
+	 */
+	void processLinkConfirmed();
+
+	/**
+	 * \brief Goes back to the starting baud rate after a failed link test
+	 */
+	void linkTestFailed();
+
+	/**
+	 * \brief Ends link speed negotiation and starts what was requested
+	 *        meanwhile
+	 */
+	void linkReady();
+
+	/**
+	 * \brief Processes the echo of a ping packet, adding the round trip time
+	 *        to the histogram
+	 */
+	void processPingEcho();
+
+	/**
+	 * \brief Sends the telemetry rate to the hardware
+	 */
+	void sendTelemetryRate();
+
+	/**
+	 * \brief Processes a telemetry packet, emitting telemetryReceived()
+	 */
+	void processTelemetry();
+
+	/**
+	 * \brief Processes a "sequence buffer not full" packet
+	 *
+	 * This is sent by firmware without flow control credits and is
+	 * equivalent to a credit for a single point
+	 */
+	void processBufferNotFull();
+
+	/**
+	 * \brief Processes a "sequence buffer full" packet
+	 *
+	 * This is sent by firmware without flow control credits. We only have
+	 * to wait for the next "sequence buffer not full" packet
+	 */
+	void processBufferFull();
+
+	/**
+	 * \brief Processes a "stream accepted" packet
+	 *
+	 * \param depth the number of points the hardware can buffer
+	 */
+	void processStreamAccepted(int depth);
+
+	/**
+	 * \brief Processes a credits packet
+	 *
+	 * The hardware grants us the given number of additional slots in its
+	 * queue. If we know the depth of the queue, credits never exceed it
+	 * \param credits the number of new credits
+	 */
+	void processCredits(int credits);
+
+	/**
+	 * \brief Sends points while we have credits
+	 *
+	 * Nothing is sent if we are paused or stopping. Points are requested
+	 * when the window is half empty
+	 */
+	void sendAvailablePoints();
+
+	/**
+	 * \brief Asks for the points following the window if it is half empty
+	 *
+	 * Nothing is asked if a request is already pending
+	 */
+	void requestPoints();
+
+	/**
+	 * \brief Drops the window and any pending request
+	 */
+	void dropWindow();
+
+	/**
+	 * \brief Processes a "sequence finished" packet
+	 *
+	 * If the stream is paused, the packet is recorded to be processed when
+	 * the stream is resumed
+	 */
+	void processSequenceEnded();
+
+	/**
+	 * \brief Processes the packets received while the stream was paused
+	 */
+	void processDeferredPackets();
+
+	/**
+	 * \brief Resets the decoder, the buffer of incoming data and the
+	 *        packets deferred during pause
+	 */
+	void resetDecoder();
+
+	/**
+	 * \brief Sends the next point of the stream and moves forward
+	 *
+	 * The window must not be empty. If we reach the end of the sequence and this is a one-shot stream,
+	 * the stream is stopped
+	 */
+	void streamNextPoint();
+
+	/**
+	 * \brief Returns the packet to send for the given sequence packet
+	 *
+	 * This is a delta sequence packet relative to m_lastSentPoint if the
+	 * hardware supports them and the delta packet is shorter, otherwise
+	 * it is the sequence packet itself
+	 * \param point the sequence packet of the point to send
+	 * \return the packet to send
+	 */
+	QByteArray encodePoint(const QByteArray& point) const;
+
+	/**
+	 * \brief Resets the state of the stream and returns to idle
+	 */
+	void endStream();
+
+	/**
+	 * \brief Publishes the index of the next point to stream
+	 *
+	 * This stores the position and emits streamPositionChanged() if the
+	 * previous notification has already been taken
+	 */
+	void publishStreamPosition();
+
+	/**
+	 * \brief The function that actually sends data
+	 *
+	 * In framed mode the data is sent inside a frame, so this must be
+	 * called with exactly one packet
+	 * \param dataToSend the data to send through the serial port
+	 */
+	void sendData(const QByteArray& dataToSend);
+
+	/**
+	 * \brief Changes the value of the battery charge and emits the changed
+	 *        signal if needed
+	 *
+	 * \param v the new value of the battery charge (if negative, -1.0 is
+	 *          used)
+	 */
+	void setBatteryCharge(float v);
+
+	/**
+	 * \brief The serial communication port
+	 *
+	 * This is a child of this object so that it is moved with us to other
+	 * threads
+	 */
+	QSerialPort m_serialPort;
+
+	/**
+	 * \brief The timer to wait for Arduino boot to finish
+	 *
+	 * This is a child of this object so that it is moved with us to other
+	 * threads. See arduinoBootFinished() description
+	 */
+	QTimer m_arduinoBoot;
+
+	/**
+	 * \brief The timer for the steps of link speed negotiation
+	 *
+	 * This is a child of this object so that it is moved with us to other
+	 * threads
+	 */
+	QTimer m_linkTimer;
+
+	/**
+	 * \brief The state of the link
+	 *
+	 * Nothing but link speed packets is sent until this is Ready
+	 */
+	LinkState m_linkState;
+
+	/**
+	 * \brief The baud rate the hardware starts with
+	 */
+	int m_startBaudRate;
+
+	/**
+	 * \brief The maximum baud rate to negotiate
+	 */
+	int m_maxBaudRate;
+
+	/**
+	 * \brief The current baud rate of the link
+	 */
+	int m_linkBaudRate;
+
+	/**
+	 * \brief The echo of the link test packet being received
+	 */
+	QByteArray m_linkTestEcho;
+
+	/**
+	 * \brief The number of link confirm packets sent without an answer
+	 */
+	int m_linkConfirmAttempts;
+
+	/**
+	 * \brief The timer to send ping packets
+	 *
+	 * This is a child of this object so that it is moved with us to other
+	 * threads
+	 */
+	QTimer m_pingTimer;
+
+	/**
+	 * \brief The interval between ping packets in milliseconds, 0 if pings
+	 *        are not sent
+	 */
+	int m_pingInterval;
+
+	/**
+	 * \brief The echo of the ping packet being received
+	 */
+	QByteArray m_pingEcho;
+
+	/**
+	 * \brief The duration of the underrun packet being received
+	 */
+	int m_underrunDuration;
+
+	/**
+	 * \brief The clock for all latency measurements
+	 */
+	QElapsedTimer m_latencyClock;
+
+	/**
+	 * \brief The timer to publish latency statistics
+	 *
+	 * This is a child of this object so that it is moved with us to other
+	 * threads
+	 */
+	QTimer m_latencyTimer;
+
+	/**
+	 * \brief True if latency histograms changed since they were last
+	 *        published
+	 */
+	bool m_latencyChanged;
+
+	/**
+	 * \brief The histogram of round trip times of ping packets
+	 */
+	LatencyHistogram m_roundTripTimes;
+
+	/**
+	 * \brief The histogram of the times between credit packets
+	 */
+	LatencyHistogram m_creditIntervals;
+
+	/**
+	 * \brief The histogram of the durations of underruns
+	 */
+	LatencyHistogram m_underrunDurations;
+
+	/**
+	 * \brief The time in microseconds of m_latencyClock at which the last
+	 *        credit packet of the stream was received, -1 if none
+	 */
+	qint64 m_lastCreditTime;
+
+	/**
+	 * \brief The number of telemetry packets per second the hardware should
+	 *        send, 0 if telemetry is disabled
+	 */
+	int m_telemetryRate;
+
+	/**
+	 * \brief The telemetry packet being received, without the packet type
+	 */
+	QByteArray m_telemetryPacket;
+
+	/**
+	 * \brief Whether packets are sent and received inside frames
+	 */
+	bool m_framed;
+
+	/**
+	 * \brief The current modality
+	 */
+	Mode m_mode;
+
+	/**
+	 * \brief The dimension of points
+	 */
+	int m_pointDim;
+
+	/**
+	 * \brief The number of points in the sequence being streamed
+	 */
+	int m_numPoints;
+
+	/**
+	 * \brief The sequence packets of the next points to stream
+	 *
+	 * The first element is the point with index m_nextPoint, indices wrap
+	 * at the end of the sequence
+	 */
+	RingBuffer<QByteArray, pointWindow> m_window;
+
+	/**
+	 * \brief The generation of the window
+	 *
+	 * This is incremented each time the window is dropped
+	 */
+	int m_windowGeneration;
+
+	/**
+	 * \brief True if we asked for points and are waiting for them
+	 */
+	bool m_pointsRequested;
+
+	/**
+	 * \brief The last point that was requested to be sent in immediate
+	 *        mode, if any
+	 */
+	QByteArray m_immediatePoint;
+
+	/**
+	 * \brief The index in the sequence of the next point to stream
+	 */
+	int m_nextPoint;
+
+	/**
+	 * \brief Whether the stream is played only once or continuously
+	 */
+	bool m_oneShot;
+
+	/**
+	 * \brief If true streaming is paused in stream mode
+	 */
+	bool m_paused;
+
+	/**
+	 * \brief The number of points we can send without overflowing the queue
+	 *        of the hardware
+	 *
+	 * This is incremented by credits packets (and by "sequence buffer not
+	 * full" packets from older firmware) and decremented for each point we
+	 * send. Credits received while paused are kept and used when the stream
+	 * is resumed
+	 */
+	int m_credits;
+
+	/**
+	 * \brief The timer asking the hardware for credits when we had none for
+	 *        a while
+	 *
+	 * This is a child of this object so that it is moved with us to other
+	 * threads. See creditTimeout()
+	 */
+	QTimer m_creditTimer;
+
+	/**
+	 * \brief True if we asked the hardware for the absolute number of
+	 *        credits and are waiting for the answer
+	 *
+	 * Credit packets received in the meantime are ignored, they are
+	 * included in the answer
+	 */
+	bool m_creditResync;
+
+	/**
+	 * \brief The number of points the hardware can buffer
+	 *
+	 * This is received in the "stream accepted" packet and limits the
+	 * number of points in flight. It is 0 if unknown (older firmware does
+	 * not send it)
+	 */
+	int m_bufferDepth;
+
+	/**
+	 * \brief The sequence packet of the last point sent in stream mode
+	 *
+	 * This is always the full packet, even if a delta packet was sent.
+	 * Delta packets are computed relative to this. It is empty if no point
+	 * has been sent in the current stream
+	 */
+	QByteArray m_lastSentPoint;
+
+	/**
+	 * \brief True if we have sent a stop sequence packet and are waiting
+	 *        for the end of the sequence
+	 */
+	bool m_stopping;
+
+	/**
+	 * \brief The buffer of data from the serial port
+	 */
+	RingBuffer<char, 4096> m_incomingData;
+
+	/**
+	 * \brief The current state of the decoder
+	 *
+	 * This is PacketType when we are waiting for a new packet, otherwise it
+	 * tells which part of a packet we expect next
+	 */
+	DecoderState m_decoderState;
+
+	/**
+	 * \brief The length of the debug message being received
+	 */
+	int m_debugMessageLength;
+
+	/**
+	 * \brief The debug message being received
+	 */
+	QByteArray m_debugMessage;
+
+	/**
+	 * \brief True if we received the sync byte of a frame and are
+	 *        receiving it
+	 */
+	bool m_frameStarted;
+
+	/**
+	 * \brief True if a valid frame has been received since the decoder was
+	 *        reset
+	 *
+	 * Before that, bytes between frames can be packets the hardware sent
+	 * before switching to framed mode
+	 */
+	bool m_frameSynchronized;
+
+	/**
+	 * \brief True if bytes are discarded until the next sync byte
+	 *
+	 * This happens after a frame has been counted as corrupted before its
+	 * end
+	 */
+	bool m_frameDiscarding;
+
+	/**
+	 * \brief True if the previous byte of the frame was the escape byte
+	 */
+	bool m_frameEscape;
+
+	/**
+	 * \brief The frame being received, without the sync byte and unescaped
+	 */
+	QByteArray m_frame;
+
+	/**
+	 * \brief The number of corrupted frames since the port was opened
+	 */
+	int m_corruptedFrames;
+
+	/**
+	 * \brief The timer measuring the duration of the current stream
+	 */
+	QElapsedTimer m_streamTimer;
+
+	/**
+	 * \brief The number of points sent in the current stream
+	 */
+	int m_streamedPoints;
+
+	/**
+	 * \brief The last points sent in the current stream
+	 *
+	 * This is used to find the point the hardware is playing from the number
+	 * of points it started. The hardware never lags behind by more than the
+	 * depth of its buffer, so only the last points are kept
+	 */
+	RingBuffer<SentPoint, 256> m_sentPoints;
+
+	/**
+	 * \brief True if the "sequence finished" packet was received while
+	 *        paused
+	 */
+	bool m_deferredSequenceEnded;
+
+	/**
+	 * \brief The current charge level of the battery
+	 */
+	float m_batteryCharge;
+
+	/**
+	 * \brief The last published index of the next point to stream
+	 *
+	 * This is read by takeStreamPosition() from other threads
+	 */
+	QAtomicInt m_streamPosition;
+
+	/**
+	 * \brief 1 if streamPositionChanged() was emitted and
+	 *        takeStreamPosition() has not been called yet
+	 */
+	QAtomicInt m_streamPositionPending;
+
+	/**
+	 * \brief The trace of packets exchanged with the hardware
+	 */
+	PacketTrace m_packetTrace;
+};
+
+#endif // SERIALWORKER_H
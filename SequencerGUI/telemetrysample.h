@@ -0,0 +1,150 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#ifndef TELEMETRYSAMPLE_H
+#define TELEMETRYSAMPLE_H
+
+#include <QMetaType>
+#include <QVector>
+
+/**
+ * \brief The state of the hardware reported by a telemetry packet
+ *
+ * The hardware sends telemetry packets periodically when asked to (see the
+ * telemetryRate property of SerialCommunication). The number of the point
+ * being played is mapped to the index of the point in the streamed sequence
+ * and the timing of that point, as authored in the sequence, is added, so
+ * that the actual timing can be compared with the expected one. This is a
+ * plain value, so it can be stored in ring buffers and passed in queued
+ * signals.
+ */
+struct TelemetrySample
+{
+	/**
+	 * \brief The phases of the point being played
+	 *
+	 * NoPoint means that the buffer of the hardware is empty. In the Moving
+	 * phase servos move towards the position of the point, in the Holding
+	 * phase they have reached it and wait for the end of the point. The
+	 * values are those sent by the hardware
+	 */
+	enum Phase {
+		NoPoint = 0,
+		Moving = 1,
+		Holding = 2
+	};
+
+	/**
+	 * \brief Constructor
+	 *
+	 * Creates a sample with no point being played
+	 */
+	TelemetrySample()
+		: time(0)
+		, startedPoints(0)
+		, sequenceIndex(-1)
+		, duration(-1)
+		, timeToTarget(-1)
+		, phase(NoPoint)
+		, pointTime(0)
+		, tickOverruns(0)
+		, maxLateness(0)
+		, maxTickDuration(0)
+		, pwm()
+	{
+	}
+
+	/**
+	 * \brief The time at which the packet was received, in milliseconds
+	 *        since the serial port was opened
+	 */
+	qint64 time;
+
+	/**
+	 * \brief The number of points the hardware started since the stream
+	 *        started
+	 *
+	 * The hardware only sends the lower 16 bits
+	 */
+	int startedPoints;
+
+	/**
+	 * \brief The index in the sequence of the point being played
+	 *
+	 * This is -1 if no point is being played, if we are not streaming or if
+	 * the point cannot be found among those recently sent
+	 */
+	int sequenceIndex;
+
+	/**
+	 * \brief The duration of the point being played as authored in the
+	 *        sequence, in milliseconds
+	 *
+	 * This is -1 if sequenceIndex is -1
+	 */
+	int duration;
+
+	/**
+	 * \brief The time to target of the point being played as authored in
+	 *        the sequence, in milliseconds
+	 *
+	 * This is -1 if sequenceIndex is -1
+	 */
+	int timeToTarget;
+
+	/**
+	 * \brief The phase of the point being played
+	 */
+	Phase phase;
+
+	/**
+	 * \brief The time since the point being played started, in
+	 *        milliseconds
+	 */
+	int pointTime;
+
+	/**
+	 * \brief The number of control ticks of the hardware that ended late
+	 *        since the stream started
+	 */
+	int tickOverruns;
+
+	/**
+	 * \brief The maximum lateness of point starts since the stream started,
+	 *        in microseconds
+	 */
+	int maxLateness;
+
+	/**
+	 * \brief The maximum duration of a control tick of the hardware since
+	 *        the previous sample, in microseconds
+	 */
+	int maxTickDuration;
+
+	/**
+	 * \brief The PWM last sent to each servo
+	 */
+	QVector<int> pwm;
+};
+
+Q_DECLARE_METATYPE(TelemetrySample)
+
+#endif // TELEMETRYSAMPLE_H
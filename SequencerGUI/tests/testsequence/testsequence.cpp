@@ -0,0 +1,114 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <QtTest/QtTest>
+#include "sequence.h"
+
+/**
+ * \brief The class to perform unit tests of Sequence
+ *
+ * Each private slot is a test
+ */
+class TestSequence : public QObject
+{
+	Q_OBJECT
+
+private:
+	/**
+	 * \brief Creates a sequence with two coordinates and three points
+	 *
+	 * \param sequence the sequence to fill
+	 */
+	void fillSequence(Sequence& sequence)
+	{
+		sequence.append();
+		sequence.append();
+		sequence.append();
+	}
+
+private slots:
+	void groupedSettersEmitOneRangeNotification()
+	{
+		Sequence sequence(2, SequencePoint(QVector<double>{0, 0}, 0, 0), SequencePoint(QVector<double>{255, 255}, 10000, 10000));
+		fillSequence(sequence);
+
+		QSignalSpy pointsSpy(&sequence, SIGNAL(pointsChanged(int,int)));
+		QSignalSpy valuesSpy(&sequence, SIGNAL(pointValuesChanged(int)));
+
+		sequence.beginUpdate();
+		sequence.setPoint(0, SequencePoint(QVector<double>{10, 20}, 100, 50));
+		sequence.setPointCoordinate(1, 0, 30);
+		sequence.setDuration(2, 200);
+		sequence.setTimeToTarget(1, 80);
+
+		QCOMPARE(pointsSpy.count(), 0);
+		QCOMPARE(valuesSpy.count(), 0);
+
+		sequence.endUpdate();
+
+		QCOMPARE(pointsSpy.count(), 1);
+		QCOMPARE(pointsSpy.at(0).at(0).toInt(), 0);
+		QCOMPARE(pointsSpy.at(0).at(1).toInt(), 2);
+		QCOMPARE(valuesSpy.count(), 3);
+		QVERIFY(sequence.isModified());
+	}
+
+	void coalescedSettersEmitOneRangeNotification()
+	{
+		Sequence sequence(2, SequencePoint(QVector<double>{0, 0}, 0, 0), SequencePoint(QVector<double>{255, 255}, 10000, 10000));
+		fillSequence(sequence);
+		sequence.setCoalesceUpdates(true);
+
+		QSignalSpy pointsSpy(&sequence, SIGNAL(pointsChanged(int,int)));
+
+		sequence.setPointCoordinate(0, 1, 40);
+		sequence.setDuration(1, 300);
+
+		QCOMPARE(pointsSpy.count(), 0);
+		QTRY_COMPARE(pointsSpy.count(), 1);
+		QCOMPARE(pointsSpy.at(0).at(0).toInt(), 0);
+		QCOMPARE(pointsSpy.at(0).at(1).toInt(), 1);
+	}
+
+	void saveFlushesPendingNotifications()
+	{
+		Sequence sequence(2, SequencePoint(QVector<double>{0, 0}, 0, 0), SequencePoint(QVector<double>{255, 255}, 10000, 10000));
+		fillSequence(sequence);
+		sequence.save();
+
+		QSignalSpy pointsSpy(&sequence, SIGNAL(pointsChanged(int,int)));
+
+		sequence.beginUpdate();
+		sequence.setDuration(0, 500);
+		sequence.save();
+
+		QCOMPARE(pointsSpy.count(), 1);
+		QVERIFY(!sequence.isModified());
+
+		sequence.endUpdate();
+
+		QCOMPARE(pointsSpy.count(), 1);
+		QVERIFY(!sequence.isModified());
+	}
+};
+
+QTEST_MAIN(TestSequence)
+#include "testsequence.moc"
@@ -0,0 +1,21 @@
+TEMPLATE = app
+
+QT += core testlib
+QT -= gui
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -std=c++11 -Wall -Wextra
+
+# The test uses the Sequence class of SequencerGUI
+INCLUDEPATH += ../..
+
+SOURCES += testsequence.cpp \
+    ../../sequence.cpp \
+    ../../sequencepoint.cpp
+
+HEADERS += \
+    ../../sequence.h \
+    ../../sequencepoint.h \
+    ../../utils.h
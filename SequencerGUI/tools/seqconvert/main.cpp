@@ -0,0 +1,87 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include "sequence.h"
+
+/**
+ * \file main.cpp
+ *
+ * A command line tool to convert sequences between the JSON and the binary
+ * format. The format of both the input and the output file is chosen from the
+ * extension: files with the .seqb extension are binary sequences, all other
+ * files are JSON sequences. The conversion is lossless for valid sequences:
+ * coordinates are stored as doubles in binary files unless they are all
+ * integers between 0 and 255.
+ */
+
+namespace {
+	/**
+	 * \brief The exit codes of the program
+	 */
+	enum ExitCode {
+		Success = 0,
+		InvalidArguments = 1,
+		LoadError = 2,
+		SaveError = 3
+	};
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("seqconvert");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Converts sequences between the JSON (.seq) and the binary (.seqb) format");
+	parser.addHelpOption();
+	parser.addPositionalArgument("input", "The sequence file to read");
+	parser.addPositionalArgument("output", "The sequence file to write");
+	parser.process(app);
+
+	QTextStream err(stderr);
+
+	const QStringList args = parser.positionalArguments();
+	if (args.size() != 2) {
+		err << "Expected an input and an output file" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	const QString input = args[0];
+	const QString output = args[1];
+
+	// Loading the sequence
+	std::unique_ptr<Sequence> sequence = Sequence::isBinaryFilename(input) ? Sequence::loadBinary(input) : Sequence::load(input);
+	if (!sequence->isValid()) {
+		err << "Cannot load sequence from " << input << endl;
+		return LoadError;
+	}
+
+	// Saving the sequence
+	const bool saved = Sequence::isBinaryFilename(output) ? sequence->saveBinary(output) : sequence->save(output);
+	if (!saved) {
+		err << "Cannot save sequence to " << output << endl;
+		return SaveError;
+	}
+
+	return Success;
+}
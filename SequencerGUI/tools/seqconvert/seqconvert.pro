@@ -0,0 +1,21 @@
+TEMPLATE = app
+
+QT += core
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -std=c++11 -Wall -Wextra
+
+# The tool uses the Sequence class of SequencerGUI
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../sequence.cpp \
+    ../../sequencepoint.cpp
+
+HEADERS += \
+    ../../sequence.h \
+    ../../sequencepoint.h \
+    ../../utils.h
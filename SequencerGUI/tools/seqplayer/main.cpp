@@ -0,0 +1,266 @@
+/******************************************************************************
+ * SequencerGUI                                                               *
+ * Copyright (C) 2015                                                         *
+ * Tomassino Ferrauto <t_ferrauto@yahoo.it>                                   *
+ * Luca Anastasio <anastasio.lu@gmail.com>                                    *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation; either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA *
+ ******************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+#include <QTimer>
+#include "sequence.h"
+#include "serialcommunication.h"
+
+/**
+ * \file main.cpp
+ *
+ * A command line tool to stream a sequence to the robot without the graphical
+ * interface. The sequence is loaded (files with the .seqb extension are
+ * memory mapped as binary sequences, all other files are read as JSON
+ * sequences), the serial port is opened and the sequence is streamed once or
+ * in a loop. In loop mode the program runs until the optional duration
+ * elapses or it is killed. When the stream is stopped (at the end of the
+ * duration or because of an error), the robot plays the points it has buffered
+ * before confirming; if it does not confirm within the stop timeout the port
+ * is closed anyway. The exit code tells whether the sequence was played
+ * successfully. Packets exchanged with the robot can be written to a file for
+ * debugging, latency histograms can be saved as CSV to tune the link and the
+ * telemetry of the robot can be saved as CSV to compare the actual timing of
+ * points with the one of the sequence.
+ */
+
+namespace {
+	/**
+	 * \brief The exit codes of the program
+	 */
+	enum ExitCode {
+		Success = 0,
+		InvalidArguments = 1,
+		LoadError = 2,
+		PortError = 3,
+		StreamError = 4
+	};
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("seqplayer");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Streams a sequence to the robot");
+	parser.addHelpOption();
+	parser.addPositionalArgument("sequence", "The sequence file to play");
+	QCommandLineOption portOption(QStringList() << "p" << "port", "The serial port to use", "port");
+	parser.addOption(portOption);
+	QCommandLineOption baudOption(QStringList() << "b" << "baud", "The baud rate of the serial port (default: 115200)", "rate", "115200");
+	parser.addOption(baudOption);
+	QCommandLineOption loopOption(QStringList() << "l" << "loop", "Plays the sequence in a loop instead of once");
+	parser.addOption(loopOption);
+	QCommandLineOption durationOption(QStringList() << "d" << "duration", "Stops playing after the given number of seconds (0 means no limit)", "seconds", "0");
+	parser.addOption(durationOption);
+	QCommandLineOption stopTimeoutOption(QStringList() << "o" << "stop-timeout", "How many seconds to wait for the robot to finish the sequence after stopping it before giving up (default: 30)", "seconds", "30");
+	parser.addOption(stopTimeoutOption);
+	QCommandLineOption threadOption(QStringList() << "t" << "io-thread", "Performs serial I/O in a separate thread");
+	parser.addOption(threadOption);
+	QCommandLineOption framedOption("framed", "Sends packets inside frames, detecting corrupted data (older firmware does not support them)");
+	parser.addOption(framedOption);
+	QCommandLineOption maxBaudOption(QStringList() << "m" << "max-baud", "The maximum baud rate to negotiate with the robot (default: 1000000)", "rate", "1000000");
+	parser.addOption(maxBaudOption);
+	QCommandLineOption traceOption(QStringList() << "r" << "trace", "Writes the packets exchanged with the robot to the given file", "file");
+	parser.addOption(traceOption);
+	QCommandLineOption pingOption(QStringList() << "i" << "ping", "Sends a ping to the robot every given number of milliseconds to measure the round trip time (default: 0, no pings)", "ms", "0");
+	parser.addOption(pingOption);
+	QCommandLineOption latencyOption(QStringList() << "s" << "latency", "Saves latency histograms to the given CSV file at exit", "file");
+	parser.addOption(latencyOption);
+	QCommandLineOption telemetryOption(QStringList() << "e" << "telemetry", "Asks the robot for telemetry and saves the last samples to the given CSV file at exit", "file");
+	parser.addOption(telemetryOption);
+	QCommandLineOption telemetryRateOption(QStringList() << "f" << "telemetry-rate", "The number of telemetry packets per second the robot sends when --telemetry is given (default: 20)", "rate", "20");
+	parser.addOption(telemetryRateOption);
+	parser.process(app);
+
+	QTextStream err(stderr);
+
+	const QStringList args = parser.positionalArguments();
+	if (args.size() != 1) {
+		err << "Expected a sequence file" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	if (!parser.isSet(portOption)) {
+		err << "The serial port must be specified" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	bool baudOk = false;
+	const int baudRate = parser.value(baudOption).toInt(&baudOk);
+	bool maxBaudOk = false;
+	const int maxBaudRate = parser.value(maxBaudOption).toInt(&maxBaudOk);
+	bool durationOk = false;
+	const int duration = parser.value(durationOption).toInt(&durationOk);
+	bool stopTimeoutOk = false;
+	const int stopTimeout = parser.value(stopTimeoutOption).toInt(&stopTimeoutOk);
+	bool pingOk = false;
+	const int pingInterval = parser.value(pingOption).toInt(&pingOk);
+	bool telemetryRateOk = false;
+	const int telemetryRate = parser.value(telemetryRateOption).toInt(&telemetryRateOk);
+	if (!baudOk || (baudRate <= 0)) {
+		err << "Invalid baud rate" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	if (!maxBaudOk) {
+		err << "Invalid maximum baud rate" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	if (!durationOk || (duration < 0)) {
+		err << "Invalid duration" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	if (!stopTimeoutOk || (stopTimeout <= 0)) {
+		err << "Invalid stop timeout" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	if (!pingOk || (pingInterval < 0)) {
+		err << "Invalid ping interval" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	if (!telemetryRateOk || (telemetryRate <= 0) || (telemetryRate > 255)) {
+		err << "Invalid telemetry rate" << endl;
+		parser.showHelp(InvalidArguments);
+	}
+	const QString filename = args[0];
+
+	// Loading the sequence
+	std::unique_ptr<Sequence> sequence = Sequence::isBinaryFilename(filename) ? Sequence::map(filename) : Sequence::load(filename);
+	if (!sequence->isValid() || (sequence->numPoints() == 0)) {
+		err << "Cannot load sequence from " << filename << " or sequence is empty" << endl;
+		return LoadError;
+	}
+
+	// Opening the serial port
+	SerialCommunication serialCommunication;
+	serialCommunication.setUseIOThread(parser.isSet(threadOption));
+	serialCommunication.setFramedProtocol(parser.isSet(framedOption));
+	serialCommunication.setSerialPortName(parser.value(portOption));
+	serialCommunication.setBaudRate(baudRate);
+	serialCommunication.setMaxBaudRate(maxBaudRate);
+	serialCommunication.setPingInterval(pingInterval);
+	if (parser.isSet(telemetryOption)) {
+		serialCommunication.setTelemetryRate(telemetryRate);
+	}
+	serialCommunication.setOneShotSequence(!parser.isSet(loopOption));
+	if (!serialCommunication.openSerial()) {
+		err << "Cannot open serial port " << serialCommunication.serialPortName() << endl;
+		return PortError;
+	}
+
+	// Opening the trace file, if requested. The trace is moved to the file
+	// periodically, so that it doesn't fill up
+	QFile traceFile;
+	QTextStream trace;
+	QTimer traceTimer;
+	if (parser.isSet(traceOption)) {
+		traceFile.setFileName(parser.value(traceOption));
+		if (!traceFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+			err << "Cannot open trace file " << traceFile.fileName() << endl;
+			return InvalidArguments;
+		}
+		trace.setDevice(&traceFile);
+
+		serialCommunication.setPacketTrace(true);
+		QObject::connect(&traceTimer, &QTimer::timeout, [&]() {
+			trace << serialCommunication.dumpPacketTrace();
+		});
+		traceTimer.start(100);
+	}
+
+	// Stopping the stream. The robot plays the points it has buffered and
+	// then tells us the sequence is finished. If it doesn't (dead port or
+	// silent robot), the port is closed after the stop timeout
+	int exitCode = Success;
+	QTimer stopTimer;
+	stopTimer.setSingleShot(true);
+	QObject::connect(&stopTimer, &QTimer::timeout, [&]() {
+		err << "The robot did not finish the sequence after stopping it, closing the port" << endl;
+
+		exitCode = StreamError;
+		serialCommunication.abortSerial();
+	});
+	auto stopStream = [&]() {
+		if (!stopTimer.isActive() && serialCommunication.stop()) {
+			stopTimer.start(stopTimeout * 1000);
+		}
+	};
+
+	// Errors stop the stream, the program terminates when streaming ends
+	QObject::connect(&serialCommunication, &SerialCommunication::streamError, [&](QString error) {
+		err << error << endl;
+
+		exitCode = StreamError;
+		stopStream();
+	});
+	QObject::connect(&serialCommunication, &SerialCommunication::isStreamingChanged, [&]() {
+		if (!serialCommunication.isStreaming()) {
+			app.exit(exitCode);
+		}
+	});
+
+	// Stopping after the given time, if requested
+	QTimer durationTimer;
+	durationTimer.setSingleShot(true);
+	QObject::connect(&durationTimer, &QTimer::timeout, [&]() {
+		stopStream();
+	});
+	if (duration > 0) {
+		durationTimer.start(duration * 1000);
+	}
+
+	if (!serialCommunication.startStream(sequence.get())) {
+		err << "Cannot start streaming the sequence" << endl;
+		return StreamError;
+	}
+
+	const int ret = app.exec();
+
+	if (traceFile.isOpen()) {
+		trace << serialCommunication.dumpPacketTrace();
+		trace.flush();
+	}
+
+	err << "Link baud rate: " << serialCommunication.linkBaudRate() << endl;
+	if (serialCommunication.pointsPerSecond() > 0.0) {
+		err << "Points per second: " << serialCommunication.pointsPerSecond() << endl;
+	}
+	if (pingInterval > 0) {
+		err << "Round trip time: mean " << serialCommunication.meanRoundTripTime() << " ms, max " << serialCommunication.maxRoundTripTime() << " ms" << endl;
+	}
+	err << "Underruns: " << serialCommunication.underruns() << endl;
+	if (parser.isSet(latencyOption) && !serialCommunication.saveLatencyStatistics(parser.value(latencyOption))) {
+		err << "Cannot save latency histograms to " << parser.value(latencyOption) << endl;
+	}
+	if (parser.isSet(telemetryOption) && !serialCommunication.saveTelemetry(parser.value(telemetryOption))) {
+		err << "Cannot save telemetry to " << parser.value(telemetryOption) << endl;
+	}
+
+	if (serialCommunication.corruptedFrames() != 0) {
+		err << "Corrupted frames: " << serialCommunication.corruptedFrames() << endl;
+	}
+
+	serialCommunication.closeSerial();
+
+	return ret;
+}